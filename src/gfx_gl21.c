@@ -22,7 +22,6 @@
 #include "map.h"
 #include "shaders.h"
 #include "util.h"
-#include "wcwidth/wcwidth.h"
 
 #define NUM_BUCKETS 256
 
@@ -65,7 +64,7 @@ DEF_VECTOR(Texture, Texture_destroy)
 
 static inline size_t Rune_hash(const Rune* self)
 {
-    return self->code;
+    return self->code ^ (size_t)self->cluster << 21;
 }
 
 static inline size_t Rune_eq(const Rune* self, const Rune* other)
@@ -1198,7 +1197,7 @@ __attribute__((hot)) static inline void _GfxOpenGL21_rasterize_line_range(
             int32_t extra_width = 0;
 
             if (idx_each_rune > 1) {
-                extra_width = wcwidth(vt_line->data.buf[idx_each_rune - 1].rune.code) - 1;
+                extra_width = vt_line->data.buf[idx_each_rune - 1].wide;
             }
             bg_pixels_end = (idx_each_rune + extra_width) * gfx->glyph_width_pixels;
             glEnable(GL_SCISSOR_TEST);
@@ -1628,10 +1627,10 @@ __attribute__((hot)) static inline void _GfxOpenGL21_rasterize_line_range(
             }
         } // end if bg color changed
 
-        int w = likely(idx_each_rune != range_end_idx)
-                  ? wcwidth(vt_line->data.buf[idx_each_rune].rune.code)
+        int w = likely(idx_each_rune != range_end_idx) && vt_line->data.buf[idx_each_rune].wide
+                  ? 2
                   : 1;
-        idx_each_rune = CLAMP(idx_each_rune + (unlikely(w > 1) ? w : 1),
+        idx_each_rune = CLAMP(idx_each_rune + w,
                               range_begin_idx,
                               (vt_line->data.size + 1));
     } // end for each VtRune
@@ -1726,14 +1725,7 @@ __attribute__((hot)) static inline void GfxOpenGL21_rasterize_line(GfxOpenGL21*
         case VT_LINE_DAMAGE_RANGE: {
             size_t range_begin_idx = vt_line->damage.front;
             size_t range_end_idx   = vt_line->damage.end + 1;
-            int    extra           = 0, tmp;
-            if ((tmp = wcwidth(vt_line->data.buf[range_end_idx - 1].rune.code)) > 1) {
-                extra = (tmp - 1);
-            }
-            if (range_end_idx &&
-                (tmp = wcwidth(vt_line->data.buf[range_end_idx - 2].rune.code)) > 2) {
-                extra = MAX(extra, tmp - 2);
-            }
+            int    extra           = vt_line->data.buf[range_end_idx - 1].wide;
             range_end_idx += extra;
             range_end_idx = MIN(range_end_idx, vt_line->data.size);
             extra         = 0;
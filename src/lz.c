@@ -0,0 +1,147 @@
+/* See LICENSE for license information. */
+
+#include "lz.h"
+
+#include <string.h>
+
+#define LZ_MIN_MATCH  4
+#define LZ_MAX_OFFSET UINT16_MAX
+#define LZ_HASH_BITS  12
+
+static inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline uint8_t* write_length(uint8_t* out, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *out++ = 255;
+    *out++ = len;
+    return out;
+}
+
+static inline uint8_t* write_sequence(uint8_t*       out,
+                                      const uint8_t* literals,
+                                      size_t         literal_len,
+                                      size_t         offset,
+                                      size_t         match_len)
+{
+    uint8_t* token = out++;
+    *token         = (literal_len < 15 ? literal_len : 15) << 4;
+    if (literal_len >= 15)
+        out = write_length(out, literal_len - 15);
+
+    memcpy(out, literals, literal_len);
+    out += literal_len;
+
+    if (match_len) {
+        match_len -= LZ_MIN_MATCH;
+        *token |= match_len < 15 ? match_len : 15;
+        *out++ = offset & 0xff;
+        *out++ = offset >> 8;
+        if (match_len >= 15)
+            out = write_length(out, match_len - 15);
+    }
+
+    return out;
+}
+
+size_t lz_compress(const void* src, size_t size, void* dst)
+{
+    const uint8_t* const begin  = src;
+    const uint8_t* const end    = begin + size;
+    const uint8_t*       ip     = begin;
+    const uint8_t*       anchor = begin;
+    uint8_t*             out    = dst;
+    uint32_t             table[1 << LZ_HASH_BITS];
+
+    memset(table, 0, sizeof(table));
+
+    while (ip + LZ_MIN_MATCH <= end) {
+        uint32_t       h         = hash32(read32(ip));
+        const uint8_t* candidate = begin + table[h];
+        table[h]                 = ip - begin;
+
+        if (candidate < ip && ip - candidate <= LZ_MAX_OFFSET &&
+            read32(candidate) == read32(ip)) {
+            size_t len = LZ_MIN_MATCH;
+            while (ip + len < end && candidate[len] == ip[len])
+                ++len;
+
+            out    = write_sequence(out, anchor, ip - anchor, ip - candidate, len);
+            ip     = ip + len;
+            anchor = ip;
+        } else {
+            ++ip;
+        }
+    }
+
+    out = write_sequence(out, anchor, end - anchor, 0, 0);
+    return out - (uint8_t*)dst;
+}
+
+static inline bool read_length(const uint8_t** in, const uint8_t* end, size_t* len)
+{
+    uint8_t b;
+    do {
+        if (*in >= end)
+            return false;
+        b = *(*in)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz_decompress(const void* src, size_t size, void* dst, size_t dst_size)
+{
+    const uint8_t*       in      = src;
+    const uint8_t* const in_end  = in + size;
+    uint8_t*             out     = dst;
+    uint8_t* const       out_end = out + dst_size;
+
+    while (in < in_end) {
+        uint8_t token       = *in++;
+        size_t  literal_len = token >> 4;
+
+        if (literal_len == 15 && !read_length(&in, in_end, &literal_len))
+            return false;
+        if (literal_len > (size_t)(in_end - in) || literal_len > (size_t)(out_end - out))
+            return false;
+
+        memcpy(out, in, literal_len);
+        in += literal_len;
+        out += literal_len;
+
+        /* last sequence */
+        if (in == in_end)
+            break;
+
+        if (in_end - in < 2)
+            return false;
+        size_t offset = in[0] | in[1] << 8;
+        in += 2;
+
+        size_t match_len = token & 0x0f;
+        if (match_len == 15 && !read_length(&in, in_end, &match_len))
+            return false;
+        match_len += LZ_MIN_MATCH;
+
+        if (!offset || offset > (size_t)(out - (uint8_t*)dst) ||
+            match_len > (size_t)(out_end - out))
+            return false;
+
+        /* may overlap the output being written */
+        for (const uint8_t* match = out - offset; match_len--;)
+            *out++ = *match++;
+    }
+
+    return out == out_end;
+}
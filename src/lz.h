@@ -0,0 +1,30 @@
+/* See LICENSE for license information. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Small LZ77 block compressor using the LZ4 block layout. Each sequence is a token byte (literal
+ * length and match length - 4 as nibbles, 15 meaning more length bytes follow), the literals, a
+ * 16 bit match offset and the remaining match length. The last sequence has literals only.
+ * Meant for data that is compressed once and rarely read back, it favors speed over ratio. */
+
+/**
+ * Largest possible output of lz_compress() for @param size bytes of input */
+static inline size_t lz_compress_bound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+/**
+ * Compress @param size bytes of @param src, @param dst must fit lz_compress_bound(size) bytes.
+ * Returns the compressed size */
+size_t lz_compress(const void* src, size_t size, void* dst);
+
+/**
+ * Decompress a block made by lz_compress(). Returns false if the block is malformed or does not
+ * decompress to exactly @param dst_size bytes */
+bool lz_decompress(const void* src, size_t size, void* dst, size_t dst_size);
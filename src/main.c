@@ -11,7 +11,13 @@
 
 #define _GNU_SOURCE
 
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <sys/eventfd.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -54,6 +60,11 @@
 #define SCROLLBAR_WIDTH_PX 10
 #endif
 
+/* While program output floods in, frames are drawn at most this often */
+#ifndef FLOOD_FRAME_INTERVAL_MS
+#define FLOOD_FRAME_INTERVAL_MS 16
+#endif
+
 typedef struct
 {
     Window_* win;
@@ -67,6 +78,11 @@ typedef struct
     bool       swap_performed;
     TimePoint* closest_pending_wakeup;
 
+    /* The last parse slice ran out of time with output left to read. Frames are not drawn before
+     * next_frame while this is set */
+    bool      input_pending;
+    TimePoint next_frame;
+
     bool exit;
 
     // selection
@@ -91,6 +107,34 @@ typedef struct
 
     Ui ui;
 
+    /* What is drawn, copied from vt when a frame starts. The ui cursor is moved to its rows */
+    VtSnapshot frame;
+    Ui         frame_ui;
+    Cursor     frame_cursor;
+
+    /* Only with settings.parse_thread, see App_parse() */
+    struct AppParser
+    {
+        bool        running;
+        pthread_t   thread;
+        atomic_bool stop;
+
+        /* Number of App_lock() calls waiting for the lock, the parser lets them go first */
+        atomic_int waiting;
+
+        /* Held while vt is used. Recursive, window system callbacks take it too and can run
+         * with it already held */
+        pthread_mutex_t lock;
+
+        /* stop_fd wakes the parser to stop, frame_fd wakes the main thread when there is
+         * something to draw or handle */
+        int stop_fd, frame_fd;
+
+        /* Vt callbacks made while parsing, handled on the main thread. Protected by lock */
+        bool  repaint_required, action_performed, bell_flash;
+        char* title;
+    } parser;
+
     enum AutoscrollDir
     {
         AUTOSCROLL_NONE = 0,
@@ -110,6 +154,26 @@ void        App_notify_content_change(void* self);
 static void App_clamp_cursor(App* self, Pair_uint32_t chars);
 static void App_set_callbacks(App* self);
 static void App_maybe_resize(App* self, Pair_uint32_t newres);
+static void App_start_parser(App* self);
+static void App_stop_parser(App* self);
+
+/**
+ * Take vt from the parser thread, if there is one */
+static inline void App_lock(App* self)
+{
+    if (self->parser.running) {
+        atomic_fetch_add(&self->parser.waiting, 1);
+        pthread_mutex_lock(&self->parser.lock);
+        atomic_fetch_sub(&self->parser.waiting, 1);
+    }
+}
+
+static inline void App_unlock(App* self)
+{
+    if (self->parser.running) {
+        pthread_mutex_unlock(&self->parser.lock);
+    }
+}
 
 void* App_load_gl_ext(const char* name)
 {
@@ -164,17 +228,123 @@ void App_init(App* self)
     self->ui.pixel_offset_y  = 0;
     self->swap_performed     = false;
     self->resolution         = size;
+    self->frame              = VtSnapshot_new();
+
+    if (settings.parse_thread) {
+        App_start_parser(self);
+    }
+}
+
+static void App_write_output(App* self)
+{
+    char*  buf;
+    size_t len;
+    Vt_get_output(&self->vt, &buf, &len);
+    if (len) {
+        Monitor_write(&self->monitor, buf, len);
+    }
+}
+
+/**
+ * Interpret program output for up to settings.parse_budget_ms and send the responses, so a fast
+ * program can not hold up input handling and drawing. Returns true if there was any output */
+static bool App_read_input(App* self)
+{
+    bool      got_input     = false;
+    ssize_t   bytes         = 0;
+    TimePoint read_deadline = TimePoint_ms_from_now(settings.parse_budget_ms);
+    do {
+        bytes = Monitor_read(&self->monitor);
+        if (bytes > 0) {
+            Vt_interpret(&self->vt, self->monitor.input, bytes);
+            got_input = true;
+        }
+    } while (bytes > 0 && !TimePoint_passed(read_deadline));
+
+    /* the last read still returned something, more is probably waiting */
+    self->input_pending = bytes > 0;
+
+    App_write_output(self);
+    return got_input;
+}
+
+/**
+ * While output floods in, the screen changes faster than it can be shown. Frames are then drawn at
+ * most every FLOOD_FRAME_INTERVAL_MS and parsing goes on in between, states between two frames are
+ * never drawn */
+static bool App_frame_due(App* self)
+{
+    return !self->input_pending || TimePoint_passed(self->next_frame);
+}
+
+/**
+ * Parser thread. Reads and interprets program output while the main thread handles the window and
+ * draws snapshots of vt, so parsing does not wait for frames */
+static void* App_parse(void* data)
+{
+    App* self = data;
+
+    while (!atomic_load(&self->parser.stop)) {
+        bool child_open = Monitor_wait_input(&self->monitor, self->parser.stop_fd);
+
+        /* mutexes are not fair, without this the main thread could wait for several slices */
+        while (atomic_load(&self->parser.waiting)) {
+            sched_yield();
+        }
+
+        pthread_mutex_lock(&self->parser.lock);
+        bool got_input = App_read_input(self);
+        if (got_input) {
+            self->parser.action_performed = true;
+        }
+        pthread_mutex_unlock(&self->parser.lock);
+
+        if (got_input) {
+            eventfd_write(self->parser.frame_fd, 1);
+        } else if (!child_open) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Do what the Vt callbacks asked for on the parser thread */
+static void App_handle_parser_requests(App* self)
+{
+    struct AppParser* parser = &self->parser;
+
+    if (parser->repaint_required) {
+        Window_notify_content_change(self->win);
+    }
+    if (parser->action_performed) {
+        Gfx_notify_action(self->gfx);
+    }
+    if (parser->bell_flash) {
+        Gfx_flash(self->gfx);
+    }
+    if (parser->title) {
+        Window_update_title(self->win, parser->title);
+        free(parser->title);
+        parser->title = NULL;
+    }
+
+    parser->repaint_required = parser->action_performed = parser->bell_flash = false;
 }
 
 void App_run(App* self)
 {
     while (!Window_is_closed(self->win) && !self->exit) {
-        int timeout_ms = self->swap_performed
+        App_lock(self);
+        int timeout_ms = self->swap_performed || Vt_is_reflow_pending(&self->vt)
                            ? 0
                            : self->closest_pending_wakeup
                                ? TimePoint_is_ms_ahead(*self->closest_pending_wakeup)
                                : -1;
+        App_unlock(self);
         Monitor_wait(&self->monitor, timeout_ms);
+        App_lock(self);
         self->closest_pending_wakeup = NULL;
         if (Monitor_are_window_system_events_pending(&self->monitor)) {
             Window_events(self->win);
@@ -184,29 +354,15 @@ void App_run(App* self)
             self->closest_pending_wakeup = pending_window_timer;
         }
 
-        char*  buf;
-        size_t len;
-        Vt_get_output(&self->vt, &buf, &len);
-        if (len) {
-            Monitor_write(&self->monitor, buf, len);
-        }
-        ssize_t bytes = 0;
-        do {
-            bytes = Monitor_read(&self->monitor);
-            if (bytes > 0) {
-                Vt_interpret(&self->vt, self->monitor.input_buffer, bytes);
-                Gfx_notify_action(self->gfx);
-            } else if (bytes < 0) {
-                break;
-            }
-        } while (bytes);
-
-        Vt_get_output(&self->vt, &buf, &len);
-        if (len) {
-            Monitor_write(&self->monitor, buf, len);
+        App_write_output(self);
+        if (self->parser.running) {
+            App_handle_parser_requests(self);
+        } else if (App_read_input(self)) {
+            Gfx_notify_action(self->gfx);
         }
 
         App_maybe_resize(self, Window_size(self->win));
+        Vt_reflow_history_step(&self->vt);
         if (self->ui.scrollbar.visible || self->vt.scrolling_visual) {
             App_do_autoscroll(self);
             App_update_scrollbar_vis(self);
@@ -225,18 +381,48 @@ void App_run(App* self)
             self->closest_pending_wakeup = closest_gfx_timer;
         }
 
-        self->swap_performed = Window_maybe_swap(self->win);
+        bool frame_due = App_frame_due(self);
+        if (!frame_due && self->win->paint &&
+            (!self->closest_pending_wakeup ||
+             TimePoint_is_earlier(self->next_frame, *self->closest_pending_wakeup))) {
+            self->closest_pending_wakeup = &self->next_frame;
+        }
+        App_unlock(self);
+
+        self->swap_performed = frame_due && Window_maybe_swap(self->win);
+        if (self->swap_performed) {
+            self->next_frame = TimePoint_ms_from_now(FLOOD_FRAME_INTERVAL_MS);
+        }
     }
+    App_stop_parser(self);
+    VtSnapshot_destroy(&self->frame);
     Vt_destroy(&self->vt);
+    Monitor_destroy(&self->monitor);
     Gfx_destroy(self->gfx);
     Freetype_destroy(&self->freetype);
     Window_destroy(self->win);
 }
 
+/**
+ * Copy what should be drawn from vt, so drawing does not have to wait for the parser */
+static void App_update_frame(App* self)
+{
+    VtSnapshot_update(&self->frame, &self->vt);
+    self->frame_ui = self->ui;
+    if (self->ui.cursor) {
+        self->frame_cursor = *self->ui.cursor;
+        self->frame_cursor.row -= MIN(self->frame_cursor.row, self->frame.top);
+        self->frame_ui.cursor = &self->frame_cursor;
+    }
+}
+
 static void App_redraw(void* self)
 {
     App* app = self;
-    Gfx_draw(app->gfx, &app->vt, &app->ui);
+    App_lock(app);
+    App_update_frame(app);
+    App_unlock(app);
+    Gfx_draw(app->gfx, &app->frame.view, &app->frame_ui);
 }
 
 static void App_update_padding(App* self)
@@ -269,7 +455,9 @@ static void App_maybe_resize(App* self, Pair_uint32_t newres)
 
 void App_clipboard_handler(void* self, const char* text)
 {
+    App_lock(self);
     Vt_handle_clipboard(&((App*)self)->vt, text);
+    App_unlock(self);
 }
 
 void App_reload_font(void* self)
@@ -277,7 +465,9 @@ void App_reload_font(void* self)
     App* app = self;
     Freetype_reload_fonts(&app->freetype);
     Gfx_reload_font(app->gfx);
-    Gfx_draw(app->gfx, &app->vt, &app->ui);
+    VtSnapshot_clear_proxies(&app->frame);
+    App_update_frame(app);
+    Gfx_draw(app->gfx, &app->frame.view, &app->frame_ui);
     App_update_padding(self);
     Window_notify_content_change(app->win);
     Window_maybe_swap(app->win);
@@ -573,6 +763,7 @@ static bool App_maybe_handle_application_key(App*     self,
         return true;
     } else if (KeyCommand_is_active(&settings.key_commands[KCMD_DEBUG], key, rawkey, mods)) {
         Vt_dump_info(vt);
+        Monitor_dump_info(&self->monitor);
         return true;
     } else if (KeyCommand_is_active(&settings.key_commands[KCMD_UNICODE_ENTRY],
                                     key,
@@ -595,11 +786,13 @@ static bool App_maybe_handle_application_key(App*     self,
 
 void App_key_handler(void* self, uint32_t key, uint32_t rawkey, uint32_t mods)
 {
+    App_lock(self);
     if (!App_maybe_handle_application_key(self, key, rawkey, mods)) {
         App* app = self;
         Window_set_pointer_style(app->win, MOUSE_POINTER_HIDDEN);
         Vt_handle_key(&app->vt, key, rawkey, mods);
     }
+    App_unlock(self);
 }
 
 static void App_update_cursor(App* self)
@@ -901,6 +1094,7 @@ void App_button_handler(void*    self,
                         int32_t  ammount,
                         uint32_t mods)
 {
+    App_lock(self);
     App* app             = self;
     Vt*  vt              = &app->vt;
     x                    = CLAMP(x - app->ui.pixel_offset_x, 0, (int32_t)app->resolution.first);
@@ -927,16 +1121,110 @@ void App_button_handler(void*    self,
                !App_maybe_consume_click(self, button, state, x, y, mods)) {
         Vt_handle_button(vt, button, state, x, y, ammount, mods);
     }
+    App_unlock(self);
 }
 
 void App_motion_handler(void* self, uint32_t button, int32_t x, int32_t y)
 {
+    App_lock(self);
     App* app = self;
     x        = CLAMP(x - app->ui.pixel_offset_x, 0, (int32_t)app->resolution.first);
     y        = CLAMP(y - app->ui.pixel_offset_y, 0, (int32_t)app->resolution.second);
     if (!App_scrollbar_consume_drag(self, button, x, y) && !App_consume_drag(self, button, x, y)) {
         Vt_handle_motion(&app->vt, button, x, y);
     }
+    App_unlock(self);
+}
+
+/* Vt callbacks with a parser thread. They only record the request, App_run() handles it */
+static void App_parser_repaint_required(void* self)
+{
+    App* app                     = self;
+    app->parser.repaint_required = true;
+    eventfd_write(app->parser.frame_fd, 1);
+}
+
+static void App_parser_action_performed(void* self)
+{
+    ((App*)self)->parser.action_performed = true;
+}
+
+static void App_parser_bell_flash(void* self)
+{
+    App* app               = self;
+    app->parser.bell_flash = true;
+    eventfd_write(app->parser.frame_fd, 1);
+}
+
+static void App_parser_title_changed(void* self, const char* title)
+{
+    App* app = self;
+    free(app->parser.title);
+    app->parser.title = strdup(title);
+    eventfd_write(app->parser.frame_fd, 1);
+}
+
+static void App_start_parser(App* self)
+{
+    struct AppParser* parser = &self->parser;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&parser->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    parser->stop_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    parser->frame_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (parser->stop_fd < 0 || parser->frame_fd < 0) {
+        ERR("Failed to create eventfd %s", strerror(errno));
+    }
+
+    self->vt.callbacks.on_repaint_required = App_parser_repaint_required;
+    self->vt.callbacks.on_action_performed = App_parser_action_performed;
+    self->vt.callbacks.on_bell_flash       = App_parser_bell_flash;
+    self->vt.callbacks.on_title_changed    = App_parser_title_changed;
+    Monitor_watch_input_notify_fd(&self->monitor, parser->frame_fd);
+    parser->running = true;
+
+    /* SIGCHLD should be handled on the main thread */
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    int err = pthread_create(&parser->thread, NULL, App_parse, self);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (err) {
+        WRN("Failed to start parser thread: %s\n", strerror(err));
+        parser->running = false;
+        App_set_callbacks(self);
+        Monitor_watch_input_notify_fd(&self->monitor, -1);
+        close(parser->stop_fd);
+        close(parser->frame_fd);
+        pthread_mutex_destroy(&parser->lock);
+    }
+}
+
+static void App_stop_parser(App* self)
+{
+    struct AppParser* parser = &self->parser;
+
+    if (!parser->running) {
+        return;
+    }
+
+    atomic_store(&parser->stop, true);
+    eventfd_write(parser->stop_fd, 1);
+    pthread_join(parser->thread, NULL);
+    parser->running = false;
+
+    Monitor_watch_input_notify_fd(&self->monitor, -1);
+    close(parser->stop_fd);
+    close(parser->frame_fd);
+    pthread_mutex_destroy(&parser->lock);
+    free(parser->title);
+    parser->title = NULL;
 }
 
 static void App_set_callbacks(App* self)
@@ -2,12 +2,16 @@
 
 #include "monitor.h"
 
+#include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
+#include <sys/eventfd.h>
 #include <sys/poll.h>
 #include <sys/wait.h>
 #include <utmp.h>
 
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -42,6 +46,165 @@ void sighandler(int sig)
     }
 }
 
+/**
+ * Single producer, single consumer ring buffer. head and tail count all bytes ever written and
+ * consumed. Each side stores its own counter and then loads the other one, so at least one of
+ * them sees that the other has to be woken up:
+ * - the thread signals data_fd when the main thread had consumed everything it wrote before,
+ * - the main thread signals space_fd when the thread waits for room (blocked is set).
+ * space_fd also wakes the thread to stop. */
+struct MonitorReader
+{
+    pthread_t thread;
+    int       fd, data_fd, space_fd;
+
+    atomic_bool      stop, blocked;
+    _Atomic uint64_t syscalls;
+
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+
+    _Alignas(64) char ring[MONITOR_RING_SIZE];
+};
+
+static void MonitorReader_wait(int fd, int event_fd)
+{
+    struct pollfd pfds[2] = {
+        { .fd = fd, .events = POLLIN },
+        { .fd = event_fd, .events = POLLIN },
+    };
+    if (poll(pfds, 2, -1) < 0 && errno != EINTR) {
+        ERR("poll failed %s", strerror(errno));
+    }
+
+    eventfd_t value;
+    if (pfds[1].revents & POLLIN) {
+        eventfd_read(event_fd, &value);
+    }
+}
+
+static void* MonitorReader_run(void* data)
+{
+    MonitorReader* self = data;
+    size_t         head = 0;
+
+    while (!atomic_load(&self->stop)) {
+        size_t used = head - atomic_load(&self->tail);
+
+        if (used == MONITOR_RING_SIZE) {
+            atomic_store(&self->blocked, true);
+            if (head - atomic_load(&self->tail) == MONITOR_RING_SIZE) {
+                /* poll() skips negative descriptors */
+                MonitorReader_wait(-1, self->space_fd);
+            }
+            atomic_store(&self->blocked, false);
+            continue;
+        }
+
+        size_t  offset = head & (MONITOR_RING_SIZE - 1);
+        ssize_t rd     = read(self->fd,
+                          self->ring + offset,
+                          MIN(MONITOR_RING_SIZE - used, MONITOR_RING_SIZE - offset));
+        atomic_fetch_add_explicit(&self->syscalls, 1, memory_order_relaxed);
+
+        if (rd > 0) {
+            size_t old_head = head;
+            head += rd;
+            atomic_store(&self->head, head);
+            if (atomic_load(&self->tail) == old_head) {
+                eventfd_write(self->data_fd, 1);
+            }
+        } else if (rd < 0 && errno == EAGAIN) {
+            MonitorReader_wait(self->fd, self->space_fd);
+        } else if (rd < 0 && errno == EINTR) {
+            continue;
+        } else {
+            /* EIO or 0 when the child closed its end */
+            eventfd_write(self->data_fd, 1);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void Monitor_start_reader(Monitor* self)
+{
+    MonitorReader* reader = calloc(1, sizeof(MonitorReader));
+    reader->fd            = self->child_fd;
+    reader->data_fd       = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    reader->space_fd      = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (reader->data_fd < 0 || reader->space_fd < 0) {
+        ERR("Failed to create eventfd %s", strerror(errno));
+    }
+
+    /* SIGCHLD should be handled on the main thread */
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    int err = pthread_create(&reader->thread, NULL, MonitorReader_run, reader);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (err) {
+        WRN("Failed to start reader thread: %s\n", strerror(err));
+        close(reader->data_fd);
+        close(reader->space_fd);
+        free(reader);
+        return;
+    }
+
+    self->reader = reader;
+}
+
+static void Monitor_stop_reader(Monitor* self)
+{
+    MonitorReader* reader = self->reader;
+    atomic_store(&reader->stop, true);
+    eventfd_write(reader->space_fd, 1);
+    pthread_join(reader->thread, NULL);
+
+    close(reader->data_fd);
+    close(reader->space_fd);
+    free(reader);
+    self->reader = NULL;
+}
+
+/**
+ * Bytes in the ring not returned by Monitor_read() yet */
+static size_t Monitor_ring_pending(Monitor* self)
+{
+    return atomic_load(&self->reader->head) - atomic_load(&self->reader->tail) - self->input_batch;
+}
+
+/**
+ * Release the previous batch and take the next contiguous part of the ring */
+static ssize_t Monitor_read_ring(Monitor* self)
+{
+    MonitorReader* reader = self->reader;
+    size_t         tail   = atomic_load_explicit(&reader->tail, memory_order_relaxed);
+
+    if (self->input_batch) {
+        tail += self->input_batch;
+        atomic_store(&reader->tail, tail);
+        if (atomic_load(&reader->blocked)) {
+            eventfd_write(reader->space_fd, 1);
+        }
+    }
+
+    size_t offset     = tail & (MONITOR_RING_SIZE - 1);
+    size_t available  = atomic_load(&reader->head) - tail;
+    self->input_batch = MIN(available, MONITOR_RING_SIZE - offset);
+
+    if (!self->input_batch) {
+        return -1;
+    }
+
+    self->input = reader->ring + offset;
+    return self->input_batch;
+}
+
 Monitor Monitor_new()
 {
     static bool instances_initialized = false;
@@ -50,8 +213,12 @@ Monitor Monitor_new()
         instances             = Vector_new_MonitorInfo();
     }
     Monitor self;
-    self.extra_fd      = 0;
-    self.child_is_dead = true;
+    memset(&self, 0, sizeof(self));
+    self.extra_fd          = 0;
+    self.input_notify_fd   = -1;
+    self.child_is_dead     = true;
+    self.input_buffer_size = MONITOR_INPUT_BUFFER_MIN;
+    self.input_buffer      = malloc(self.input_buffer_size);
 
     return self;
 }
@@ -65,6 +232,10 @@ void Monitor_fork_new_pty(Monitor* self, uint32_t cols, uint32_t rows)
 
     struct winsize ws = { .ws_col = cols, .ws_row = rows };
     openpty(&self->child_fd, &self->parent_fd, NULL, NULL, &ws);
+
+    /* reads drain everything that is available without waiting for more */
+    fcntl(self->child_fd, F_SETFL, fcntl(self->child_fd, F_GETFL) | O_NONBLOCK);
+
     self->child_pid = fork();
     if (self->child_pid == 0) {
         close(self->child_fd);
@@ -95,59 +266,288 @@ void Monitor_fork_new_pty(Monitor* self, uint32_t cols, uint32_t rows)
         ERR("Failed to fork process %s", strerror(errno));
     }
     close(self->parent_fd);
+
+    pthread_mutex_init(&self->output_lock, NULL);
+
+    if (settings.reader_thread) {
+        Monitor_start_reader(self);
+    }
+
     Vector_push_MonitorInfo(&instances,
                             (MonitorInfo){ .child_pid = self->child_pid, .instance = self });
     self->child_is_dead = false;
 }
 
+/**
+ * write() without blocking. Returns the number of bytes written or -1 if the child closed its end.
+ * output_lock is held */
+static ssize_t Monitor_write_some(Monitor* self, const char* buffer, size_t bytes)
+{
+    size_t written = 0;
+    while (written < bytes) {
+        ssize_t wr = write(self->child_fd, buffer + written, bytes - written);
+        ++self->write_stats.syscalls;
+
+        if (wr > 0) {
+            written += wr;
+        } else if (wr < 0 && errno == EINTR) {
+            continue;
+        } else if (wr < 0 && errno == EAGAIN) {
+            ++self->write_stats.stalls;
+            break;
+        } else {
+            return -1;
+        }
+    }
+
+    self->write_stats.bytes += written;
+    return written;
+}
+
+/**
+ * Append to the output queue. output_lock is held */
+static void Monitor_queue_output(Monitor* self, const char* buffer, size_t bytes)
+{
+    size_t waiting = self->output_queued - self->output_sent;
+
+    if (self->output_sent) {
+        memmove(self->output_queue, self->output_queue + self->output_sent, waiting);
+        self->output_sent   = 0;
+        self->output_queued = waiting;
+    }
+
+    if (waiting + bytes > self->output_queue_cap) {
+        self->output_queue_cap = MAX(self->output_queue_cap * 2, waiting + bytes);
+        self->output_queue     = realloc(self->output_queue, self->output_queue_cap);
+    }
+
+    memcpy(self->output_queue + waiting, buffer, bytes);
+    self->output_queued += bytes;
+
+    self->write_stats.queued_bytes += bytes;
+    self->write_stats.max_queued = MAX(self->write_stats.max_queued, waiting + bytes);
+
+    if (unlikely(settings.debug_pty)) {
+        fprintf(stderr, "pty.write queued %zu bytes, %zu waiting\n", bytes, waiting + bytes);
+    }
+}
+
+/**
+ * Drop the output queue, e.g. after everything was sent */
+static void Monitor_clear_output_queue(Monitor* self)
+{
+    free(self->output_queue);
+    self->output_queue     = NULL;
+    self->output_queue_cap = 0;
+    self->output_sent      = 0;
+    self->output_queued    = 0;
+}
+
+/**
+ * Send as much of the output queue as the child takes */
+static void Monitor_flush_output(Monitor* self)
+{
+    pthread_mutex_lock(&self->output_lock);
+
+    ssize_t wr = Monitor_write_some(self,
+                                    self->output_queue + self->output_sent,
+                                    self->output_queued - self->output_sent);
+
+    /* nobody will read it if the child is gone */
+    if (wr < 0 || (self->output_sent += wr) == self->output_queued) {
+        Monitor_clear_output_queue(self);
+    }
+
+    pthread_mutex_unlock(&self->output_lock);
+}
+
 bool Monitor_wait(Monitor* self, int timeout)
 {
+    bool notify = self->input_notify_fd >= 0;
+
+    pthread_mutex_lock(&self->output_lock);
+    bool output_pending = self->output_sent < self->output_queued;
+    pthread_mutex_unlock(&self->output_lock);
+
     memset(self->pollfds, 0, sizeof(self->pollfds));
-    self->pollfds[CHILD_FD_IDX].fd     = self->child_fd;
+    self->pollfds[CHILD_FD_IDX].fd     = notify         ? self->input_notify_fd
+                                         : self->reader ? self->reader->data_fd
+                                                        : self->child_fd;
     self->pollfds[CHILD_FD_IDX].events = POLLIN;
     self->pollfds[EXTRA_FD_IDX].fd     = self->extra_fd;
     self->pollfds[EXTRA_FD_IDX].events = POLLIN;
 
-    if (poll(self->pollfds, 2, timeout) < 0) {
+    /* poll() skips negative descriptors */
+    self->pollfds[OUTPUT_FD_IDX].fd     = output_pending ? self->child_fd : -1;
+    self->pollfds[OUTPUT_FD_IDX].events = POLLOUT;
+
+    if (!notify && self->reader && Monitor_ring_pending(self)) {
+        timeout = 0;
+    }
+
+    if (poll(self->pollfds, ARRAY_SIZE(self->pollfds), timeout) < 0) {
         ERR("poll failed %s", strerror(errno));
     }
 
-    self->read_info_up_to_date = true;
+    if (self->pollfds[OUTPUT_FD_IDX].revents) {
+        Monitor_flush_output(self);
+    }
+
+    if ((notify || self->reader) && (self->pollfds[CHILD_FD_IDX].revents & POLLIN)) {
+        eventfd_t value;
+        eventfd_read(self->pollfds[CHILD_FD_IDX].fd, &value);
+    }
+
+    /* the thread reading the child waits on its own */
+    if (!notify) {
+        self->read_info_up_to_date = true;
+    }
     return false;
 }
 
+bool Monitor_wait_input(Monitor* self, int wake_fd)
+{
+    struct pollfd pfds[2] = {
+        { .fd = self->reader ? self->reader->data_fd : self->child_fd, .events = POLLIN },
+        { .fd = wake_fd, .events = POLLIN },
+    };
+
+    if (poll(pfds, 2, self->reader && Monitor_ring_pending(self) ? 0 : -1) < 0 && errno != EINTR) {
+        ERR("poll failed %s", strerror(errno));
+    }
+
+    eventfd_t value;
+    if (self->reader && (pfds[0].revents & POLLIN)) {
+        eventfd_read(self->reader->data_fd, &value);
+    }
+    if (pfds[1].revents & POLLIN) {
+        eventfd_read(wake_fd, &value);
+    }
+
+    return (pfds[0].revents & POLLIN) || !(pfds[0].revents & (POLLHUP | POLLERR));
+}
+
+static uint64_t Monitor_syscalls(Monitor* self)
+{
+    return self->read_stats.syscalls +
+           (self->reader ? atomic_load_explicit(&self->reader->syscalls, memory_order_relaxed) : 0);
+}
+
+static void Monitor_count_batch(Monitor* self, size_t bytes)
+{
+    self->read_stats.bytes += bytes;
+    ++self->read_stats.batches;
+
+    if (unlikely(settings.debug_pty)) {
+        fprintf(stderr,
+                "pty.read batch of %zu bytes, buffer %zu KiB, %.1f syscalls/MB\n",
+                bytes,
+                (self->reader ? MONITOR_RING_SIZE : self->input_buffer_size) >> 10,
+                Monitor_syscalls(self) / (self->read_stats.bytes / 1048576.0));
+    }
+}
+
+/**
+ * Size the input buffer for the amount of data the last read returned. The previous batch is no
+ * longer used, so its contents don't have to be kept */
+static void Monitor_fit_input_buffer(Monitor* self)
+{
+    size_t size = self->input_buffer_size;
+
+    if (!self->input_batch) {
+        return;
+    }
+
+    if (self->input_batch == size && size < MONITOR_INPUT_BUFFER_MAX) {
+        size *= 2;
+    } else if (self->input_batch < size / 8 && size > MONITOR_INPUT_BUFFER_MIN) {
+        if (++self->input_small_batches >= MONITOR_INPUT_SHRINK_BATCHES) {
+            size /= 2;
+        }
+    } else {
+        self->input_small_batches = 0;
+    }
+
+    if (size != self->input_buffer_size) {
+        free(self->input_buffer);
+        self->input_buffer        = malloc(size);
+        self->input_buffer_size   = size;
+        self->input_small_batches = 0;
+    }
+}
+
 ssize_t Monitor_read(Monitor* self)
 {
     if (unlikely(self->child_is_dead)) {
         return -1;
     }
 
-    if (!self->read_info_up_to_date) {
-        memset(self->pollfds, 0, sizeof(self->pollfds[0]));
-        self->pollfds[CHILD_FD_IDX].fd     = self->child_fd;
-        self->pollfds[CHILD_FD_IDX].events = POLLIN;
-        if (poll(self->pollfds, 1, 0) < 0) {
-            ERR("poll failed %s", strerror(errno));
+    if (self->reader) {
+        ssize_t rd = Monitor_read_ring(self);
+        if (rd > 0) {
+            Monitor_count_batch(self, rd);
         }
-        self->read_info_up_to_date = true;
+        return rd;
     }
 
-    if (self->pollfds[CHILD_FD_IDX].revents & POLLIN) {
-        ssize_t rd = read(self->child_fd, self->input_buffer, sizeof(self->input_buffer));
-        if (rd < 0) {
-            return -1;
-        }
-        self->read_info_up_to_date = false;
-        return rd;
-    } else {
+    /* Monitor_wait() already told us there is nothing to read */
+    if (self->read_info_up_to_date && !(self->pollfds[CHILD_FD_IDX].revents & POLLIN)) {
         self->read_info_up_to_date = false;
+        self->input_batch          = 0;
         return -1;
     }
+    self->read_info_up_to_date = false;
+
+    Monitor_fit_input_buffer(self);
+
+    size_t total = 0;
+    while (total < self->input_buffer_size) {
+        ssize_t rd =
+          read(self->child_fd, self->input_buffer + total, self->input_buffer_size - total);
+        ++self->read_stats.syscalls;
+
+        if (rd > 0) {
+            total += rd;
+        } else if (rd < 0 && errno == EINTR) {
+            continue;
+        } else {
+            /* EAGAIN when drained, EIO or 0 when the child closed its end */
+            break;
+        }
+    }
+
+    self->input       = self->input_buffer;
+    self->input_batch = total;
+    if (!total) {
+        return -1;
+    }
+
+    Monitor_count_batch(self, total);
+    return total;
 }
 
 ssize_t Monitor_write(Monitor* self, char* buffer, size_t bytes)
 {
-    return write(self->child_fd, buffer, bytes);
+    /* Waiting for room here could deadlock with a child that is itself blocked writing to us, keep
+     * what does not fit until Monitor_wait() finds the pty writable */
+    pthread_mutex_lock(&self->output_lock);
+
+    size_t written = 0;
+    if (self->output_sent == self->output_queued) {
+        ssize_t wr = Monitor_write_some(self, buffer, bytes);
+        if (wr < 0) {
+            pthread_mutex_unlock(&self->output_lock);
+            return -1;
+        }
+        written = wr;
+    }
+
+    if (written < bytes) {
+        Monitor_queue_output(self, buffer + written, bytes - written);
+    }
+
+    pthread_mutex_unlock(&self->output_lock);
+    return bytes;
 }
 
 void Monitor_kill(Monitor* self)
@@ -158,11 +558,60 @@ void Monitor_kill(Monitor* self)
     self->child_pid = 0;
 }
 
+void Monitor_destroy(Monitor* self)
+{
+    if (self->reader) {
+        Monitor_stop_reader(self);
+    }
+    free(self->input_buffer);
+    self->input_buffer = NULL;
+    Monitor_clear_output_queue(self);
+    pthread_mutex_destroy(&self->output_lock);
+}
+
+void Monitor_dump_info(Monitor* self)
+{
+    struct MonitorReadStats* stats    = &self->read_stats;
+    uint64_t                 syscalls = Monitor_syscalls(self);
+
+    printf("\nPty reads%s:\n", self->reader ? " (reader thread)" : "");
+    printf("  bytes read:                       %lu\n", stats->bytes);
+    printf("  read() calls:                     %lu (%.1f per MB)\n",
+           syscalls,
+           stats->bytes ? syscalls / (stats->bytes / 1048576.0) : 0.0);
+    printf("  batches:                          %lu (%.1f KiB average)\n",
+           stats->batches,
+           stats->batches ? stats->bytes / 1024.0 / stats->batches : 0.0);
+    if (self->reader) {
+        printf("  unread in ring:                   %zu\n", Monitor_ring_pending(self));
+    } else {
+        printf("  input buffer:                     %zu KiB\n", self->input_buffer_size >> 10);
+    }
+
+    pthread_mutex_lock(&self->output_lock);
+    struct MonitorWriteStats* wstats = &self->write_stats;
+    printf("\nPty writes:\n");
+    printf("  bytes written:                    %lu\n", wstats->bytes);
+    printf("  write() calls:                    %lu\n", wstats->syscalls);
+    printf("  found the pty full:               %lu times\n", wstats->stalls);
+    printf("  bytes queued:                     %lu (at most %zu at once)\n",
+           wstats->queued_bytes,
+           wstats->max_queued);
+    printf("  waiting in queue:                 %zu\n",
+           self->output_queued - self->output_sent);
+    pthread_mutex_unlock(&self->output_lock);
+}
+
 void Monitor_watch_window_system_fd(Monitor* self, int fd)
 {
     self->extra_fd = fd;
 }
 
+void Monitor_watch_input_notify_fd(Monitor* self, int fd)
+{
+    self->input_notify_fd = fd;
+}
+
 /**
  * Ensure the child proceses are killed even if we segfault */
 __attribute__((destructor)) void destructor()
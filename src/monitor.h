@@ -13,25 +13,75 @@
 #include <termios.h>
 #endif
 
+#include <pthread.h>
 #include <sys/poll.h>
 
 #include "settings.h"
 #include "util.h"
 
-#ifndef MONITOR_INPUT_BUFFER_SZ
-#define MONITOR_INPUT_BUFFER_SZ 128
+/* Size limits of the buffer data from the child is read into. It doubles when a read fills it and
+ * halves after MONITOR_INPUT_SHRINK_BATCHES reads in a row used less than an eighth of it */
+#ifndef MONITOR_INPUT_BUFFER_MIN
+#define MONITOR_INPUT_BUFFER_MIN (64 << 10)
 #endif
 
+#ifndef MONITOR_INPUT_BUFFER_MAX
+#define MONITOR_INPUT_BUFFER_MAX (1 << 20)
+#endif
+
+#ifndef MONITOR_INPUT_SHRINK_BATCHES
+#define MONITOR_INPUT_SHRINK_BATCHES 64
+#endif
+
+/* Size of the buffer the reader thread fills with settings.reader_thread, a power of two */
+#ifndef MONITOR_RING_SIZE
+#define MONITOR_RING_SIZE (4 << 20)
+#endif
+
+/* Thread moving data from the pty into a ring buffer, see monitor.c */
+typedef struct MonitorReader MonitorReader;
+
 typedef struct
 {
     int           child_fd, parent_fd, extra_fd;
-    struct pollfd pollfds[2];
-#define CHILD_FD_IDX 0
-#define EXTRA_FD_IDX 1
+    struct pollfd pollfds[3];
+#define CHILD_FD_IDX  0
+#define EXTRA_FD_IDX  1
+#define OUTPUT_FD_IDX 2
     bool  read_info_up_to_date;
     pid_t child_pid;
     bool  child_is_dead;
-    char  input_buffer[MONITOR_INPUT_BUFFER_SZ];
+
+    /* Data returned by the last Monitor_read(), in input_buffer or the ring of the reader */
+    char*    input;
+    char*    input_buffer;
+    size_t   input_buffer_size, input_batch;
+    uint32_t input_small_batches;
+
+    /* Only with settings.reader_thread */
+    MonitorReader* reader;
+
+    /* Polled instead of the child when another thread reads it, -1 if unused */
+    int input_notify_fd;
+
+    struct MonitorReadStats
+    {
+        uint64_t bytes, syscalls, batches;
+    } read_stats;
+
+    /* Data the child did not take yet, bytes from output_sent to output_queued are sent when
+     * Monitor_wait() finds it writable. Locked, since Monitor_write() may be called by another
+     * thread */
+    pthread_mutex_t output_lock;
+    char*           output_queue;
+    size_t          output_sent, output_queued, output_queue_cap;
+
+    struct MonitorWriteStats
+    {
+        /* stalls counts writes that found the pty full */
+        uint64_t bytes, syscalls, stalls, queued_bytes;
+        size_t   max_queued;
+    } write_stats;
 
     struct MonitorCallbacks
     {
@@ -50,25 +100,45 @@ Monitor Monitor_new();
 void Monitor_fork_new_pty(Monitor* self, uint32_t cols, uint32_t rows);
 
 /**
- * Wait for any activity */
+ * Wait for any activity. Sends queued output if the child can take it */
 bool Monitor_wait(Monitor* self, int timeout);
 
 /**
- * Try to read data from the child process */
+ * Wait for data from the child or for @param wake_fd (an eventfd) to be signaled, for a thread
+ * that reads the child while another one uses Monitor_wait(). Returns false if the child closed its
+ * end */
+bool Monitor_wait_input(Monitor* self, int wake_fd);
+
+/**
+ * Try to read data from the child process. Reads until there is nothing more or the input buffer is
+ * full, the data is at input until the next call. With a reader thread this takes the data it
+ * already read */
 ssize_t Monitor_read(Monitor* self);
 
 /**
- * Write data to the child process */
+ * Write data to the child process without blocking. What does not fit in the pty is queued and sent
+ * from Monitor_wait(). Returns @param bytes or -1 if the child closed its end */
 ssize_t Monitor_write(Monitor* self, char* buffer, size_t bytes);
 
 /**
  * Kill the child process */
 void Monitor_kill(Monitor* self);
 
+void Monitor_destroy(Monitor* self);
+
+/**
+ * Print read and write statistics */
+void Monitor_dump_info(Monitor* self);
+
 /**
  * Set an extra file descriptor to monitor for activity when wait()-ing */
 void Monitor_watch_window_system_fd(Monitor* self, int fd);
 
+/**
+ * Make Monitor_wait() poll @param fd (an eventfd) instead of the child, when Monitor_read() is only
+ * called by another thread. -1 to undo */
+void Monitor_watch_input_notify_fd(Monitor* self, int fd);
+
 /**
  * Check read can be performed on the 'extra' fd */
 static bool Monitor_are_window_system_events_pending(Monitor* self)
@@ -163,46 +163,61 @@ static struct option long_options[] = {
 #define OPT_SCROLLBACK_IDX 46
     [OPT_SCROLLBACK_IDX] = { "scrollback", required_argument, 0, 0 },
 
-#define OPT_BIND_KEY_COPY_IDX 47
+#define OPT_SCROLLBACK_SPILL_IDX 47
+    [OPT_SCROLLBACK_SPILL_IDX] = { "scrollback-spill", no_argument, 0, 0 },
+
+#define OPT_SCROLLBACK_DEDUP_IDX 48
+    [OPT_SCROLLBACK_DEDUP_IDX] = { "scrollback-dedup", no_argument, 0, 0 },
+
+#define OPT_READER_THREAD_IDX 49
+    [OPT_READER_THREAD_IDX] = { "reader-thread", no_argument, 0, 0 },
+
+#define OPT_PARSE_THREAD_IDX 50
+    [OPT_PARSE_THREAD_IDX] = { "parse-thread", no_argument, 0, 0 },
+
+#define OPT_PARSE_BUDGET_IDX 51
+    [OPT_PARSE_BUDGET_IDX] = { "parse-budget", required_argument, 0, 0 },
+
+#define OPT_BIND_KEY_COPY_IDX 52
     [OPT_BIND_KEY_COPY_IDX] = { "bind-key-copy", required_argument, 0, 0 },
 
-#define OPT_BIND_KEY_PASTE_IDX 48
+#define OPT_BIND_KEY_PASTE_IDX 53
     [OPT_BIND_KEY_PASTE_IDX] = { "bind-key-paste", required_argument, 0, 0 },
 
-#define OPT_BIND_KEY_ENLARGE_IDX 49
+#define OPT_BIND_KEY_ENLARGE_IDX 54
     [OPT_BIND_KEY_ENLARGE_IDX] = { "bind-key-enlarge", required_argument, 0, 0 },
 
-#define OPT_BIND_KEY_SHRINK_IDX 50
+#define OPT_BIND_KEY_SHRINK_IDX 55
     [OPT_BIND_KEY_SHRINK_IDX] = { "bind-key-shrink", required_argument, 0, 0 },
 
-#define OPT_BIND_KEY_UNI_IDX 51
+#define OPT_BIND_KEY_UNI_IDX 56
     [OPT_BIND_KEY_UNI_IDX] = { "bind-key-uni", required_argument, 0, 0 },
 
-#define OPT_BIND_KEY_KSM_IDX 52
+#define OPT_BIND_KEY_KSM_IDX 57
     [OPT_BIND_KEY_KSM_IDX] = { "bind-key-ksm", required_argument, 0, 0 },
 
-#define OPT_BIND_KEY_DEBUG_IDX 53
+#define OPT_BIND_KEY_DEBUG_IDX 58
     [OPT_BIND_KEY_DEBUG_IDX] = { "bind-key-debug", required_argument, 0, 0 },
 
-#define OPT_BIND_KEY_QUIT_IDX 54
+#define OPT_BIND_KEY_QUIT_IDX 59
     [OPT_BIND_KEY_QUIT_IDX] = { "bind-key-quit", required_argument, 0, 0 },
 
-#define OPT_DEBUG_PTY_IDX 55
+#define OPT_DEBUG_PTY_IDX 60
     [OPT_DEBUG_PTY_IDX] = { "debug-pty", no_argument, 0, 'D' },
 
-#define OPT_DEBUG_GFX_IDX 56
+#define OPT_DEBUG_GFX_IDX 61
     [OPT_DEBUG_GFX_IDX] = { "debug-gfx", no_argument, 0, 'G' },
 
-#define OPT_DEBUG_FONT_IDX 57
+#define OPT_DEBUG_FONT_IDX 62
     [OPT_DEBUG_FONT_IDX] = { "debug-font", no_argument, 0, 'F' },
 
-#define OPT_VERSION_IDX 58
+#define OPT_VERSION_IDX 63
     [OPT_VERSION_IDX] = { "version", no_argument, 0, 'v' },
 
-#define OPT_HELP_IDX 59
+#define OPT_HELP_IDX 64
     [OPT_HELP_IDX] = { "help", no_argument, 0, 'h' },
 
-#define OPT_SENTINEL_IDX 60
+#define OPT_SENTINEL_IDX 65
     [OPT_SENTINEL_IDX] = { 0 }
 };
 
@@ -265,6 +280,20 @@ static const char* long_options_descriptions[][2] = {
 
     [OPT_SCROLL_LINES_IDX] = { arg_int, "Lines scrolled per wheel click (default: 3)" },
     [OPT_SCROLLBACK_IDX]   = { arg_int, "Set scrollback buffer size (default: 2000)" },
+    [OPT_SCROLLBACK_SPILL_IDX] = { NULL,
+                                   "Move lines past the scrollback size to a temporary file "
+                                   "instead of discarding them" },
+    [OPT_SCROLLBACK_DEDUP_IDX] = { NULL,
+                                   "Share one copy of identical lines in the scrollback" },
+    [OPT_READER_THREAD_IDX] = { NULL,
+                                "Read program output on a separate thread, so it is not stopped "
+                                "while a frame is drawn" },
+    [OPT_PARSE_THREAD_IDX] = { NULL,
+                               "Interpret program output on a separate thread, frames are drawn "
+                               "from a copy of the screen" },
+    [OPT_PARSE_BUDGET_IDX] = { arg_int,
+                               "Time spent interpreting program output before handling input "
+                               "and drawing [ms] (default: 8)" },
     [OPT_PADDING_IDX]      = { "bool:int?",
                           "Pad screen content: center:extra padding[px] (default: true:0)" },
 
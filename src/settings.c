@@ -491,7 +491,13 @@ static void settings_make_default()
 
         .allow_multiple_underlines = false,
 
-        .scrollback = 2000,
+        .scrollback       = 2000,
+        .scrollback_spill = false,
+        .scrollback_dedup = false,
+
+        .reader_thread   = false,
+        .parse_thread    = false,
+        .parse_budget_ms = 8,
 
         .debug_pty = false,
         .debug_gfx = false,
@@ -576,12 +582,6 @@ static void print_version_and_exit()
            "disabled"
 #else
            "enabled"
-#endif
-           "\n utf8proc: "
-#ifdef NOUTF8PROC
-           "disabled"
-#else
-           "enabled"
 #endif
            "\n");
 
@@ -683,6 +683,26 @@ static void handle_option(const char opt, const int array_index, const char* val
             settings.scrollback = MAX(strtol(value, NULL, 10), 0);
             break;
 
+        case OPT_SCROLLBACK_SPILL_IDX:
+            settings.scrollback_spill = value ? strtob(value) : true;
+            break;
+
+        case OPT_SCROLLBACK_DEDUP_IDX:
+            settings.scrollback_dedup = value ? strtob(value) : true;
+            break;
+
+        case OPT_READER_THREAD_IDX:
+            settings.reader_thread = value ? strtob(value) : true;
+            break;
+
+        case OPT_PARSE_THREAD_IDX:
+            settings.parse_thread = value ? strtob(value) : true;
+            break;
+
+        case OPT_PARSE_BUDGET_IDX:
+            settings.parse_budget_ms = MAX(strtol(value, NULL, 10), 0);
+            break;
+
         case OPT_VERSION_IDX:
             print_version_and_exit();
             break;
@@ -139,6 +139,12 @@ typedef struct
     bool debug_font;
 
     uint32_t scrollback;
+    bool     scrollback_spill;
+    bool     scrollback_dedup;
+
+    bool     reader_thread;
+    bool     parse_thread;
+    uint32_t parse_budget_ms;
 
     bool    enable_cursor_blink;
     int32_t cursor_blink_interval_ms;
@@ -0,0 +1,153 @@
+/* See LICENSE for license information. */
+
+#define _GNU_SOURCE
+
+#include "spill.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "util.h"
+
+/* Mappings grow by at least this much, so they are rarely replaced */
+#define SPILL_MAP_GRANULARITY (64 << 20)
+
+static int Spill_create_file()
+{
+    const char* dir = getenv("TMPDIR");
+
+    if (!dir || !*dir)
+        dir = "/tmp";
+
+    char* path = asprintf("%s/wayst-scrollback-XXXXXX", dir);
+    int   fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    else
+        WRN("Failed to create scrollback file \'%s\': %s\n", path, strerror(errno));
+
+    free(path);
+    return fd;
+}
+
+/**
+ * Make sure the first @param size bytes of a file are mapped. Mappings may be larger than the
+ * file, only the part that was written is accessed */
+static void* Spill_map(int fd, void* map, uint64_t* mapped, uint64_t size)
+{
+    if (likely(size <= *mapped))
+        return map;
+
+    if (map)
+        munmap(map, *mapped);
+
+    uint64_t length = MAX(*mapped * 2, size + SPILL_MAP_GRANULARITY);
+    length -= length % SPILL_MAP_GRANULARITY;
+
+    map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        ERR("Failed to map scrollback file: %s", strerror(errno));
+
+    *mapped = length;
+    return map;
+}
+
+bool Spill_open(Spill* self)
+{
+    memset(self, 0, sizeof(Spill));
+
+    if ((self->data_fd = Spill_create_file()) < 0)
+        return false;
+
+    if ((self->index_fd = Spill_create_file()) < 0) {
+        close(self->data_fd);
+        return false;
+    }
+
+    self->is_open = true;
+    return true;
+}
+
+void Spill_close(Spill* self)
+{
+    if (!self->is_open)
+        return;
+
+    if (self->data)
+        munmap(self->data, self->data_mapped);
+    if (self->index)
+        munmap(self->index, self->index_mapped);
+
+    close(self->data_fd);
+    close(self->index_fd);
+    memset(self, 0, sizeof(Spill));
+}
+
+static bool write_all(int fd, const void* data, size_t size, uint64_t offset)
+{
+    for (ssize_t written; size; size -= written, offset += written) {
+        written = pwrite(fd, data, size, offset);
+
+        if (written < 0 && errno == EINTR) {
+            written = 0;
+        } else if (written <= 0) {
+            WRN("Failed to write scrollback file: %s\n", strerror(errno));
+            return false;
+        }
+
+        data = (const uint8_t*)data + written;
+    }
+    return true;
+}
+
+uint64_t Spill_write(Spill* self, const void* data, size_t size)
+{
+    if (!write_all(self->data_fd, data, size, self->data_size))
+        return UINT64_MAX;
+
+    uint64_t offset = self->data_size;
+    self->data_size += size;
+    return offset;
+}
+
+const uint8_t* Spill_read(Spill* self, uint64_t offset, size_t size)
+{
+    ASSERT(offset + size <= self->data_size, "read past the end of scrollback file");
+    self->data = Spill_map(self->data_fd, self->data, &self->data_mapped, offset + size);
+    return self->data + offset;
+}
+
+bool Spill_push_entry(Spill* self, const uint64_t entry[static SPILL_ENTRY_WORDS])
+{
+    size_t size = SPILL_ENTRY_WORDS * sizeof(uint64_t);
+    if (!write_all(self->index_fd, entry, size, self->nentries * size))
+        return false;
+
+    ++self->nentries;
+    return true;
+}
+
+const uint64_t* Spill_entry(Spill* self, size_t idx)
+{
+    ASSERT(idx < self->nentries, "scrollback file index out of range");
+
+    self->index = Spill_map(self->index_fd,
+                            self->index,
+                            &self->index_mapped,
+                            (idx + 1) * SPILL_ENTRY_WORDS * sizeof(uint64_t));
+    return self->index + idx * SPILL_ENTRY_WORDS;
+}
+
+void Spill_clear(Spill* self)
+{
+    if (ftruncate(self->data_fd, 0) || ftruncate(self->index_fd, 0))
+        WRN("Failed to truncate scrollback file: %s\n", strerror(errno));
+
+    self->data_size = 0;
+    self->nentries  = 0;
+}
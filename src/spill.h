@@ -0,0 +1,60 @@
+/* See LICENSE for license information. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of 64 bit words in an index entry */
+#define SPILL_ENTRY_WORDS 2
+
+/**
+ * Append-only record storage in an unlinked temporary file, read back through a memory mapping.
+ * A second file holds a fixed size entry per stored item (e.g. the record offset and some flags),
+ * so any item can be found in O(1). Entries can be dropped from the end, records are never removed.
+ * Writes use pwrite(), so running out of disk space is an error instead of a SIGBUS. */
+typedef struct
+{
+    bool     is_open;
+    int      data_fd, index_fd;
+    uint8_t* data;
+    uint64_t data_size, data_mapped;
+
+    uint64_t* index;
+    uint64_t  index_mapped;
+    size_t    nentries;
+} Spill;
+
+/**
+ * Create the backing files in $TMPDIR or /tmp */
+bool Spill_open(Spill* self);
+
+void Spill_close(Spill* self);
+
+/**
+ * Append a record. Returns its offset or UINT64_MAX if it could not be written */
+uint64_t Spill_write(Spill* self, const void* data, size_t size);
+
+/**
+ * Get a pointer to data stored at @param offset, valid until the next call to this function */
+const uint8_t* Spill_read(Spill* self, uint64_t offset, size_t size);
+
+/**
+ * Add an entry to the index. Returns false if it could not be written */
+bool Spill_push_entry(Spill* self, const uint64_t entry[static SPILL_ENTRY_WORDS]);
+
+/**
+ * Get index entry @param idx, valid until the next call to this function */
+const uint64_t* Spill_entry(Spill* self, size_t idx);
+
+/**
+ * Drop @param n entries from the end of the index */
+static inline void Spill_pop_entries(Spill* self, size_t n)
+{
+    self->nentries -= n < self->nentries ? n : self->nentries;
+}
+
+/**
+ * Drop all records and entries */
+void Spill_clear(Spill* self);
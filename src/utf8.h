@@ -0,0 +1,81 @@
+/* See LICENSE for license information. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <uchar.h>
+
+/**
+ * Locale independent UTF-8 decoding, based on Bjoern Hoehrmann's DFA decoder
+ * (http://bjoern.hoehrmann.de/utf-8/decoder/dfa/). Overlong forms, surrogates and values past
+ * U+10FFFF are rejected. */
+
+#define UTF8_ACCEPT 0
+#define UTF8_REJECT 12
+
+#define UTF8_REPLACEMENT_CHARACTER 0xFFFD
+
+static const uint8_t utf8_dfa[] = {
+    /* byte -> character class */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    8, 8, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    10, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 3, 3, 11, 6, 6, 6, 5, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+
+    /* state + character class -> state */
+    0, 12, 24, 36, 60, 96, 84, 12, 12, 12, 48, 72, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 0, 12, 12, 12, 12, 12, 0, 12, 0, 12, 12, 12, 24, 12, 12, 12, 12, 12, 24, 12, 24, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 24, 12, 12, 12, 12, 12, 24, 12, 12, 12, 12, 12, 12, 12, 24, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12, 12, 36, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12,
+    12, 36, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+};
+
+/**
+ * Feed one byte to the decoder. Returns the new state, @param codepoint is complete when it is
+ * UTF8_ACCEPT. On UTF8_REJECT the caller should emit U+FFFD, reset the state and, if the previous
+ * state was not UTF8_ACCEPT, feed the same byte again as it may begin a new sequence */
+__attribute__((always_inline, hot)) static inline uint32_t utf8_decode(uint32_t* state,
+                                                                       char32_t* codepoint,
+                                                                       uint8_t   byte)
+{
+    uint32_t type = utf8_dfa[byte];
+
+    *codepoint = (*state != UTF8_ACCEPT) ? (byte & 0x3fu) | (*codepoint << 6)
+                                         : (0xffu >> type) & (byte);
+
+    return *state = utf8_dfa[256 + *state + type];
+}
+
+/**
+ * Encode @param codepoint as UTF-8, @param out must fit 4 bytes. Returns the number of bytes
+ * written, 0 if @param codepoint can not be encoded */
+static inline size_t utf8_encode(char32_t codepoint, char* out)
+{
+    if (codepoint < 0x80) {
+        out[0] = codepoint;
+        return 1;
+    } else if (codepoint < 0x800) {
+        out[0] = 0xc0 | (codepoint >> 6);
+        out[1] = 0x80 | (codepoint & 0x3f);
+        return 2;
+    } else if (codepoint < 0x10000) {
+        if (codepoint >= 0xd800 && codepoint <= 0xdfff)
+            return 0;
+        out[0] = 0xe0 | (codepoint >> 12);
+        out[1] = 0x80 | ((codepoint >> 6) & 0x3f);
+        out[2] = 0x80 | (codepoint & 0x3f);
+        return 3;
+    } else if (codepoint < 0x110000) {
+        out[0] = 0xf0 | (codepoint >> 18);
+        out[1] = 0x80 | ((codepoint >> 12) & 0x3f);
+        out[2] = 0x80 | ((codepoint >> 6) & 0x3f);
+        out[3] = 0x80 | (codepoint & 0x3f);
+        return 4;
+    }
+    return 0;
+}
@@ -300,17 +300,58 @@ static inline bool strtob(const char* restrict str)
 }
 
 
+/* Character property table generated by src/wcwidth/gen_width_table.c. Indexed by codepoint / 256,
+ * then by codepoint % 256 */
+extern const uint8_t unicode_table_index[0x110000 >> 8];
+extern const uint8_t unicode_table_blocks[][256];
+
+#define UNICODE_TABLE_WIDTH_MASK     0x03
+#define UNICODE_TABLE_COMBINING_FLAG 0x04
+
+static inline uint8_t unicode_table_lookup(char32_t codepoint)
+{
+    if (unlikely(codepoint >= 0x110000)) {
+        return 1;
+    }
+    return unicode_table_blocks[unicode_table_index[codepoint >> 8]][codepoint & 0xff];
+}
+
+/**
+ * Number of cells required to display a character, same as wcwidth() */
+static inline int unicode_width(char32_t codepoint)
+{
+    uint8_t width = unicode_table_lookup(codepoint) & UNICODE_TABLE_WIDTH_MASK;
+    return width == UNICODE_TABLE_WIDTH_MASK ? -1 : width;
+}
+
 static inline bool unicode_is_combining(char32_t codepoint)
 {
-    switch (codepoint) {
-    case 0xFE20 ... 0xFE2F:
-    case 0x1AB0 ... 0x1AFF:
-    case 0x1DC0 ... 0x1DFF:
-    case 0x20D0 ... 0x20FF:
-    case 0x0300 ... 0x036F:
-        return true;
-    default:
-        return false;
+    return unicode_table_lookup(codepoint) & UNICODE_TABLE_COMBINING_FLAG;
+}
+
+/* Canonical composition pairs generated by src/wcwidth/gen_width_table.c. Open addressing hash
+ * table of { base, combining character, composed character }, empty slots have a base of 0 */
+#define UNICODE_COMPOSE_SLOTS 2048
+extern const uint32_t unicode_compose_table[UNICODE_COMPOSE_SLOTS][3];
+
+/* Must match compose_hash() in gen_width_table.c */
+static inline uint32_t unicode_compose_hash(char32_t base, char32_t mark)
+{
+    return ((base * 0x9E3779B1u) ^ (mark * 0x85EBCA6Bu)) >> 21 & (UNICODE_COMPOSE_SLOTS - 1);
+}
+
+/**
+ * Character equal to @param base followed by combining character @param mark after NFC
+ * normalization, 0 if they do not compose */
+static inline char32_t unicode_compose(char32_t base, char32_t mark)
+{
+    for (uint32_t i = unicode_compose_hash(base, mark);; ++i) {
+        const uint32_t* entry = unicode_compose_table[i & (UNICODE_COMPOSE_SLOTS - 1)];
+        if (entry[0] == base && entry[1] == mark) {
+            return entry[2];
+        } else if (!entry[0]) {
+            return 0;
+        }
     }
 }
 
@@ -15,85 +15,1288 @@
 #include <termios.h>
 #include <uchar.h>
 
-#ifndef NOUTF8PROC
-#include <utf8proc.h>
+#include <xkbcommon/xkbcommon.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
 #endif
 
-#include <xkbcommon/xkbcommon.h>
+#include "lz.h"
+#include "utf8.h"
+
+VtRune blank_space;
+
+void (*Vt_destroy_line_proxy)(int32_t proxy[static 4]) = NULL;
+
+static inline size_t Vt_top_line(const Vt* const self);
+void                 Vt_visual_scroll_to(Vt* self, size_t line);
+void                 Vt_visual_scroll_up(Vt* self);
+void                 Vt_visual_scroll_down(Vt* self);
+void                 Vt_visual_scroll_reset(Vt* self);
+static inline size_t Vt_get_scroll_region_top(Vt* self);
+static inline size_t Vt_get_scroll_region_bottom(Vt* self);
+static inline bool   Vt_scroll_region_not_default(Vt* self);
+static void          Vt_alt_buffer_on(Vt* self, bool save_mouse);
+static void          Vt_alt_buffer_off(Vt* self, bool save_mouse);
+static void          Vt_handle_SGR_sequence(Vt* self);
+static inline void   Vt_handle_literal(Vt* self, char c);
+static void          Vt_reset_text_attribs(Vt* self);
+static void          Vt_carriage_return(Vt* self);
+static void          Vt_clear_right(Vt* self);
+static void          Vt_clear_left(Vt* self);
+static inline void   Vt_scroll_out_all_content(Vt* self);
+static void          Vt_empty_line_fill_bg(Vt* self, size_t idx);
+static void          Vt_cursor_down(Vt* self);
+static void          Vt_cursor_up(Vt* self);
+static void          Vt_cursor_left(Vt* self);
+static void          Vt_cursor_right(Vt* self);
+static void          Vt_insert_new_line(Vt* self);
+static void          Vt_scroll_up(Vt* self);
+static void          Vt_scroll_down(Vt* self);
+static void          Vt_reverse_line_feed(Vt* self);
+static void          Vt_delete_line(Vt* self);
+static void          Vt_delete_chars(Vt* self, size_t n);
+static void          Vt_erase_chars(Vt* self, size_t n);
+static void          Vt_clear_above(Vt* self);
+static inline void   Vt_scroll_out_above(Vt* self);
+static void          Vt_insert_line(Vt* self);
+static void          Vt_clear_display_and_scrollback(Vt* self);
+static void          Vt_reflow_history_in_view(Vt* self);
+static void          Vt_erase_to_end(Vt* self);
+static void          Vt_move_cursor(Vt* self, uint32_t c, uint32_t r);
+static void          Vt_move_cursor_to_column(Vt* self, uint32_t c);
+static void          Vt_reset_tab_stops(Vt* self);
+static void          Vt_grow_tab_stops(Vt* self, uint32_t cols);
+static void          Vt_set_tab_stop(Vt* self, uint32_t col, bool set);
+static uint32_t      Vt_next_tab_stop(const Vt* self, uint32_t col);
+static uint32_t      Vt_previous_tab_stop(const Vt* self, uint32_t col);
+static void          Vt_push_title(Vt* self);
+static void          Vt_pop_title(Vt* self);
+static inline void   Vt_insert_char_at_cursor(Vt* self, VtRune c);
+static inline void   Vt_insert_char_at_cursor_with_shift(Vt* self, VtRune c);
+static Vector_char line_to_string(const VtClusterTable* clusters,
+                                  Vector_VtRune*        line,
+                                  size_t                begin,
+                                  size_t                end,
+                                  const char*           tail);
+static inline void Vt_mark_proxy_fully_damaged(Vt* self, size_t idx);
+static void        Vt_mark_proxy_damaged_cell(Vt* self, size_t line, size_t rune);
+
+static inline VtLine VtLine_new()
+{
+    return (VtLine){ .damage =
+                       (struct VtLineDamage){
+                         .type  = VT_LINE_DAMAGE_FULL,
+                         .front = 0,
+                         .end   = 0,
+                         .shift = 0,
+                       },
+                     .reflowable = true,
+                     .rejoinable = false,
+                     .data       = Vector_new_VtRune(),
+                     .proxy      = { { 0 } } };
+}
+
+static void Vt_output(Vt* self, const char* buf, size_t len)
+{
+    Vector_pushv_char(&self->output, buf, len);
+}
+
+#define Vt_output_formated(vt, fmt, ...)                                                           \
+    char _tmp[64];                                                                                 \
+    int  _len = snprintf(_tmp, sizeof(_tmp), fmt, __VA_ARGS__);                                    \
+    Vt_output((vt), _tmp, _len);
+
+/* Offset of the part of VtRune that follows the character code. Starts with the cluster index,
+ * which is masked out */
+#define VT_RUNE_STYLE_OFFSET (offsetof(Rune, code) + sizeof(((Rune*)0)->code))
+
+_Static_assert(sizeof(Rune) == 2 * sizeof(char32_t), "Rune cluster and style do not share a word");
+
+_Static_assert(sizeof(VtRune) - VT_RUNE_STYLE_OFFSET <= 2 * sizeof(uint64_t),
+               "VtRune style does not fit in two words");
+
+/* Bits of the style part of VtRune that are stored in the style table. Excludes padding and the
+ * wide flag */
+static uint64_t vt_rune_style_mask[2];
+
+static inline void VtRune_style_words(const VtRune* self, uint64_t out[static 2])
+{
+    out[0] = out[1] = 0;
+    memcpy(out, (const char*)self + VT_RUNE_STYLE_OFFSET, sizeof(VtRune) - VT_RUNE_STYLE_OFFSET);
+}
+
+static void VtRune_init_style_mask()
+{
+    VtRune mask;
+    memset(&mask, 0, sizeof(mask));
+    mask.rune.style          = ~0;
+    mask.fg                  = (ColorRGB){ 0xff, 0xff, 0xff };
+    mask.line                = (ColorRGB){ 0xff, 0xff, 0xff };
+    mask.bg                  = (ColorRGBA){ 0xff, 0xff, 0xff, 0xff };
+    mask.linecolornotdefault = 1;
+    mask.dim                 = 1;
+    mask.hidden              = 1;
+    mask.blinkng             = 1;
+    mask.underlined          = 1;
+    mask.strikethrough       = 1;
+    mask.doubleunderline     = 1;
+    mask.curlyunderline      = 1;
+    mask.overline            = 1;
+    VtRune_style_words(&mask, vt_rune_style_mask);
+}
+
+/**
+ * Compare everything but the character and width. Reads the style part as two masked words, this
+ * runs for every cell moved to the scrollback */
+static inline bool VtRune_style_eq(const VtRune* a, const VtRune* b)
+{
+    uint64_t wa[2], wb[2];
+    VtRune_style_words(a, wa);
+    VtRune_style_words(b, wb);
+    return !(((wa[0] ^ wb[0]) & vt_rune_style_mask[0]) | ((wa[1] ^ wb[1]) & vt_rune_style_mask[1]));
+}
+
+static inline uint32_t VtRune_style_hash(const VtRune* self)
+{
+    uint64_t w[2];
+    VtRune_style_words(self, w);
+    uint64_t h = (w[0] & vt_rune_style_mask[0]) * 0x9e3779b97f4a7c15 ^
+                 (w[1] & vt_rune_style_mask[1]) * 0xbf58476d1ce4e5b9;
+    return h ^ h >> 32;
+}
+
+static VtStyleTable VtStyleTable_new()
+{
+    VtRune_init_style_mask();
+    return (VtStyleTable){ .styles         = Vector_new_VtRune(),
+                           .slots          = NULL,
+                           .nslots         = 0,
+                           .palette_index  = NULL,
+                           .npalette_index = 0 };
+}
+
+static void VtStyleTable_destroy(VtStyleTable* self)
+{
+    Vector_destroy_VtRune(&self->styles);
+    free(self->slots);
+    free(self->palette_index);
+    self->slots          = NULL;
+    self->nslots         = 0;
+    self->palette_index  = NULL;
+    self->npalette_index = 0;
+}
+
+static void VtStyleTable_rehash(VtStyleTable* self, uint32_t nslots)
+{
+    free(self->slots);
+    self->slots  = calloc(nslots, sizeof(uint32_t));
+    self->nslots = nslots;
+
+    for (uint32_t i = 0; i < self->styles.size; ++i) {
+        uint32_t slot = VtRune_style_hash(&self->styles.buf[i]) & (nslots - 1);
+        while (self->slots[slot])
+            slot = (slot + 1) & (nslots - 1);
+        self->slots[slot] = i + 1;
+    }
+}
+
+/**
+ * Find or add the style of @param rune. Returns false if the table is full */
+static bool VtStyleTable_intern(VtStyleTable* self, const VtRune* rune, uint16_t* out_index)
+{
+    if (unlikely((self->styles.size + 1) * 2 > self->nslots))
+        VtStyleTable_rehash(self, MAX(self->nslots * 2, 256));
+
+    uint32_t slot = VtRune_style_hash(rune) & (self->nslots - 1);
+    for (; self->slots[slot]; slot = (slot + 1) & (self->nslots - 1)) {
+        if (VtRune_style_eq(&self->styles.buf[self->slots[slot] - 1], rune)) {
+            *out_index = self->slots[slot] - 1;
+            return true;
+        }
+    }
+
+    if (unlikely(self->styles.size > UINT16_MAX))
+        return false;
+
+    VtRune style = *rune;
+    style.rune.code    = 0;
+    style.rune.cluster = 0;
+    style.wide         = false;
+    Vector_push_VtRune(&self->styles, style);
+
+    self->slots[slot] = self->styles.size;
+    *out_index        = self->styles.size - 1;
+    return true;
+}
+
+static inline uint32_t VtCompactLine_hash(VtCompactLine* self)
+{
+    uint64_t h = self->size;
+    for (uint32_t i = 0; i < self->size; ++i) {
+        const VtCompactCell* cell = &self->cells[i];
+        h = (h ^ ((uint64_t)cell->style << 32 | cell->code << 1 | cell->wide)) * 0x9e3779b97f4a7c15;
+    }
+
+    VtCompactCombine* combine = VtCompactLine_combine(self);
+    for (uint32_t i = 0; i < self->ncombine; ++i) {
+        h = (h ^ combine[i].column) * 0xbf58476d1ce4e5b9;
+        h = (h ^ combine[i].cluster) * 0xbf58476d1ce4e5b9;
+    }
+
+    return h ^ h >> 32;
+}
+
+static inline bool VtCompactLine_eq(VtCompactLine* a, VtCompactLine* b)
+{
+    if (a->hash != b->hash || a->size != b->size || a->ncombine != b->ncombine)
+        return false;
+
+    for (uint32_t i = 0; i < a->size; ++i)
+        if (a->cells[i].code != b->cells[i].code || a->cells[i].wide != b->cells[i].wide ||
+            a->cells[i].style != b->cells[i].style)
+            return false;
+
+    return !memcmp(VtCompactLine_combine(a),
+                   VtCompactLine_combine(b),
+                   a->ncombine * sizeof(VtCompactCombine));
+}
+
+static void VtCompactLineTable_destroy(VtCompactLineTable* self)
+{
+    for (uint32_t i = 0; i < self->nslots; ++i)
+        VtCompactLine_unref(self->slots[i]);
+    free(self->slots);
+    self->slots  = NULL;
+    self->nslots = self->nlines = 0;
+}
+
+/**
+ * Drop the lines no row uses anymore and resize the table so it is at most a quarter full */
+static void VtCompactLineTable_rehash(VtCompactLineTable* self)
+{
+    VtCompactLine** old  = self->slots;
+    uint32_t        nold = self->nslots;
+
+    self->nlines = 0;
+    for (uint32_t i = 0; i < nold; ++i)
+        if (old[i] && old[i]->refs > 1)
+            ++self->nlines;
+
+    for (self->nslots = 256; self->nslots < self->nlines * 4;)
+        self->nslots *= 2;
+    self->slots = calloc(self->nslots, sizeof(VtCompactLine*));
+
+    for (uint32_t i = 0; i < nold; ++i) {
+        if (!old[i])
+            continue;
+
+        if (old[i]->refs == 1) {
+            free(old[i]);
+            continue;
+        }
+
+        uint32_t slot = old[i]->hash & (self->nslots - 1);
+        while (self->slots[slot])
+            slot = (slot + 1) & (self->nslots - 1);
+        self->slots[slot] = old[i];
+    }
+
+    free(old);
+}
+
+/**
+ * Get the shared copy of @param line. If there is one @param line is freed, otherwise it becomes
+ * the shared copy */
+static VtCompactLine* VtCompactLineTable_intern(VtCompactLineTable* self, VtCompactLine* line)
+{
+    if (unlikely((self->nlines + 1) * 2 > self->nslots))
+        VtCompactLineTable_rehash(self);
+
+    ++self->interned;
+    line->hash = VtCompactLine_hash(line);
+
+    uint32_t slot = line->hash & (self->nslots - 1);
+    for (; self->slots[slot]; slot = (slot + 1) & (self->nslots - 1)) {
+        if (VtCompactLine_eq(self->slots[slot], line)) {
+            ++self->shared;
+            ++self->slots[slot]->refs;
+            free(line);
+            return self->slots[slot];
+        }
+    }
+
+    ++line->refs;
+    ++self->nlines;
+    self->slots[slot] = line;
+    return line;
+}
+
+static VtClusterTable VtClusterTable_new()
+{
+    return (VtClusterTable){ .codes        = Vector_new_char32_t(),
+                             .slots        = NULL,
+                             .nslots       = 0,
+                             .rebuild_size = VT_CLUSTER_TABLE_REBUILD };
+}
+
+static void VtClusterTable_destroy(VtClusterTable* self)
+{
+    Vector_destroy_char32_t(&self->codes);
+    free(self->slots);
+    self->slots  = NULL;
+    self->nslots = self->nclusters = self->unshared = 0;
+}
+
+static inline uint32_t VtClusterTable_hash(const char32_t* codes, uint32_t len)
+{
+    uint64_t h = len;
+    for (uint32_t i = 0; i < len; ++i)
+        h = (h ^ codes[i]) * 0x9e3779b97f4a7c15;
+    return h ^ h >> 32;
+}
+
+static void VtClusterTable_rehash(VtClusterTable* self, uint32_t nslots)
+{
+    free(self->slots);
+    self->slots  = calloc(nslots, sizeof(uint32_t));
+    self->nslots = nslots;
+
+    for (uint32_t i = 0; i < self->codes.size; i += self->codes.buf[i] + 1) {
+        uint32_t slot = VtClusterTable_hash(self->codes.buf + i + 1, self->codes.buf[i]);
+        for (slot &= nslots - 1; self->slots[slot]; slot = (slot + 1) & (nslots - 1))
+            ;
+        self->slots[slot] = i + 1;
+    }
+}
+
+/**
+ * Find or add a sequence of combining characters. Returns 0 if there is no room for it */
+static uint32_t VtClusterTable_intern(VtClusterTable* self, const char32_t* codes, uint32_t len)
+{
+    if (unlikely((self->nclusters + 1) * 2 > self->nslots))
+        VtClusterTable_rehash(self, MAX(self->nslots * 2, 64));
+
+    uint32_t slot = VtClusterTable_hash(codes, len) & (self->nslots - 1);
+    for (; self->slots[slot]; slot = (slot + 1) & (self->nslots - 1)) {
+        const char32_t* other = self->codes.buf + self->slots[slot] - 1;
+        if (other[0] == len && !memcmp(other + 1, codes, len * sizeof(char32_t))) {
+            if (self->slots[slot] == self->unshared)
+                self->unshared = 0;
+            return self->slots[slot];
+        }
+    }
+
+    /* must fit in Rune::cluster */
+    if (unlikely(self->codes.size + len + 2 >= 1u << 29)) {
+        WRN("Combining character table full\n");
+        return 0;
+    }
+
+    Vector_push_char32_t(&self->codes, len);
+    Vector_pushv_char32_t(&self->codes, codes, len);
+    ++self->nclusters;
+    return self->unshared = self->slots[slot] = self->codes.size - len;
+}
+
+/**
+ * Remove the unshared sequence, it is the last one in 'codes' */
+static void VtClusterTable_pop_unshared(VtClusterTable* self)
+{
+    uint32_t        cluster = self->unshared, mask = self->nslots - 1;
+    const char32_t* codes   = self->codes.buf + cluster - 1;
+    ASSERT(cluster + codes[0] == self->codes.size, "unshared cluster is not the last one");
+
+    uint32_t slot = VtClusterTable_hash(codes + 1, codes[0]) & mask;
+    while (self->slots[slot] != cluster)
+        slot = (slot + 1) & mask;
+
+    /* move entries that probed past the removed one back, so lookups still find them */
+    for (uint32_t next = (slot + 1) & mask; self->slots[next]; next = (next + 1) & mask) {
+        const char32_t* other = self->codes.buf + self->slots[next] - 1;
+        uint32_t        home  = VtClusterTable_hash(other + 1, other[0]) & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            self->slots[slot] = self->slots[next];
+            slot              = next;
+        }
+    }
+
+    self->slots[slot] = 0;
+    self->codes.size  = cluster - 1;
+    self->unshared    = 0;
+    --self->nclusters;
+}
+
+/**
+ * Get the index of sequence @param cluster of @param old in @param new */
+static inline uint32_t VtClusterTable_move(const VtClusterTable* old,
+                                           VtClusterTable*       new,
+                                           uint32_t              cluster)
+{
+    uint32_t        len;
+    const char32_t* codes = VtClusterTable_get(old, cluster, &len);
+    return VtClusterTable_intern(new, codes, len);
+}
+
+/**
+ * Add a combining character to a cell */
+static void Vt_push_combining(Vt* self, VtRune* rune, char32_t codepoint)
+{
+    ASSERT(unicode_is_combining(codepoint), "must be a combining character");
+
+    char32_t codes[VT_RUNE_MAX_COMBINE];
+    uint32_t len = 0;
+
+    if (rune->rune.cluster) {
+        const char32_t* old = VtClusterTable_get(&self->clusters, rune->rune.cluster, &len);
+        memcpy(codes, old, len * sizeof(char32_t));
+    }
+
+    if (unlikely(len == VT_RUNE_MAX_COMBINE)) {
+        WRN("Combining character limit (%d) exceeded\n", VT_RUNE_MAX_COMBINE);
+        return;
+    }
+
+    /* the shorter sequence would be left behind unused */
+    bool popped = rune->rune.cluster && rune->rune.cluster == self->clusters.unshared;
+    if (popped)
+        VtClusterTable_pop_unshared(&self->clusters);
+
+    codes[len++]     = codepoint;
+    uint32_t cluster = VtClusterTable_intern(&self->clusters, codes, len);
+    if (unlikely(!cluster && popped))
+        cluster = VtClusterTable_intern(&self->clusters, codes, len - 1);
+    if (cluster)
+        rune->rune.cluster = cluster;
+}
+
+/**
+ * Get an empty cell buffer that fits a row at the current width */
+static Vector_VtRune Vt_take_cells(Vt* self)
+{
+    while (self->cell_pool_size) {
+        Vector_VtRune cells = self->cell_pool[--self->cell_pool_size];
+        if (likely(cells.cap >= self->ws.ws_col))
+            return cells;
+
+        /* left from before the window got wider */
+        Vector_destroy_VtRune(&cells);
+    }
+
+    return Vector_new_with_capacity_VtRune(MAX(self->ws.ws_col, 4));
+}
+
+/**
+ * Keep the cell buffer of a line for reuse if it is the right size, @param cells is left empty */
+static void Vt_give_cells(Vt* self, Vector_VtRune* cells)
+{
+    size_t row = MAX(self->ws.ws_col, 4);
+
+    if (cells->buf && cells->cap >= row && cells->cap <= 2 * row &&
+        self->cell_pool_size < VT_CELL_POOL_SIZE) {
+        Vector_clear_VtRune(cells);
+        self->cell_pool[self->cell_pool_size++] = *cells;
+    } else {
+        Vector_destroy_VtRune(cells);
+    }
+
+    *cells = (Vector_VtRune){ .cap = 0, .size = 0, .buf = NULL };
+}
+
+/**
+ * Empty line for the screen, with room for a full row of cells */
+static inline VtLine Vt_new_line(Vt* self)
+{
+    return (VtLine){
+        .data       = Vt_take_cells(self),
+        .damage     = (struct VtLineDamage){ .type = VT_LINE_DAMAGE_FULL },
+        .reflowable = true,
+    };
+}
+
+/**
+ * Move line contents to compact cells. Returns false and leaves the line as it was if the style
+ * table is full */
+static bool Vt_compact_line(Vt* self, VtLine* line)
+{
+    if (line->compact || line->cold)
+        return true;
+
+    uint32_t size = line->data.size, ncombine = 0;
+    for (uint32_t i = 0; i < size; ++i)
+        if (line->data.buf[i].rune.cluster)
+            ++ncombine;
+
+    VtCompactLine* compact = malloc(sizeof(VtCompactLine) + size * sizeof(VtCompactCell) +
+                                    ncombine * sizeof(VtCompactCombine));
+    compact->size     = size;
+    compact->ncombine = ncombine;
+    compact->refs     = 1;
+
+    VtCompactCombine* combine = VtCompactLine_combine(compact);
+    uint64_t          styled[2] = { 0, 0 };
+    uint16_t          style = 0;
+
+    for (uint32_t i = 0; i < size; ++i) {
+        const VtRune* rune = &line->data.buf[i];
+        uint64_t      words[2];
+        VtRune_style_words(rune, words);
+
+        /* neighbouring cells usually look the same */
+        if (!i || ((words[0] ^ styled[0]) & vt_rune_style_mask[0]) |
+                    ((words[1] ^ styled[1]) & vt_rune_style_mask[1])) {
+            if (unlikely(!VtStyleTable_intern(&self->style_table, rune, &style))) {
+                free(compact);
+                return false;
+            }
+            styled[0] = words[0];
+            styled[1] = words[1];
+        }
+
+        compact->cells[i] =
+          (VtCompactCell){ .code = rune->rune.code, .wide = rune->wide, .style = style };
+
+        if (rune->rune.cluster) {
+            combine->column  = i;
+            combine->cluster = rune->rune.cluster;
+            ++combine;
+        }
+    }
+
+    if (settings.scrollback_dedup)
+        compact = VtCompactLineTable_intern(&self->line_table, compact);
+
+    Vt_give_cells(self, &line->data);
+    line->compact = compact;
+    return true;
+}
+
+static void VtCompactLine_remap_styles(VtCompactLine*      self,
+                                       const VtStyleTable* old,
+                                       VtStyleTable*       new,
+                                       uint32_t*           remap)
+{
+    for (uint32_t j = 0; j < self->size; ++j) {
+        VtCompactCell* cell = &self->cells[j];
+        if (remap[cell->style] == UINT32_MAX) {
+            uint16_t index;
+            VtStyleTable_intern(new, &old->styles.buf[cell->style], &index);
+            remap[cell->style] = index;
+        }
+        cell->style = remap[cell->style];
+    }
+}
+
+/**
+ * Remap the compact lines of a buffer that are not shared, shared ones are done once through the
+ * line table */
+static void Vt_remap_compact_styles(VtLineBuffer*       lines,
+                                    const VtStyleTable* old,
+                                    VtStyleTable*       new,
+                                    uint32_t*           remap)
+{
+    for (size_t i = 0; i < lines->size; ++i) {
+        VtCompactLine* compact = lines->buf[i].compact;
+        if (compact && compact->refs == 1)
+            VtCompactLine_remap_styles(compact, old, new, remap);
+    }
+}
+
+/**
+ * Replace the style table with one holding only the styles used by compact lines. Compressed
+ * blocks have their own palettes, so only lines that were not frozen yet (or were expanded and
+ * compacted again) are visited */
+static void Vt_rebuild_style_table(Vt* self)
+{
+    VtStyleTable old   = self->style_table;
+    uint32_t*    remap = malloc(old.styles.size * sizeof(uint32_t));
+    memset(remap, 0xff, old.styles.size * sizeof(uint32_t));
+
+    self->style_table = VtStyleTable_new();
+
+    /* shared lines hash differently with the new indices */
+    VtCompactLineTable* lines = &self->line_table;
+    if (lines->slots) {
+        VtCompactLineTable_rehash(lines);
+        for (uint32_t i = 0; i < lines->nslots; ++i) {
+            if (lines->slots[i]) {
+                VtCompactLine_remap_styles(lines->slots[i], &old, &self->style_table, remap);
+                lines->slots[i]->hash = VtCompactLine_hash(lines->slots[i]);
+            }
+        }
+        VtCompactLineTable_rehash(lines);
+    }
+
+    Vt_remap_compact_styles(&self->lines, &old, &self->style_table, remap);
+    if (self->alt_lines.buf)
+        Vt_remap_compact_styles(&self->alt_lines, &old, &self->style_table, remap);
+
+    LOG("style table rebuilt, %zu -> %zu entries\n",
+        old.styles.size,
+        self->style_table.styles.size);
+
+    free(remap);
+    VtStyleTable_destroy(&old);
+}
+
+static void VtCompactLine_remap_clusters(VtCompactLine*        self,
+                                         const VtClusterTable* old,
+                                         VtClusterTable*       new)
+{
+    VtCompactCombine* combine = VtCompactLine_combine(self);
+    for (uint32_t i = 0; i < self->ncombine; ++i)
+        combine[i].cluster = VtClusterTable_move(old, new, combine[i].cluster);
+}
+
+/**
+ * Remap the expanded cells and the compact lines that are not shared of a buffer */
+static void Vt_remap_clusters(VtLineBuffer* lines, const VtClusterTable* old, VtClusterTable* new)
+{
+    for (size_t i = 0; i < lines->size; ++i) {
+        VtLine* line = &lines->buf[i];
+        for (size_t j = 0; j < line->data.size; ++j) {
+            Rune* rune = &line->data.buf[j].rune;
+            if (rune->cluster)
+                rune->cluster = VtClusterTable_move(old, new, rune->cluster);
+        }
+        if (line->compact && line->compact->refs == 1)
+            VtCompactLine_remap_clusters(line->compact, old, new);
+    }
+}
+
+/**
+ * Replace the cluster table with one holding only the sequences cells use. Compressed blocks store
+ * the characters themselves, so only expanded and compact lines are visited */
+static void Vt_rebuild_cluster_table(Vt* self)
+{
+    VtClusterTable old = self->clusters;
+    self->clusters     = VtClusterTable_new();
+
+    /* shared lines hash differently with the new indices */
+    VtCompactLineTable* lines = &self->line_table;
+    if (lines->slots) {
+        VtCompactLineTable_rehash(lines);
+        for (uint32_t i = 0; i < lines->nslots; ++i) {
+            if (lines->slots[i]) {
+                VtCompactLine_remap_clusters(lines->slots[i], &old, &self->clusters);
+                lines->slots[i]->hash = VtCompactLine_hash(lines->slots[i]);
+            }
+        }
+        VtCompactLineTable_rehash(lines);
+    }
+
+    Vt_remap_clusters(&self->lines, &old, &self->clusters);
+    if (self->alt_lines.buf)
+        Vt_remap_clusters(&self->alt_lines, &old, &self->clusters);
+
+    /* if most of them are still used, don't do it again right away */
+    self->clusters.rebuild_size = MAX(VT_CLUSTER_TABLE_REBUILD, self->clusters.codes.size * 2);
+
+    LOG("cluster table rebuilt, %u -> %u entries\n", old.nclusters, self->clusters.nclusters);
+
+    VtClusterTable_destroy(&old);
+}
+
+static inline uint8_t* write_varint(uint8_t* out, uint32_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        *out++ = value | 0x80;
+    *out++ = value;
+    return out;
+}
+
+static inline uint32_t read_varint(const uint8_t** in)
+{
+    uint32_t value = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+        uint8_t b = *(*in)++;
+        value |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return value;
+    }
+}
+
+static inline size_t VtCompactLine_serialized_bound(const VtCompactLine* self)
+{
+    return 5 + self->size * (5 + 5 + 4) + self->ncombine * 5 * (2 + VT_RUNE_MAX_COMBINE);
+}
+
+/**
+ * Write the compact cells of @param nrows rows as one line: runs of cells with the same style,
+ * then the characters as UTF-8, then the combining characters. Styles are written as indices into
+ * the block palette from @param palette_index, combining characters are written out so blocks do
+ * not depend on the cluster table. @param out must fit the sum of
+ * VtCompactLine_serialized_bound() of the rows */
+static uint8_t* VtCompactLine_serialize_rows(const VtLine*         rows,
+                                             uint32_t              nrows,
+                                             const uint32_t*       palette_index,
+                                             const VtClusterTable* clusters,
+                                             uint8_t*              out)
+{
+    uint32_t ncombine = 0;
+    for (uint32_t r = 0; r < nrows; ++r)
+        ncombine += rows[r].compact->ncombine;
+
+    out = write_varint(out, ncombine);
+
+    /* runs continue across rows */
+    uint32_t      run  = 0;
+    VtCompactCell last = { 0 };
+    for (uint32_t r = 0; r < nrows; ++r) {
+        const VtCompactLine* compact = rows[r].compact;
+        for (uint32_t i = 0; i < compact->size; ++i) {
+            const VtCompactCell* cell = &compact->cells[i];
+            if (run && (cell->style != last.style || cell->wide != last.wide)) {
+                out = write_varint(out, run << 1 | last.wide);
+                out = write_varint(out, palette_index[last.style]);
+                run = 0;
+            }
+            last = *cell;
+            ++run;
+        }
+    }
+
+    if (run) {
+        out = write_varint(out, run << 1 | last.wide);
+        out = write_varint(out, palette_index[last.style]);
+    }
+
+    for (uint32_t r = 0; r < nrows; ++r) {
+        const VtCompactLine* compact = rows[r].compact;
+        for (uint32_t i = 0; i < compact->size; ++i) {
+            size_t len = utf8_encode(compact->cells[i].code, (char*)out);
+            out += len ? len : utf8_encode(UTF8_REPLACEMENT_CHARACTER, (char*)out);
+        }
+    }
+
+    for (uint32_t r = 0, column = 0; r < nrows; column += rows[r++].compact->size) {
+        VtCompactCombine* combine = VtCompactLine_combine(rows[r].compact);
+        for (uint32_t i = 0; i < rows[r].compact->ncombine; ++i) {
+            uint32_t        len;
+            const char32_t* codes = VtClusterTable_get(clusters, combine[i].cluster, &len);
+            out                   = write_varint(out, column + combine[i].column);
+            out                   = write_varint(out, len);
+            for (uint32_t j = 0; j < len; ++j)
+                out = write_varint(out, codes[j]);
+        }
+    }
+
+    return out;
+}
+
+/**
+ * Decode @param cells cells from @param begin of line @param index of a block to VtRunes.
+ * @param thawed are the decompressed contents, combining characters are added to @param clusters */
+static Vector_VtRune VtColdBlock_read_line(const VtColdBlock* self,
+                                           const uint8_t*     thawed,
+                                           uint32_t           index,
+                                           uint32_t           begin,
+                                           uint32_t           cells,
+                                           VtClusterTable*    clusters)
+{
+    const VtRune*  palette  = (const VtRune*)(thawed + self->palette_offset);
+    const uint8_t* in       = thawed + self->lines[index].offset;
+    uint32_t       size     = self->lines[index].cells;
+    uint32_t       end      = begin + cells;
+    uint32_t       ncombine = read_varint(&in);
+
+    ASSERT(end <= size, "cold line slice out of range");
+
+    Vector_VtRune line = Vector_new_with_capacity_VtRune(MAX(cells, 4));
+    line.size          = cells;
+
+    for (uint32_t i = 0; i < size;) {
+        uint32_t run     = read_varint(&in);
+        uint32_t style   = read_varint(&in);
+        uint32_t run_end = i + (run >> 1);
+        for (uint32_t j = MAX(i, begin); j < MIN(run_end, end); ++j) {
+            line.buf[j - begin]      = palette[style];
+            line.buf[j - begin].wide = run & 1;
+        }
+        i = run_end;
+    }
+
+    /* combining characters are stored after all of the text */
+    uint32_t decode_end = ncombine ? size : end;
+    uint32_t state      = UTF8_ACCEPT;
+    char32_t code       = 0;
+    for (uint32_t i = 0; i < decode_end;) {
+        if (utf8_decode(&state, &code, *in++) == UTF8_ACCEPT) {
+            if (i >= begin && i < end)
+                line.buf[i - begin].rune.code = code;
+            ++i;
+        }
+    }
+
+    for (uint32_t i = 0; i < ncombine; ++i) {
+        char32_t codes[VT_RUNE_MAX_COMBINE];
+        uint32_t column = read_varint(&in);
+        uint32_t len    = read_varint(&in);
+        for (uint32_t j = 0; j < len; ++j)
+            codes[j] = read_varint(&in);
+
+        if (column >= begin && column < end)
+            line.buf[column - begin].rune.cluster = VtClusterTable_intern(clusters, codes, len);
+    }
+
+    return line;
+}
+
+/**
+ * End of the rows from @param i stored as one line when they are frozen, the compact rows
+ * continuing the logical line before @param end */
+static inline size_t Vt_frozen_rows_end(const Vt* self, size_t i, size_t end)
+{
+    size_t j = i + 1;
+    while (j < end && self->lines.buf[j].compact && self->lines.buf[j].rejoinable)
+        ++j;
+    return j;
+}
+
+/**
+ * Compress the compacted lines in a range into one block. Rows wrapped from the same logical line
+ * are stored unwrapped, each of them refers to its part of it */
+static void Vt_freeze_lines(Vt* self, size_t begin, size_t end)
+{
+    ASSERT(end - begin <= VT_COLD_BLOCK_LINES, "too many lines for one block");
+
+    VtStyleTable* table = &self->style_table;
+    if (table->npalette_index < table->styles.size) {
+        free(table->palette_index);
+        table->npalette_index = table->styles.size;
+        table->palette_index  = malloc(table->npalette_index * sizeof(uint32_t));
+        memset(table->palette_index, 0xff, table->npalette_index * sizeof(uint32_t));
+    }
+
+    /* styles used by the block in order of appearance */
+    Vector_size_t palette = Vector_new_size_t();
+    size_t        bound   = 0;
+    uint32_t      nrows   = 0;
+
+    for (size_t i = begin; i < end; ++i) {
+        VtCompactLine* compact = self->lines.buf[i].compact;
+        if (!compact)
+            continue;
+
+        ++nrows;
+        bound += VtCompactLine_serialized_bound(compact);
+        for (uint32_t j = 0; j < compact->size; ++j) {
+            uint32_t* index = &table->palette_index[compact->cells[j].style];
+            if (*index == UINT32_MAX) {
+                *index = palette.size;
+                Vector_push_size_t(&palette, compact->cells[j].style);
+            }
+        }
+    }
+
+    if (!bound) {
+        Vector_destroy_size_t(&palette);
+        return;
+    }
+
+    bound += _Alignof(VtRune) + palette.size * sizeof(VtRune);
+    uint8_t* raw = malloc(bound);
+    uint8_t* out = raw;
+
+    struct VtColdBlockLine info[VT_COLD_BLOCK_LINES];
+    uint32_t               nlines = 0;
+
+    for (size_t i = begin, j; i < end; i = j) {
+        if (!self->lines.buf[i].compact) {
+            j = i + 1;
+            continue;
+        }
+
+        j              = Vt_frozen_rows_end(self, i, end);
+        uint32_t cells = 0;
+        for (size_t k = i; k < j; ++k)
+            cells += self->lines.buf[k].compact->size;
+
+        info[nlines++] = (struct VtColdBlockLine){ .offset = out - raw, .cells = cells };
+        out = VtCompactLine_serialize_rows(self->lines.buf + i,
+                                           j - i,
+                                           table->palette_index,
+                                           &self->clusters,
+                                           out);
+    }
+
+    size_t palette_offset = out - raw;
+    palette_offset += -palette_offset & (_Alignof(VtRune) - 1);
+    out = raw + palette_offset;
+
+    for (size_t* style = NULL; (style = Vector_iter_size_t(&palette, style));) {
+        memcpy(out, &table->styles.buf[*style], sizeof(VtRune));
+        out += sizeof(VtRune);
+        table->palette_index[*style] = UINT32_MAX;
+    }
+
+    size_t   size       = out - raw;
+    uint8_t* compressed = malloc(lz_compress_bound(size));
+    size_t   compressed_size = lz_compress(raw, size, compressed);
+
+    VtColdBlock* block     = malloc(sizeof(VtColdBlock) + compressed_size);
+    block->refs            = nrows;
+    block->size            = size;
+    block->compressed_size = compressed_size;
+    block->palette_offset  = palette_offset;
+    block->npalette        = palette.size;
+    block->nlines          = nlines;
+    block->spill_offset    = UINT64_MAX;
+    block->thawed          = NULL;
+    memcpy(block->lines, info, nlines * sizeof(*info));
+    memcpy(block->data, compressed, compressed_size);
+
+    free(compressed);
+    free(raw);
+    Vector_destroy_size_t(&palette);
+
+    for (size_t i = begin, j, idx = 0; i < end; i = j) {
+        if (!self->lines.buf[i].compact) {
+            j = i + 1;
+            continue;
+        }
+
+        j = Vt_frozen_rows_end(self, i, end);
+        for (uint32_t k = i, offset = 0; k < j; ++k) {
+            VtLine*  line  = &self->lines.buf[k];
+            uint32_t cells = line->compact->size;
+            VtCompactLine_unref(line->compact);
+            line->compact    = NULL;
+            line->cold       = block;
+            line->cold_index = idx;
+            line->cold_begin = offset;
+            line->cold_cells = cells;
+            offset += cells;
+        }
+        ++idx;
+    }
+}
+
+/**
+ * Get decompressed contents of a block and keep them in the thaw cache */
+static const uint8_t* Vt_thaw_block(Vt* self, VtColdBlock* block)
+{
+    if (block->thawed)
+        return block->thawed;
+
+    uint8_t* thawed = malloc(block->size);
+    if (!lz_decompress(block->data, block->compressed_size, thawed, block->size))
+        ERR("Failed to decompress scrollback block");
+
+    VtColdBlock** slot    = &self->thaw_cache[self->thaw_cache_next];
+    self->thaw_cache_next = (self->thaw_cache_next + 1) % VT_THAW_CACHE_SIZE;
+
+    if (*slot) {
+        free((*slot)->thawed);
+        (*slot)->thawed = NULL;
+        VtColdBlock_unref(*slot);
+    }
+
+    ++block->refs;
+    block->thawed = thawed;
+    *slot         = block;
+
+    return thawed;
+}
+
+static void Vt_clear_thaw_cache(Vt* self)
+{
+    for (uint32_t i = 0; i < VT_THAW_CACHE_SIZE; ++i) {
+        if (self->thaw_cache[i]) {
+            free(self->thaw_cache[i]->thawed);
+            self->thaw_cache[i]->thawed = NULL;
+            VtColdBlock_unref(self->thaw_cache[i]);
+            self->thaw_cache[i] = NULL;
+        }
+    }
+}
+
+/**
+ * Decode compact or compressed cells back to VtRunes */
+static void Vt_expand_line(Vt* self, VtLine* line)
+{
+    if (unlikely(line->cold)) {
+        VtColdBlock* block = line->cold;
+        line->data = VtColdBlock_read_line(block,
+                                           Vt_thaw_block(self, block),
+                                           line->cold_index,
+                                           line->cold_begin,
+                                           line->cold_cells,
+                                           &self->clusters);
+        line->cold = NULL;
+        VtColdBlock_unref(block);
+        return;
+    }
+
+    VtCompactLine* compact = line->compact;
+
+    if (likely(!compact))
+        return;
+
+    line->data      = Vector_new_with_capacity_VtRune(MAX(compact->size, 4));
+    line->data.size = compact->size;
+
+    for (uint32_t i = 0; i < compact->size; ++i) {
+        VtRune* rune    = &line->data.buf[i];
+        *rune           = self->style_table.styles.buf[compact->cells[i].style];
+        rune->rune.code = compact->cells[i].code;
+        rune->wide      = compact->cells[i].wide;
+    }
+
+    VtCompactCombine* combine = VtCompactLine_combine(compact);
+    for (uint32_t i = 0; i < compact->ncombine; ++i)
+        line->data.buf[combine[i].column].rune.cluster = combine[i].cluster;
+
+    VtCompactLine_unref(compact);
+    line->compact = NULL;
+}
+
+static inline void Vt_expand_line_at(Vt* self, size_t idx)
+{
+    if (unlikely(self->lines.buf[idx].compact || self->lines.buf[idx].cold)) {
+        Vt_expand_line(self, &self->lines.buf[idx]);
+        self->lines.compacted = MIN(self->lines.compacted, idx);
+        self->lines.frozen    = MIN(self->lines.frozen, idx);
+    }
+}
+
+/**
+ * Number of cells in a line, whether it is expanded or not */
+static inline size_t VtLine_cells(const VtLine* self)
+{
+    if (unlikely(self->cold))
+        return self->cold_cells;
+    if (unlikely(self->compact))
+        return self->compact->size;
+    return self->data.size;
+}
+
+/**
+ * Make sure the lines that can be drawn have VtRune contents */
+static void Vt_expand_visible_lines(Vt* self)
+{
+    size_t end = MIN(Vt_visual_bottom_line(self) + 1, self->lines.size);
+    for (size_t i = Vt_visual_top_line(self); i < end; ++i)
+        Vt_expand_line_at(self, i);
+}
+
+/**
+ * Make sure the lines on the screen and the ones that can be drawn have VtRune contents. Removing
+ * lines can bring compacted ones back onto the screen */
+static void Vt_expand_screen_lines(Vt* self)
+{
+    for (size_t i = Vt_top_line(self); i < self->lines.size; ++i)
+        Vt_expand_line_at(self, i);
+    Vt_expand_visible_lines(self);
+}
+
+/**
+ * Forget the character combining characters are added to if it belongs to @param line, called
+ * before the cells of that line are freed */
+static inline void Vt_forget_last_inserted_in(Vt* self, const VtLine* line)
+{
+    if (self->last_interted >= line->data.buf &&
+        self->last_interted < line->data.buf + line->data.size) {
+        self->last_interted = NULL;
+    }
+}
+
+/**
+ * Compact lines that were moved off the screen since the last call */
+static void Vt_compact_scrollback(Vt* self)
+{
+    /* alt buffer is active or scrollback is being viewed */
+    if (self->alt_lines.buf || self->scrolling_visual)
+        return;
+
+    size_t top     = Vt_top_line(self);
+    bool   rebuilt = false;
+    for (size_t i = self->lines.compacted; i < top; ++i) {
+        Vt_forget_last_inserted_in(self, &self->lines.buf[i]);
+        if (unlikely(!Vt_compact_line(self, &self->lines.buf[i]) && !rebuilt)) {
+            /* if the lines that are not frozen yet really use this many styles, the rest is kept
+             * expanded */
+            Vt_rebuild_style_table(self);
+            Vt_compact_line(self, &self->lines.buf[i]);
+            rebuilt = true;
+        }
+    }
+    self->lines.compacted = MAX(self->lines.compacted, top);
+}
+
+/**
+ * Compress blocks of compacted lines that are far enough from the screen. Does a limited amount of
+ * work per call, so a large burst of output is compressed over a few reads */
+static void Vt_freeze_scrollback(Vt* self)
+{
+    if (self->alt_lines.buf || self->scrolling_visual)
+        return;
+
+    size_t top   = Vt_top_line(self);
+    size_t limit = MIN(self->lines.compacted, top > VT_COLD_DISTANCE ? top - VT_COLD_DISTANCE : 0);
+
+    for (uint32_t budget = 4; budget && self->lines.frozen + VT_COLD_BLOCK_LINES <= limit;
+         --budget) {
+        Vt_freeze_lines(self, self->lines.frozen, self->lines.frozen + VT_COLD_BLOCK_LINES);
+        self->lines.frozen += VT_COLD_BLOCK_LINES;
+    }
+}
+
+/**
+ * Header of a block in the scrollback file, followed by the positions of its lines and the
+ * compressed contents */
+struct VtSpilledBlock
+{
+    uint32_t size, compressed_size, palette_offset, npalette;
+    uint16_t nlines;
+};
+
+static uint64_t Vt_spill_block(Vt* self, VtColdBlock* block)
+{
+    struct VtSpilledBlock header = {
+        .size            = block->size,
+        .compressed_size = block->compressed_size,
+        .palette_offset  = block->palette_offset,
+        .npalette        = block->npalette,
+        .nlines          = block->nlines,
+    };
+
+    size_t   lines_size = block->nlines * sizeof(*block->lines);
+    size_t   size       = sizeof(header) + lines_size + block->compressed_size;
+    uint8_t* record     = malloc(size);
+
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), block->lines, lines_size);
+    memcpy(record + sizeof(header) + lines_size, block->data, block->compressed_size);
+
+    block->spill_offset = Spill_write(&self->spill, record, size);
+    free(record);
+    return block->spill_offset;
+}
+
+static VtColdBlock* Vt_read_spilled_block(Vt* self, uint64_t offset)
+{
+    struct VtSpilledBlock header;
+    memcpy(&header, Spill_read(&self->spill, offset, sizeof(header)), sizeof(header));
+
+    size_t         lines_size = header.nlines * sizeof(struct VtColdBlockLine);
+    const uint8_t* record =
+      Spill_read(&self->spill, offset, sizeof(header) + lines_size + header.compressed_size);
+
+    VtColdBlock* block     = malloc(sizeof(VtColdBlock) + header.compressed_size);
+    block->refs            = 0;
+    block->size            = header.size;
+    block->compressed_size = header.compressed_size;
+    block->palette_offset  = header.palette_offset;
+    block->npalette        = header.npalette;
+    block->nlines          = header.nlines;
+    block->spill_offset    = offset;
+    block->thawed          = NULL;
+    memcpy(block->lines, record + sizeof(header), lines_size);
+    memcpy(block->data, record + sizeof(header) + lines_size, header.compressed_size);
+
+    return block;
+}
+
+/**
+ * Write the first @param n lines to the scrollback file before they are evicted. Lines are
+ * compressed first if they were not yet, blocks that are already in the file are not written
+ * again. If the file can not be written to, it is closed and lines are discarded from then on */
+static void Vt_spill_lines(Vt* self, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (unlikely(!Vt_compact_line(self, &self->lines.buf[i]))) {
+            Vt_rebuild_style_table(self);
+            Vt_compact_line(self, &self->lines.buf[i]);
+        }
+    }
+
+    for (size_t i = 0; i < n; i += VT_COLD_BLOCK_LINES)
+        Vt_freeze_lines(self, i, MIN(i + VT_COLD_BLOCK_LINES, n));
+
+    for (size_t i = 0; i < n; ++i) {
+        VtLine*      line  = &self->lines.buf[i];
+        VtColdBlock* block = line->cold;
+
+        /* the style table did not fit the line */
+        if (unlikely(!block))
+            continue;
+
+        if (block->spill_offset == UINT64_MAX && Vt_spill_block(self, block) == UINT64_MAX) {
+            WRN("Scrollback file disabled\n");
+            Spill_close(&self->spill);
+            return;
+        }
+
+        uint8_t  flags    = line->reflowable | line->rejoinable << 1 | line->was_reflown << 2;
+        uint64_t entry[SPILL_ENTRY_WORDS] = {
+            VT_SPILL_ENTRY(block->spill_offset, flags, line->cold_index),
+            VT_SPILL_ENTRY_SLICE(line->cold_begin, line->cold_cells),
+        };
+        if (!Spill_push_entry(&self->spill, entry)) {
+            WRN("Scrollback file disabled\n");
+            Spill_close(&self->spill);
+            return;
+        }
+    }
+}
+
+/**
+ * Move up to @param n of the most recently spilled lines back in front of the scrollback. They
+ * stay compressed until they are drawn or copied. Returns the number of lines added */
+static size_t Vt_page_in_spilled_lines(Vt* self, size_t n)
+{
+    if (!self->spill.is_open || self->alt_lines.buf)
+        return 0;
+
+    n = MIN(n, self->spill.nentries);
+    if (!n)
+        return 0;
 
-#include "wcwidth/wcwidth.h"
+    VtLine*      lines        = VtLineBuffer_prepend(&self->lines, n);
+    size_t       first        = self->spill.nentries - n;
+    VtColdBlock* block        = NULL;
+    uint64_t     block_offset = UINT64_MAX;
 
-VtRune blank_space;
+    for (size_t i = 0; i < n; ++i) {
+        const uint64_t* entry = Spill_entry(&self->spill, first + i);
+        uint8_t         flags = VT_SPILL_ENTRY_FLAGS(entry[0]);
 
-void (*Vt_destroy_line_proxy)(int32_t proxy[static 4]) = NULL;
+        if (VT_SPILL_ENTRY_OFFSET(entry[0]) != block_offset) {
+            block_offset = VT_SPILL_ENTRY_OFFSET(entry[0]);
+            block        = Vt_read_spilled_block(self, block_offset);
+        }
 
-static inline size_t Vt_top_line(const Vt* const self);
-void                 Vt_visual_scroll_to(Vt* self, size_t line);
-void                 Vt_visual_scroll_up(Vt* self);
-void                 Vt_visual_scroll_down(Vt* self);
-void                 Vt_visual_scroll_reset(Vt* self);
-static inline size_t Vt_get_scroll_region_top(Vt* self);
-static inline size_t Vt_get_scroll_region_bottom(Vt* self);
-static inline bool   Vt_scroll_region_not_default(Vt* self);
-static void          Vt_alt_buffer_on(Vt* self, bool save_mouse);
-static void          Vt_alt_buffer_off(Vt* self, bool save_mouse);
-static void          Vt_handle_SGR_sequence(Vt* self, Vector_char seq);
-static void          Vt_reset_text_attribs(Vt* self);
-static void          Vt_carriage_return(Vt* self);
-static void          Vt_clear_right(Vt* self);
-static void          Vt_clear_left(Vt* self);
-static inline void   Vt_scroll_out_all_content(Vt* self);
-static void          Vt_empty_line_fill_bg(Vt* self, size_t idx);
-static void          Vt_cursor_down(Vt* self);
-static void          Vt_cursor_up(Vt* self);
-static void          Vt_cursor_left(Vt* self);
-static void          Vt_cursor_right(Vt* self);
-static void          Vt_insert_new_line(Vt* self);
-static void          Vt_scroll_up(Vt* self);
-static void          Vt_scroll_down(Vt* self);
-static void          Vt_reverse_line_feed(Vt* self);
-static void          Vt_delete_line(Vt* self);
-static void          Vt_delete_chars(Vt* self, size_t n);
-static void          Vt_erase_chars(Vt* self, size_t n);
-static void          Vt_clear_above(Vt* self);
-static inline void   Vt_scroll_out_above(Vt* self);
-static void          Vt_insert_line(Vt* self);
-static void          Vt_clear_display_and_scrollback(Vt* self);
-static void          Vt_erase_to_end(Vt* self);
-static void          Vt_move_cursor(Vt* self, uint32_t c, uint32_t r);
-static void          Vt_move_cursor_to_column(Vt* self, uint32_t c);
-static void          Vt_push_title(Vt* self);
-static void          Vt_pop_title(Vt* self);
-static inline void   Vt_insert_char_at_cursor(Vt* self, VtRune c);
-static inline void   Vt_insert_char_at_cursor_with_shift(Vt* self, VtRune c);
-static Vector_char line_to_string(Vector_VtRune* line, size_t begin, size_t end, const char* tail);
-static inline void Vt_mark_proxy_fully_damaged(Vt* self, size_t idx);
-static void        Vt_mark_proxy_damaged_cell(Vt* self, size_t line, size_t rune);
+        ++block->refs;
+        lines[i] = (VtLine){
+            .damage      = (struct VtLineDamage){ .type = VT_LINE_DAMAGE_FULL },
+            .cold        = block,
+            .cold_index  = VT_SPILL_ENTRY_INDEX(entry[0]),
+            .cold_begin  = VT_SPILL_ENTRY_BEGIN(entry[1]),
+            .cold_cells  = VT_SPILL_ENTRY_CELLS(entry[1]),
+            .reflowable  = flags & 1,
+            .rejoinable  = flags & 2,
+            .was_reflown = flags & 4,
+        };
+    }
 
-static inline VtLine VtLine_new()
-{
-    return (VtLine){ .damage =
-                       (struct VtLineDamage){
-                         .type  = VT_LINE_DAMAGE_FULL,
-                         .front = 0,
-                         .end   = 0,
-                         .shift = 0,
-                       },
-                     .reflowable = true,
-                     .rejoinable = false,
-                     .data       = Vector_new_VtRune(),
-                     .proxy      = { { 0 } } };
-}
+    Spill_pop_entries(&self->spill, n);
 
-static void Vt_output(Vt* self, const char* buf, size_t len)
-{
-    Vector_pushv_char(&self->output, buf, len);
-}
+    self->cursor.row += n;
+    self->saved_active_line += n;
+    self->visual_scroll_top += n;
 
-#define Vt_output_formated(vt, fmt, ...)                                                           \
-    char _tmp[64];                                                                                 \
-    int  _len = snprintf(_tmp, sizeof(_tmp), fmt, __VA_ARGS__);                                    \
-    Vt_output((vt), _tmp, _len);
+    /* written at an earlier width */
+    self->reflow_top += n;
+
+    if (self->selection.mode != SELECT_MODE_NONE) {
+        self->selection.begin_line += n;
+        self->selection.end_line += n;
+        self->selection.click_begin_line += n;
+    }
+
+    return n;
+}
 
 /**
  * Get string from selected region */
@@ -104,11 +1307,15 @@ Vector_char Vt_select_region_to_string(Vt* self)
     size_t      begin_line = MIN(self->selection.begin_line, self->selection.end_line);
     size_t      end_line   = MAX(self->selection.begin_line, self->selection.end_line);
 
+    for (size_t i = begin_line; i <= end_line && i < self->lines.size; ++i)
+        Vt_expand_line_at(self, i);
+
     if (begin_line == end_line && self->selection.mode != SELECT_MODE_NONE) {
         begin_char_idx = MIN(self->selection.begin_char_idx, self->selection.end_char_idx);
         end_char_idx   = MAX(self->selection.begin_char_idx, self->selection.end_char_idx);
 
-        return line_to_string(&self->lines.buf[begin_line].data,
+        return line_to_string(&self->clusters,
+                              &self->lines.buf[begin_line].data,
                               begin_char_idx,
                               end_char_idx + 1,
                               "");
@@ -121,28 +1328,38 @@ Vector_char Vt_select_region_to_string(Vt* self)
     }
 
     if (self->selection.mode == SELECT_MODE_NORMAL) {
-        ret = line_to_string(&self->lines.buf[begin_line].data,
+        ret = line_to_string(&self->clusters,
+                             &self->lines.buf[begin_line].data,
                              begin_char_idx,
                              0,
                              self->lines.buf[begin_line + 1].rejoinable ? "" : "\n");
         Vector_pop_char(&ret);
         for (size_t i = begin_line + 1; i < end_line; ++i) {
-            tmp = line_to_string(&self->lines.buf[i].data,
+            tmp = line_to_string(&self->clusters,
+                                 &self->lines.buf[i].data,
                                  0,
                                  0,
                                  self->lines.buf[i + 1].rejoinable ? "" : "\n");
             Vector_pushv_char(&ret, tmp.buf, tmp.size - 1);
             Vector_destroy_char(&tmp);
         }
-        tmp = line_to_string(&self->lines.buf[end_line].data, 0, end_char_idx + 1, "");
+        tmp = line_to_string(&self->clusters,
+                             &self->lines.buf[end_line].data,
+                             0,
+                             end_char_idx + 1,
+                             "");
         Vector_pushv_char(&ret, tmp.buf, tmp.size - 1);
         Vector_destroy_char(&tmp);
     } else if (self->selection.mode == SELECT_MODE_BOX) {
-        ret =
-          line_to_string(&self->lines.buf[begin_line].data, begin_char_idx, end_char_idx + 1, "\n");
+        ret = line_to_string(&self->clusters,
+                             &self->lines.buf[begin_line].data,
+                             begin_char_idx,
+                             end_char_idx + 1,
+                             "\n");
         Vector_pop_char(&ret);
         for (size_t i = begin_line + 1; i <= end_line; ++i) {
-            tmp = line_to_string(&self->lines.buf[i].data,
+            tmp = line_to_string(&self->clusters,
+                                 &self->lines.buf[i].data,
                                  begin_char_idx,
                                  end_char_idx + 1,
                                  i == end_line ? "" : "\n");
@@ -218,15 +1435,33 @@ void Vt_select_init_line(Vt* self, int32_t y)
     Vt_mark_proxy_fully_damaged(self, self->selection.begin_line);
 }
 
+static inline void Vt_notify_repaint_required(Vt* self)
+{
+    if (self->deferred_callbacks.active) {
+        self->deferred_callbacks.repaint_required = true;
+    } else {
+        CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+    }
+}
+
+static inline void Vt_notify_action_performed(Vt* self)
+{
+    if (self->deferred_callbacks.active) {
+        self->deferred_callbacks.action_performed = true;
+    } else {
+        CALL_FP(self->callbacks.on_action_performed, self->callbacks.user_data);
+    }
+}
+
 static inline void Vt_mark_proxy_fully_damaged(Vt* self, size_t idx)
 {
-    CALL_FP(self->callbacks.on_action_performed, self->callbacks.user_data);
+    Vt_notify_action_performed(self);
     self->lines.buf[idx].damage.type = VT_LINE_DAMAGE_FULL;
 }
 
 static void Vt_mark_proxy_damaged_cell(Vt* self, size_t line, size_t rune)
 {
-    CALL_FP(self->callbacks.on_action_performed, self->callbacks.user_data);
+    Vt_notify_action_performed(self);
     switch (self->lines.buf[line].damage.type) {
         case VT_LINE_DAMAGE_NONE:
             self->lines.buf[line].damage.type  = VT_LINE_DAMAGE_RANGE;
@@ -310,7 +1545,7 @@ void Vt_select_commit(Vt* self)
           self->selection.click_begin_char_idx;
 
         Vt_mark_proxies_damaged_in_selected_region(self);
-        CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+        Vt_notify_repaint_required(self);
     }
 }
 
@@ -337,7 +1572,7 @@ void Vt_select_set_end_cell(Vt* self, int32_t x, int32_t y)
         size_t lo = MIN(MIN(old_end, self->selection.end_line), self->selection.begin_line);
         size_t hi = MAX(MAX(old_end, self->selection.end_line), self->selection.begin_line);
         Vt_mark_proxies_damaged_in_region(self, hi, lo);
-        CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+        Vt_notify_repaint_required(self);
     }
 }
 
@@ -364,7 +1599,7 @@ void Vt_select_set_front_cell(Vt* self, int32_t x, int32_t y)
         size_t lo = MIN(MIN(old_front, self->selection.end_line), self->selection.begin_line);
         size_t hi = MAX(MAX(old_front, self->selection.end_line), self->selection.begin_line);
         Vt_mark_proxies_damaged_in_region(self, hi, lo);
-        CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+        Vt_notify_repaint_required(self);
     }
 }
 
@@ -372,7 +1607,7 @@ void Vt_select_end(Vt* self)
 {
     self->selection.mode = SELECT_MODE_NONE;
     Vt_mark_proxies_damaged_in_selected_region(self);
-    CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+    Vt_notify_repaint_required(self);
 }
 
 static inline char32_t char_sub_uk(char original)
@@ -573,7 +1808,11 @@ __attribute__((cold)) char* pty_string_prettyfy(const char* str, int32_t max)
 
 /**
  * get utf-8 text from @param line in range from @param begin to @param end */
-static Vector_char line_to_string(Vector_VtRune* line, size_t begin, size_t end, const char* tail)
+static Vector_char line_to_string(const VtClusterTable* clusters,
+                                  Vector_VtRune*        line,
+                                  size_t                begin,
+                                  size_t                end,
+                                  const char*           tail)
 {
     Vector_char res;
     end   = MIN(end ? end : line->size, line->size);
@@ -596,16 +1835,23 @@ static Vector_char line_to_string(Vector_VtRune* line, size_t begin, size_t end,
             continue;
         }
         if (line->buf[i].rune.code > CHAR_MAX) {
-            static mbstate_t mbstate;
-            size_t           bytes = c32rtomb(utfbuf, line->buf[i].rune.code, &mbstate);
+            size_t bytes = utf8_encode(line->buf[i].rune.code, utfbuf);
             if (bytes > 0) {
                 Vector_pushv_char(&res, utfbuf, bytes);
             }
-            prev_wide = wcwidth(line->buf[i].rune.code) > 1;
+            prev_wide = line->buf[i].wide;
         } else {
             Vector_push_char(&res, line->buf[i].rune.code);
             prev_wide = false;
         }
+        if (unlikely(line->buf[i].rune.cluster)) {
+            uint32_t        len;
+            const char32_t* codes = VtClusterTable_get(clusters, line->buf[i].rune.cluster, &len);
+            for (uint32_t j = 0; j < len; ++j) {
+                size_t bytes = utf8_encode(codes[j], utfbuf);
+                Vector_pushv_char(&res, utfbuf, bytes);
+            }
+        }
     }
     if (tail) {
         Vector_pushv_char(&res, tail, strlen(tail) + 1);
@@ -615,80 +1861,41 @@ static Vector_char line_to_string(Vector_VtRune* line, size_t begin, size_t end,
 }
 
 /**
- * Split string on any character in @param delimiters, filter out any character in @param filter.
- * first character of returned string is the immediately preceding delimiter, '\0' if none. Multiple
- * @param greedy_delimiters are treated as a single delimiter */
-static Vector_Vector_char string_split_on(const char* str,
-                                          const char* delimiters,
-                                          const char* greedy_delimiters,
-                                          const char* filter)
-{
-    Vector_Vector_char ret = Vector_new_with_capacity_Vector_char(8);
-    Vector_push_Vector_char(&ret, Vector_new_with_capacity_char(8));
-    Vector_push_char(&ret.buf[0], '\0');
-
-    for (; *str; ++str) {
-        /* skip filtered */
-        for (const char* i = filter; filter && *i; ++i)
-            if (*str == *i)
-                goto continue_outer;
-
-        bool is_non_greedy = false;
-        char any_symbol    = 0;
-        if (delimiters) {
-            for (const char* i = delimiters; *i; ++i) {
-                if (*i == *str) {
-                    is_non_greedy = true;
-                    any_symbol    = *i;
-                    break;
-                }
-            }
-        }
-        if (greedy_delimiters) {
-            for (const char* i = greedy_delimiters; *i; ++i) {
-                if (*i == *str) {
-                    any_symbol = *i;
-                    break;
-                }
-            }
-        }
-
-        if (any_symbol) {
-            Vector_push_char(&ret.buf[ret.size - 1], '\0');
-
-            if (ret.buf[ret.size - 1].size == 2 && !is_non_greedy) {
-                ret.buf[ret.size - 1].size = 0;
-            } else {
-                Vector_push_Vector_char(&ret, Vector_new_with_capacity_char(8));
-            }
-            Vector_push_char(&ret.buf[ret.size - 1], any_symbol);
-        } else {
-            /* record delimiter */
-            Vector_push_char(&ret.buf[ret.size - 1], *str);
-        }
-    continue_outer:;
-    }
-    Vector_push_char(&ret.buf[ret.size - 1], '\0');
-
-    return ret;
-}
-
-__attribute__((hot)) static inline bool is_csi_sequence_terminated(const char*  seq,
-                                                                   const size_t size)
+ * Get the length of the leading run of printable ascii characters (0x20 - 0x7e) in buf. Those
+ * can be inserted without going through the parser one byte at a time. */
+__attribute__((hot)) static inline size_t printable_ascii_run_length(const char* buf, size_t n)
 {
-    if (!size)
-        return false;
+    size_t i = 0;
+
+#ifdef __AVX2__
+    const __m256i lo32 = _mm256_set1_epi8(0x1f), hi32 = _mm256_set1_epi8(0x7f);
+    for (; i + 32 <= n; i += 32) {
+        /* bytes >= 0x80 are negative when compared as signed and fail the first test */
+        __m256i  chunk = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i  ok    = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, lo32),
+                                      _mm256_cmpgt_epi8(hi32, chunk));
+        uint32_t mask  = ~(uint32_t)_mm256_movemask_epi8(ok);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
 
-    return isalpha(seq[size - 1]) || seq[size - 1] == '@' || seq[size - 1] == '{' ||
-           seq[size - 1] == '}' || seq[size - 1] == '~' || seq[size - 1] == '|';
-}
+#ifdef __SSE2__
+    const __m128i lo16 = _mm_set1_epi8(0x1f), hi16 = _mm_set1_epi8(0x7f);
+    for (; i + 16 <= n; i += 16) {
+        __m128i  chunk = _mm_loadu_si128((const __m128i*)(buf + i));
+        __m128i  ok    = _mm_and_si128(_mm_cmpgt_epi8(chunk, lo16), _mm_cmpgt_epi8(hi16, chunk));
+        uint32_t mask  = ~(uint32_t)_mm_movemask_epi8(ok) & 0xffff;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
 
-static inline bool is_generic_sequence_terminated(const char* seq, const size_t size)
-{
-    if (!size)
-        return false;
+    for (; i < n; ++i)
+        if (buf[i] < 0x20 || buf[i] > 0x7e)
+            break;
 
-    return seq[size - 1] == '\a' || (size > 1 && seq[size - 2] == '\e' && seq[size - 1] == '\\');
+    return i;
 }
 
 Vt Vt_new(uint32_t cols, uint32_t rows)
@@ -699,10 +1906,9 @@ Vt Vt_new(uint32_t cols, uint32_t rows)
     self.ws                   = (struct winsize){ .ws_col = cols, .ws_row = rows };
     self.scroll_region_bottom = rows;
     self.parser.state         = PARSER_STATE_LITERAL;
-    self.parser.in_mb_seq     = false;
 
     self.parser.char_state = blank_space = (VtRune){
-        .rune          = ((Rune){ .code = ' ', .combine = { 0 }, .style = VT_RUNE_NORMAL }),
+        .rune          = ((Rune){ .code = ' ', .cluster = 0, .style = VT_RUNE_NORMAL }),
         .bg            = settings.bg,
         .fg            = settings.fg,
         .dim           = false,
@@ -714,23 +1920,29 @@ Vt Vt_new(uint32_t cols, uint32_t rows)
 
     self.parser.active_sequence = Vector_new_char();
     self.output                 = Vector_new_char();
-    self.lines                  = Vector_new_VtLine();
+    self.lines                  = VtLineBuffer_new();
+    self.style_table            = VtStyleTable_new();
+    self.clusters               = VtClusterTable_new();
 
     for (size_t i = 0; i < self.ws.ws_row; ++i) {
-        Vector_push_VtLine(&self.lines, VtLine_new());
+        VtLineBuffer_push(&self.lines, VtLine_new());
     }
 
     self.cursor.type     = CURSOR_BLOCK;
     self.cursor.blinking = true;
     self.cursor.col      = 0;
 
-    self.tabstop = 8;
+    Vt_reset_tab_stops(&self);
 
     self.title       = NULL;
     self.title_stack = Vector_new_size_t();
 
     self.unicode_input.buffer = Vector_new_char();
 
+    if (settings.scrollback_spill && !Spill_open(&self.spill)) {
+        WRN("Scrollback file could not be created, lines past the scrollback size are dropped\n");
+    }
+
     return self;
 }
 
@@ -772,6 +1984,9 @@ static inline bool Vt_scroll_region_not_default(Vt* self)
 
 void Vt_visual_scroll_up(Vt* self)
 {
+    if (self->scrolling_visual ? !self->visual_scroll_top : !Vt_top_line(self))
+        Vt_page_in_spilled_lines(self, VT_SPILL_PAGE_LINES);
+
     if (self->scrolling_visual) {
         if (self->visual_scroll_top)
             --self->visual_scroll_top;
@@ -779,6 +1994,8 @@ void Vt_visual_scroll_up(Vt* self)
         self->scrolling_visual  = true;
         self->visual_scroll_top = Vt_top_line(self) - 1;
     }
+    Vt_reflow_history_in_view(self);
+    Vt_expand_visible_lines(self);
 }
 
 void Vt_visual_scroll_down(Vt* self)
@@ -788,13 +2005,19 @@ void Vt_visual_scroll_down(Vt* self)
         if (self->visual_scroll_top == Vt_top_line(self))
             self->scrolling_visual = false;
     }
+    Vt_expand_visible_lines(self);
 }
 
 void Vt_visual_scroll_to(Vt* self, size_t line)
 {
+    if (!line && self->scrolling_visual)
+        Vt_page_in_spilled_lines(self, VT_SPILL_PAGE_LINES);
+
     line                    = MIN(line, Vt_top_line(self));
     self->visual_scroll_top = line;
     self->scrolling_visual  = line != Vt_top_line(self);
+    Vt_reflow_history_in_view(self);
+    Vt_expand_visible_lines(self);
 }
 
 void Vt_visual_scroll_reset(Vt* self)
@@ -822,11 +2045,25 @@ void Vt_dump_info(Vt* self)
     printf("  no auto wrap:                     %d\n", self->modes.no_auto_wrap);
     printf("  reverse video:                    %d\n", self->modes.video_reverse);
 
+    if (settings.scrollback_dedup) {
+        VtCompactLineTable* table = &self->line_table;
+        printf("\nScrollback deduplication:\n");
+        printf("  compacted lines:                  %lu\n", table->interned);
+        printf("  reused shared copy:               %lu (%.1f%%)\n",
+               table->shared,
+               table->interned ? 100.0 * table->shared / table->interned : 0.0);
+        printf("  lines in the table:               %u\n", table->nlines);
+    }
+
     printf("\n");
     printf("  S S | Number of lines %zu (last index: %zu)\n",
            self->lines.size,
            Vt_bottom_line(self));
     printf("  C C | Terminal size %hu x %hu\n", self->ws.ws_col, self->ws.ws_row);
+    if (self->spill.is_open)
+        printf("  R R | Lines in scrollback file %zu (%lu bytes)\n",
+               self->spill.nentries,
+               self->spill.data_size);
     printf("V R R | \n");
     printf("I O . | Visible region: %zu - %zu\n",
            Vt_visual_top_line(self),
@@ -848,7 +2085,8 @@ void Vt_dump_info(Vt* self)
     printf("| | |  BUFFER: %s\n", (self->alt_lines.buf ? "ALTERNATIVE" : "MAIN"));
     printf("V V V  \n");
     for (size_t i = 0; i < self->lines.size; ++i) {
-        Vector_char str = line_to_string(&self->lines.buf[i].data, 0, 0, "");
+        Vt_expand_line_at(self, i);
+        Vector_char str = line_to_string(&self->clusters, &self->lines.buf[i].data, 0, 0, "");
         printf("%c %c %c %4zu%c sz:%4zu dmg:%d proxy{%3d,%3d,%3d,%3d} reflow{%d,%d} data: %.30s\n",
                i == Vt_top_line(self) ? 'v' : i == Vt_bottom_line(self) ? '^' : ' ',
                i == Vt_get_scroll_region_top(self) || i == Vt_get_scroll_region_bottom(self) ? '-'
@@ -869,86 +2107,98 @@ void Vt_dump_info(Vt* self)
     }
 }
 
-static void Vt_reflow_expand(Vt* self, uint32_t x)
+/**
+ * Join lines in [@param begin, @param bottom_bound) wrapped at a smaller width than @param x.
+ * Both should be at the start of a logical line. Returns the number of lines removed */
+static size_t Vt_reflow_expand_lines(Vt* self, size_t begin, size_t bottom_bound, uint32_t x)
 {
-    size_t bottom_bound = self->cursor.row;
-
-    int removals = 0;
-
-    while (bottom_bound > 0 && self->lines.buf[bottom_bound].rejoinable) {
-        --bottom_bound;
-    }
+    size_t removals = 0;
 
-    for (size_t i = 0; i < bottom_bound; ++i) {
+    for (size_t i = begin; i < bottom_bound; ++i) {
+        /* keep joining until the line is full, it may have been split into more than two */
+        while (VtLine_cells(&self->lines.buf[i]) < x && self->lines.buf[i].reflowable &&
+               i + 1 < bottom_bound && self->lines.buf[i + 1].rejoinable) {
+            int32_t chars_to_move = x - VtLine_cells(&self->lines.buf[i]);
 
-        if (self->lines.buf[i].data.size < x && self->lines.buf[i].reflowable) {
-            int32_t chars_to_move = x - self->lines.buf[i].data.size;
+            /* only lines that are joined are expanded, the rest of the history stays compact */
+            Vt_expand_line_at(self, i);
+            Vt_expand_line_at(self, i + 1);
 
-            if (i + 1 < bottom_bound && self->lines.buf[i + 1].rejoinable) {
-                chars_to_move = MIN(chars_to_move, (int32_t)self->lines.buf[i + 1].data.size);
+            chars_to_move = MIN(chars_to_move, (int32_t)self->lines.buf[i + 1].data.size);
 
-                Vector_pushv_VtRune(&self->lines.buf[i].data,
-                                    self->lines.buf[i + 1].data.buf,
-                                    chars_to_move);
+            Vector_pushv_VtRune(&self->lines.buf[i].data,
+                                self->lines.buf[i + 1].data.buf,
+                                chars_to_move);
 
-                Vector_remove_at_VtRune(&self->lines.buf[i + 1].data, 0, chars_to_move);
+            Vector_remove_at_VtRune(&self->lines.buf[i + 1].data, 0, chars_to_move);
 
-                if (self->selection.mode == SELECT_MODE_NORMAL) {
-                    if (self->selection.begin_line == i + 1) {
-                        if (self->selection.begin_char_idx <= chars_to_move) {
-                            --self->selection.begin_line;
-                            self->selection.begin_char_idx =
-                              self->selection.begin_char_idx + self->lines.buf[i].data.size - 1;
-                        } else {
-                            self->selection.begin_char_idx -= chars_to_move;
-                        }
+            if (self->selection.mode == SELECT_MODE_NORMAL) {
+                if (self->selection.begin_line == i + 1) {
+                    if (self->selection.begin_char_idx <= chars_to_move) {
+                        --self->selection.begin_line;
+                        self->selection.begin_char_idx =
+                          self->selection.begin_char_idx + self->lines.buf[i].data.size - 1;
+                    } else {
+                        self->selection.begin_char_idx -= chars_to_move;
                     }
-                    if (self->selection.end_line == i + 1) {
-                        if (self->selection.end_char_idx < chars_to_move) {
-                            --self->selection.end_line;
-                            self->selection.end_char_idx =
-                              self->selection.end_char_idx + self->lines.buf[i].data.size - 1;
-                        } else {
-                            self->selection.end_char_idx -= chars_to_move;
-                        }
+                }
+                if (self->selection.end_line == i + 1) {
+                    if (self->selection.end_char_idx < chars_to_move) {
+                        --self->selection.end_line;
+                        self->selection.end_char_idx =
+                          self->selection.end_char_idx + self->lines.buf[i].data.size - 1;
+                    } else {
+                        self->selection.end_char_idx -= chars_to_move;
                     }
                 }
+            }
 
-                Vt_mark_proxy_fully_damaged(self, i);
-                Vt_mark_proxy_fully_damaged(self, i + 1);
+            Vt_mark_proxy_fully_damaged(self, i);
+            Vt_mark_proxy_fully_damaged(self, i + 1);
+
+            if (!self->lines.buf[i + 1].data.size) {
+                self->lines.buf[i].was_reflown = false;
+                size_t remove_index            = i + 1;
+                VtLineBuffer_remove_at(&self->lines, remove_index, 1);
+                --self->cursor.row;
+                --bottom_bound;
+                ++removals;
+
+                /* correct scroll region */
+                if (self->scrolling_visual && remove_index < Vt_visual_top_line(self)) {
+                    --self->visual_scroll_top;
+                }
 
-                if (!self->lines.buf[i + 1].data.size) {
-                    self->lines.buf[i].was_reflown = false;
-                    size_t remove_index            = i + 1;
-                    Vector_remove_at_VtLine(&self->lines, remove_index, 1);
-                    --self->cursor.row;
-                    --bottom_bound;
-                    ++removals;
-
-                    /* correct scroll region */
-                    if (self->scrolling_visual && remove_index < Vt_visual_top_line(self)) {
-                        Vt_visual_scroll_up(self);
+                /* correct selection */
+                if (self->selection.mode == SELECT_MODE_NORMAL) {
+                    if (self->selection.begin_line >= remove_index) {
+                        --self->selection.begin_line;
                     }
-
-                    /* correct selection */
-                    if (self->selection.mode == SELECT_MODE_NORMAL) {
-                        if (self->selection.begin_line >= remove_index) {
-                            --self->selection.begin_line;
-                        }
-                        if (self->selection.end_line > remove_index) {
-                            --self->selection.end_line;
-                        }
+                    if (self->selection.end_line > remove_index) {
+                        --self->selection.end_line;
                     }
                 }
             }
         }
     }
 
-    int underflow = -((int64_t)self->lines.size - self->ws.ws_row);
+    return removals;
+}
+
+static void Vt_reflow_expand(Vt* self, size_t begin, uint32_t x)
+{
+    size_t bottom_bound = self->cursor.row;
+
+    while (bottom_bound > 0 && self->lines.buf[bottom_bound].rejoinable) {
+        --bottom_bound;
+    }
+
+    size_t removals  = Vt_reflow_expand_lines(self, begin, bottom_bound, x);
+    int    underflow = -((int64_t)self->lines.size - self->ws.ws_row);
 
     if (underflow > 0) {
-        for (int i = 0; i < (int)MIN(underflow, removals); ++i)
-            Vector_push_VtLine(&self->lines, VtLine_new());
+        for (size_t i = 0; i < MIN((size_t)underflow, removals); ++i)
+            VtLineBuffer_push(&self->lines, VtLine_new());
     }
 
     /* do not scroll past end of screen (self->ws was not updated yet, so Vt_scroll_down does not
@@ -958,17 +2208,21 @@ static void Vt_reflow_expand(Vt* self, uint32_t x)
     }
 }
 
-static void Vt_reflow_shrink(Vt* self, uint32_t x)
+/**
+ * Split lines in [@param begin, @param bottom_bound) longer than @param x. Both should be at the
+ * start of a logical line. Returns the number of lines inserted */
+static size_t Vt_reflow_shrink_lines(Vt* self, size_t begin, size_t bottom_bound, uint32_t x)
 {
     size_t insertions_made = 0;
-    size_t bottom_bound    = self->cursor.row;
 
-    while (bottom_bound > 0 && self->lines.buf[bottom_bound].rejoinable) {
-        --bottom_bound;
-    }
+    for (size_t i = begin; i < bottom_bound; ++i) {
+        if (VtLine_cells(&self->lines.buf[i]) > x && self->lines.buf[i].reflowable) {
+            /* only lines that are split are expanded, the rest of the history stays compact */
+            Vt_expand_line_at(self, i);
+            if (i + 1 < bottom_bound && self->lines.buf[i + 1].rejoinable) {
+                Vt_expand_line_at(self, i + 1);
+            }
 
-    for (size_t i = 0; i < bottom_bound; ++i) {
-        if (self->lines.buf[i].data.size > x && self->lines.buf[i].reflowable) {
             size_t chars_to_move = self->lines.buf[i].data.size - x;
 
             /* move select to next line */
@@ -1004,11 +2258,14 @@ static void Vt_reflow_shrink(Vt* self, uint32_t x)
                       self->lines.buf[i + 1].data.buf,
                       *(self->lines.buf[i].data.buf + x + chars_to_move - ii - 1));
                 }
+                /* lines wrapped by printing past the edge are not marked yet, keep their trailing
+                 * blanks when they are trimmed */
+                self->lines.buf[i].was_reflown = true;
                 Vt_mark_proxy_fully_damaged(self, i + 1);
             } else if (i < bottom_bound) {
                 ++insertions_made;
                 size_t insert_index = i + 1;
-                Vector_insert_VtLine(&self->lines, self->lines.buf + insert_index, VtLine_new());
+                VtLineBuffer_insert_at(&self->lines, insert_index, VtLine_new());
 
                 /* correct visual scroll region */
                 if (self->scrolling_visual && Vt_visual_top_line(self) >= insert_index &&
@@ -1036,44 +2293,227 @@ static void Vt_reflow_shrink(Vt* self, uint32_t x)
         }
     }
 
-    if (self->lines.size - 1 != self->cursor.row) {
-        size_t overflow =
-          self->lines.size > self->ws.ws_row ? self->lines.size - self->ws.ws_row : 0;
-        size_t whitespace_below = self->lines.size - 1 - self->cursor.row;
-        size_t to_pop           = MIN(overflow, MIN(whitespace_below, insertions_made));
-        Vector_pop_n_VtLine(&self->lines, to_pop);
+    return insertions_made;
+}
+
+static void Vt_reflow_shrink(Vt* self, size_t begin, uint32_t x)
+{
+    size_t bottom_bound = self->cursor.row;
+
+    while (bottom_bound > 0 && self->lines.buf[bottom_bound].rejoinable) {
+        --bottom_bound;
+    }
+
+    size_t insertions_made = Vt_reflow_shrink_lines(self, begin, bottom_bound, x);
+
+    if (self->lines.size - 1 != self->cursor.row) {
+        size_t overflow =
+          self->lines.size > self->ws.ws_row ? self->lines.size - self->ws.ws_row : 0;
+        size_t whitespace_below = self->lines.size - 1 - self->cursor.row;
+        size_t to_pop           = MIN(overflow, MIN(whitespace_below, insertions_made));
+        VtLineBuffer_pop_n(&self->lines, to_pop);
+    }
+}
+
+/**
+ * Remove extra columns from lines in [@param begin, @param end). Shrinking copies the end of split
+ * lines to the next one, this drops the original */
+static void Vt_trim_columns(Vt* self, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; ++i) {
+        if (VtLine_cells(&self->lines.buf[i]) > (size_t)self->ws.ws_col) {
+            Vt_expand_line_at(self, i);
+        }
+
+        if (self->lines.buf[i].data.size > (size_t)self->ws.ws_col) {
+            Vt_mark_proxy_fully_damaged(self, i);
+            Vt_destroy_line_proxy(self->lines.buf[i].proxy.data);
+
+            size_t blanks = 0;
+
+            size_t s = self->lines.buf[i].data.size;
+            Vector_pop_n_VtRune(&self->lines.buf[i].data, s - self->ws.ws_col);
+
+            if (self->lines.buf[i].was_reflown)
+                continue;
+
+            s = self->lines.buf[i].data.size;
+
+            for (blanks = 0; blanks < s; ++blanks) {
+                if (!(self->lines.buf[i].data.buf[s - 1 - blanks].rune.code == ' ' &&
+                      ColorRGBA_eq(settings.bg, self->lines.buf[i].data.buf[s - 1 - blanks].bg))) {
+                    break;
+                }
+            }
+
+            Vector_pop_n_VtRune(&self->lines.buf[i].data, blanks);
+        }
+    }
+}
+
+/**
+ * Wrap a logical line at @param x by changing which part of its compressed contents each row shows,
+ * appending the rows to @param out. Returns false and leaves the rows as they were unless they
+ * show all of one stored line */
+static bool Vt_reslice_logical_line(VtLine* rows, size_t n, uint32_t x, VtLineBuffer* out)
+{
+    VtColdBlock* block = rows[0].cold;
+    if (!block || rows[0].cold_begin)
+        return false;
+
+    uint32_t index = rows[0].cold_index, cells = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (rows[i].cold != block || rows[i].cold_index != index || rows[i].cold_begin != cells ||
+            !rows[i].reflowable) {
+            return false;
+        }
+        cells += rows[i].cold_cells;
+    }
+
+    if (cells != block->lines[index].cells)
+        return false;
+
+    uint32_t nrows = MAX(1, (cells + x - 1) / x);
+    for (uint32_t i = 0; i < nrows; ++i) {
+        ++block->refs;
+        VtLineBuffer_push(out,
+                          (VtLine){
+                            .damage      = (struct VtLineDamage){ .type = VT_LINE_DAMAGE_FULL },
+                            .cold        = block,
+                            .cold_index  = index,
+                            .cold_begin  = i * x,
+                            .cold_cells  = MIN(x, cells - i * x),
+                            .reflowable  = true,
+                            .rejoinable  = i ? true : rows[0].rejoinable,
+                            .was_reflown = i + 1 < nrows,
+                          });
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        VtLine_destroy(&rows[i]);
+
+    return true;
+}
+
+/**
+ * Reflow the logical lines in the VT_REFLOW_STEP_LINES lines before Vt.reflow_top. They may have
+ * been wrapped at any of the earlier widths. Compressed lines are only sliced differently, others
+ * are both joined and split. This is done in a separate buffer, so the lines after them are moved
+ * once instead of on every split */
+bool Vt_reflow_history_step(Vt* self)
+{
+    if (!Vt_is_reflow_pending(self))
+        return false;
+
+    size_t end   = MIN(self->reflow_top, self->lines.size);
+    size_t begin = end > VT_REFLOW_STEP_LINES ? end - VT_REFLOW_STEP_LINES : 0;
+    while (begin && self->lines.buf[begin].rejoinable) {
+        --begin;
+    }
+
+    if (self->selection.mode != SELECT_MODE_NONE &&
+        MIN(self->selection.begin_line, self->selection.end_line) < end) {
+        Vt_select_end(self);
+    }
+
+    self->last_interted = NULL;
+
+    VtLineBuffer    lines            = self->lines;
+    size_t          cursor_row       = self->cursor.row;
+    bool            scrolling_visual = self->scrolling_visual;
+    enum SelectMode selection_mode   = self->selection.mode;
+
+    VtLineBuffer chunk     = VtLineBuffer_new();
+    self->lines            = VtLineBuffer_new();
+    self->scrolling_visual = false;
+    self->selection.mode   = SELECT_MODE_NONE;
+
+    for (size_t i = begin, j; i < end; i = j) {
+        for (j = i + 1; j < end && lines.buf[j].rejoinable; ++j)
+            ;
+
+        if (Vt_reslice_logical_line(lines.buf + i, j - i, self->ws.ws_col, &chunk))
+            continue;
+
+        self->lines.size = 0;
+        for (size_t k = i; k < j; ++k) {
+            VtLineBuffer_push(&self->lines, lines.buf[k]);
+        }
+
+        size_t n = self->lines.size;
+        n -= Vt_reflow_expand_lines(self, 0, n, self->ws.ws_col);
+        n += Vt_reflow_shrink_lines(self, 0, n, self->ws.ws_col);
+        Vt_trim_columns(self, 0, n);
+
+        for (size_t k = 0; k < n; ++k) {
+            VtLineBuffer_push(&chunk, self->lines.buf[k]);
+        }
+    }
+
+    free(self->lines.mem);
+    self->lines = lines;
+    VtLineBuffer_splice(&self->lines, begin, end - begin, chunk.buf, chunk.size);
+    free(chunk.mem);
+
+    /* positions after the reflown lines move with them */
+    size_t old_size = end - begin, new_size = chunk.size;
+
+    self->cursor.row       = cursor_row - old_size + new_size;
+    self->scrolling_visual = scrolling_visual;
+    self->selection.mode   = selection_mode;
+
+    if (self->scrolling_visual && self->visual_scroll_top >= end) {
+        self->visual_scroll_top = self->visual_scroll_top - old_size + new_size;
+    }
+
+    if (self->saved_active_line >= end) {
+        self->saved_active_line = self->saved_active_line - old_size + new_size;
     }
-}
 
-/**
- * Remove extra columns from all lines */
-static void Vt_trim_columns(Vt* self)
-{
-    for (size_t i = 0; i < self->lines.size; ++i) {
-        if (self->lines.buf[i].data.size > (size_t)self->ws.ws_col) {
-            Vt_mark_proxy_fully_damaged(self, i);
-            Vt_destroy_line_proxy(self->lines.buf[i].proxy.data);
+    if (self->selection.mode != SELECT_MODE_NONE) {
+        self->selection.begin_line = self->selection.begin_line - old_size + new_size;
+        self->selection.end_line   = self->selection.end_line - old_size + new_size;
+        self->selection.click_begin_line =
+          self->selection.click_begin_line - old_size + new_size;
+    }
 
-            size_t blanks = 0;
+    self->reflow_top = begin;
 
-            size_t s = self->lines.buf[i].data.size;
-            Vector_pop_n_VtRune(&self->lines.buf[i].data, s - self->ws.ws_col);
+    /* lines that were split or joined were expanded */
+    Vt_compact_scrollback(self);
+    Vt_freeze_scrollback(self);
+    Vt_expand_visible_lines(self);
+    if (self->scrolling_visual) {
+        Vt_notify_repaint_required(self);
+    }
 
-            if (self->lines.buf[i].was_reflown)
-                continue;
+    return begin;
+}
 
-            s = self->lines.buf[i].data.size;
+/**
+ * Reflow the history that is about to be shown */
+static void Vt_reflow_history_in_view(Vt* self)
+{
+    while (Vt_is_reflow_pending(self) &&
+           self->reflow_top + self->ws.ws_row > Vt_visual_top_line(self)) {
+        Vt_reflow_history_step(self);
+    }
+}
 
-            for (blanks = 0; blanks < s; ++blanks) {
-                if (!(self->lines.buf[i].data.buf[s - 1 - blanks].rune.code == ' ' &&
-                      ColorRGBA_eq(settings.bg, self->lines.buf[i].data.buf[s - 1 - blanks].bg))) {
-                    break;
-                }
-            }
+/**
+ * First line reflowed right away on resize, the start of the logical line a few screens above the
+ * viewport */
+static size_t Vt_reflow_begin(const Vt* self, uint32_t rows)
+{
+    size_t margin = 2 * MAX(rows, self->ws.ws_row);
+    size_t top    = MIN(Vt_visual_top_line(self), Vt_top_line(self));
+    size_t begin  = top > margin ? top - margin : 0;
 
-            Vector_pop_n_VtRune(&self->lines.buf[i].data, blanks);
-        }
+    while (begin && self->lines.buf[begin].rejoinable) {
+        --begin;
     }
+
+    return begin;
 }
 
 void Vt_resize(Vt* self, uint32_t x, uint32_t y)
@@ -1081,22 +2521,31 @@ void Vt_resize(Vt* self, uint32_t x, uint32_t y)
     if (!x || !y) {
         return;
     }
-    if (!self->alt_lines.buf) {
-        Vt_trim_columns(self);
-    }
+    bool reflown            = false;
     self->saved_cursor_pos  = MIN(self->saved_cursor_pos, x);
     self->saved_active_line = MIN(self->saved_active_line, self->lines.size);
     static uint32_t ox = 0, oy = 0;
     if (x != ox || y != oy) {
+        /* reflow and popped lines may free the cell it points to */
+        self->last_interted = NULL;
         if (!self->alt_lines.buf && !Vt_scroll_region_not_default(self)) {
             if (self->selection.mode == SELECT_MODE_BOX) {
                 Vt_select_end(self);
             }
-            if (x < ox) {
-                Vt_reflow_shrink(self, x);
+
+            /* history further up is done by Vt_reflow_history_step() */
+            size_t begin = Vt_reflow_begin(self, y);
+            if (begin < self->reflow_top) {
+                /* lines in view were not reflowed after an earlier resize yet */
+                Vt_reflow_expand(self, begin, x);
+                Vt_reflow_shrink(self, begin, x);
+            } else if (x < ox) {
+                Vt_reflow_shrink(self, begin, x);
             } else if (x > ox) {
-                Vt_reflow_expand(self, x);
+                Vt_reflow_expand(self, begin, x);
             }
+            self->reflow_top = begin;
+            reflown          = true;
         } else {
             Vt_select_end(self);
         }
@@ -1105,21 +2554,21 @@ void Vt_resize(Vt* self, uint32_t x, uint32_t y)
             if (self->cursor.row + to_pop > Vt_bottom_line(self)) {
                 to_pop -= self->cursor.row + to_pop - Vt_bottom_line(self);
             }
-            Vector_pop_n_VtLine(&self->lines, to_pop);
+            VtLineBuffer_pop_n(&self->lines, to_pop);
             if (self->alt_lines.buf) {
                 size_t to_pop_alt = self->ws.ws_row - y;
                 if (self->alt_active_line + to_pop_alt > Vt_bottom_line_alt(self)) {
                     to_pop_alt -= self->alt_active_line + to_pop_alt - Vt_bottom_line_alt(self);
                 }
-                Vector_pop_n_VtLine(&self->alt_lines, to_pop_alt);
+                VtLineBuffer_pop_n(&self->alt_lines, to_pop_alt);
             }
         } else {
             for (size_t i = 0; i < y - self->ws.ws_row; ++i) {
-                Vector_push_VtLine(&self->lines, VtLine_new());
+                VtLineBuffer_push(&self->lines, VtLine_new());
             }
             if (self->alt_lines.buf) {
                 for (size_t i = 0; i < y - self->ws.ws_row; ++i) {
-                    Vector_push_VtLine(&self->alt_lines, VtLine_new());
+                    VtLineBuffer_push(&self->alt_lines, VtLine_new());
                 }
             }
         }
@@ -1132,6 +2581,15 @@ void Vt_resize(Vt* self, uint32_t x, uint32_t y)
 
     self->ws =
       (struct winsize){ .ws_col = x, .ws_row = y, .ws_xpixel = px.first, .ws_ypixel = px.second };
+    Vt_grow_tab_stops(self, x);
+
+    /* split lines must not keep their copied tails until they are compressed, the rows of a logical
+     * line are stored as one */
+    if (reflown) {
+        Vt_trim_columns(self, self->reflow_top, self->lines.size);
+    }
+
+    Vt_expand_screen_lines(self);
 
     LOG("resized to: %d %d [%d %d]\n",
         self->ws.ws_col,
@@ -1158,10 +2616,42 @@ void Vt_resize(Vt* self, uint32_t x, uint32_t y)
     self->scroll_region_bottom = self->ws.ws_row;
 }
 
-__attribute__((always_inline, flatten)) static inline int32_t short_sequence_get_int_argument(
-  const char* seq)
+/**
+ * Get numeric parameter of the active control sequence, if it was omitted or 0 return the default
+ * value */
+__attribute__((always_inline)) static inline uint32_t Vt_CSI_param(const Vt* self,
+                                                                   uint_fast8_t idx,
+                                                                   uint32_t     default_value)
+{
+    return idx < self->parser.csi.nparams && self->parser.csi.params[idx]
+             ? self->parser.csi.params[idx]
+             : default_value;
+}
+
+/**
+ * Format the active control sequence for diagnostic messages */
+__attribute__((cold)) static const char* Vt_CSI_to_string(const Vt* self, char final_char)
 {
-    return *seq == 0 || seq[1] == 0 ? 1 : strtol(seq, NULL, 10);
+    static char buf[VT_PARSER_CSI_MAX_PARAMS * 7 + 4];
+    char*       out = buf;
+
+    if (self->parser.csi.private_marker)
+        *out++ = self->parser.csi.private_marker;
+
+    for (uint_fast8_t i = 0; i < self->parser.csi.nparams; ++i) {
+        if (i)
+            *out++ = (self->parser.csi.params_sub & (1u << i)) ? ':' : ';';
+        if (self->parser.csi.params_set & (1u << i))
+            out += sprintf(out, "%u", self->parser.csi.params[i]);
+    }
+
+    if (self->parser.csi.intermediate)
+        *out++ = self->parser.csi.intermediate;
+
+    *out++ = final_char;
+    *out   = '\0';
+
+    return buf;
 }
 
 static inline void Vt_handle_dec_mode(Vt* self, int code, bool on)
@@ -1304,612 +2794,742 @@ static inline void Vt_handle_dec_mode(Vt* self, int code, bool on)
     }
 }
 
-static inline void Vt_handle_CSI(Vt* self, char c)
+/**
+ * Execute final character of a control sequence */
+static void Vt_dispatch_CSI(Vt* self, char last_char)
 {
-    Vector_push_char(&self->parser.active_sequence, c);
+    Vt_notify_repaint_required(self);
 
-    if (is_csi_sequence_terminated(self->parser.active_sequence.buf,
-                                   self->parser.active_sequence.size)) {
-        CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
-        Vector_push_char(&self->parser.active_sequence, '\0');
-        char* seq       = self->parser.active_sequence.buf;
-        char  last_char = self->parser.active_sequence.buf[self->parser.active_sequence.size - 2];
-
-        /* char  second_last_char = */
-        /*   self->parser.active_sequence.size < 3 */
-        /*     ? '\0' */
-        /*     : self->parser.active_sequence.buf[self->parser.active_sequence.size - 3]; */
-
-        bool is_single_arg = !strchr(seq, ';') && !strchr(seq, ':');
+    bool is_single_arg = self->parser.csi.nparams <= 1;
 
 #define MULTI_ARG_IS_ERROR                                                                         \
     if (!is_single_arg) {                                                                          \
-        WRN("Unexpected additional arguments for CSI sequence \'%s\'\n", seq);                     \
+        WRN("Unexpected additional arguments for CSI sequence \'%s\'\n",                           \
+            Vt_CSI_to_string(self, last_char));                                                    \
         break;                                                                                     \
     }
 
-        if (*seq == '?') {
-            /* sequence starts with question mark */
-            switch (last_char) {
-                /* <ESC>[? Pm h - DEC Private Mode Set (DECSET) */
-                case 'h':
-                /* <ESC>[? Pm l - DEC Private Mode Reset (DECRST) */
-                case 'l': {
-                    bool               is_enable = last_char == 'l';
-                    Vector_Vector_char tokens    = string_split_on(seq + 1, ";:", NULL, NULL);
-                    for (Vector_char* token = NULL;
-                         (token = Vector_iter_Vector_char(&tokens, token));) {
-                        errno     = 0;
-                        long code = strtol(token->buf + 1, NULL, 10);
-                        if (code && !errno) {
-                            Vt_handle_dec_mode(self, code, is_enable);
+    if (self->parser.csi.private_marker == '?') {
+        switch (last_char) {
+            /* <ESC>[? Pm h - DEC Private Mode Set (DECSET) */
+            case 'h':
+            /* <ESC>[? Pm l - DEC Private Mode Reset (DECRST) */
+            case 'l': {
+                bool is_enable = last_char == 'l';
+                for (uint_fast8_t i = 0; i < MAX(self->parser.csi.nparams, 1); ++i) {
+                    uint32_t code = Vt_CSI_param(self, i, 0);
+                    if (code) {
+                        Vt_handle_dec_mode(self, code, is_enable);
+                    } else {
+                        WRN("Invalid %s argument in \'%s\'\n",
+                            is_enable ? "DECSET" : "DECRST",
+                            Vt_CSI_to_string(self, last_char));
+                    }
+                }
+            } break;
+
+            /* <ESC>[? Ps i -  Media Copy (MC), DEC-specific */
+            case 'i':
+                break;
+
+                /* <ESC>[? Ps n Device Status Report (DSR, DEC-specific) */
+            case 'n': {
+                uint32_t arg = Vt_CSI_param(self, 0, 0);
+                /* 6 - report cursor position */
+                if (arg == 6) {
+                    Vt_output_formated(self,
+                                       "\e[%zu;%zuR",
+                                       Vt_get_cursor_row_screen(self) + 1,
+                                       self->cursor.col + 1);
+                } else {
+                    WRN("Unimplemented DSR(DEC) code: %u\n", arg);
+                }
+            } break;
+
+            default:
+                WRN("Unknown CSI sequence: %s\n", Vt_CSI_to_string(self, last_char));
+        }
+    } else if (self->parser.csi.private_marker == '>') {
+        switch (last_char) {
+            /* <ESC>[> Pp m / <ESC>[> Pp ; Pv m - Set/reset key modifier options (XTMODKEYS)
+             * Pp = 0 - modifyKeyboard.
+             * Pp = 1 - modifyCursorKeys.
+             * Pp = 2 - modifyFunctionKeys.
+             * Pp = 4 - modifyOtherKeys.
+             */
+            case 'm':
+                // TODO:
+                break;
+
+            /* <ESC>[> Ps n - Disable key modifier options, xterm
+             * Pp = 0 - modifyKeyboard.
+             * Pp = 1 - modifyCursorKeys.
+             * Pp = 2 - modifyFunctionKeys.
+             * Pp = 4 - modifyOtherKeys.
+             */
+            case 'n':
+                // TODO:
+                break;
+
+            /* <ESC>[ > Ps c - Send Device Attributes (Secondary DA) */
+            case 'c': {
+                MULTI_ARG_IS_ERROR
+                if (Vt_CSI_param(self, 0, 0) == 0) {
+                    /* report VT100, firmware ver. 0, ROM number 0 */
+                    Vt_output(self, "\e[>0;0;0c", 9);
+                }
+            } break;
+
+            default:
+                WRN("Unknown CSI sequence: %s\n", Vt_CSI_to_string(self, last_char));
+        }
+    } else if (self->parser.csi.private_marker == '=') {
+        switch (last_char) {
+            /* <ESC>[ = Ps c - Send Device Attributes (Tertiary DA). */
+            case 'c': {
+                MULTI_ARG_IS_ERROR
+                if (Vt_CSI_param(self, 0, 0) == 0) {
+                    Vt_output(self, "\e[?6c", 5);
+                }
+            } break;
+
+            default:
+                WRN("Unknown CSI sequence: %s\n", Vt_CSI_to_string(self, last_char));
+        }
+    } else if (self->parser.csi.private_marker) {
+        WRN("Unknown CSI sequence: %s\n", Vt_CSI_to_string(self, last_char));
+    } else if (self->parser.csi.intermediate == '#') {
+        switch (last_char) {
+            case '}':
+            case '{': {
+                WRN("XTPUSHSGR/XTPOPSGR not implemented\n");
+            } break;
+
+            default:
+                WRN("Unknown CSI sequence: %s\n", Vt_CSI_to_string(self, last_char));
+        }
+    } else {
+        switch (last_char) {
+            /* <ESC>[ Ps ; ... m - change one or more text attributes (SGR) */
+            case 'm':
+                Vt_handle_SGR_sequence(self);
+                break;
+
+            /* <ESC>[ Ps K - clear(erase) line right of cursor (EL)
+             * none/0 - right 1 - left 2 - all */
+            case 'K': {
+                MULTI_ARG_IS_ERROR
+                switch (Vt_CSI_param(self, 0, 0)) {
+                    case 0:
+                        Vt_clear_right(self);
+                        break;
+
+                    case 2:
+                        Vt_clear_right(self);
+                        /* fallthrough */
+                    case 1:
+                        Vt_clear_left(self);
+                        break;
+
+                    default:
+                        WRN("Unknown CSI(EL) sequence: %s\n", Vt_CSI_to_string(self, last_char));
+                }
+            } break;
+
+            /* <ECS>[ Ps @ - Insert Ps Chars (ICH) */
+            case '@': {
+                MULTI_ARG_IS_ERROR // TODO: (SL), ECMA-48
+                  uint32_t arg = Vt_CSI_param(self, 0, 1);
+                for (uint32_t i = 0; i < arg; ++i) {
+                    Vt_insert_char_at_cursor_with_shift(self, blank_space);
+                }
+            } break;
+
+            /* <ESC>[ Ps a - move cursor right (forward) Ps lines (HPR) */
+            case 'a':
+            /* <ESC>[ Ps C - move cursor right (forward) Ps lines (CUF) */
+            case 'C': {
+                MULTI_ARG_IS_ERROR
+                uint32_t arg = Vt_CSI_param(self, 0, 1);
+                for (uint32_t i = 0; i < arg; ++i)
+                    Vt_cursor_right(self);
+            } break;
+
+            /* <ESC>[ Ps L - Insert line at cursor shift rest down (IL) */
+            case 'L': {
+                MULTI_ARG_IS_ERROR
+                uint32_t arg = Vt_CSI_param(self, 0, 1);
+                for (uint32_t i = 0; i < arg; ++i)
+                    Vt_insert_line(self);
+            } break;
+
+            /* <ESC>[ Ps D - move cursor left (back) Ps lines (CUB) */
+            case 'D': {
+                MULTI_ARG_IS_ERROR
+                uint32_t arg = Vt_CSI_param(self, 0, 1);
+                for (uint32_t i = 0; i < arg; ++i)
+                    Vt_cursor_left(self);
+            } break;
+
+            /* <ESC>[ Ps A - move cursor up Ps lines (CUU) */
+            case 'A': {
+                MULTI_ARG_IS_ERROR // TODO: (SL), ECMA-48
+                  uint32_t arg = Vt_CSI_param(self, 0, 1);
+                for (uint32_t i = 0; i < arg; ++i)
+                    Vt_cursor_up(self);
+            } break;
+
+            /* <ESC>[ Ps e - move cursor down Ps lines (VPR) */
+            case 'e':
+            /* <ESC>[ Ps B - move cursor down Ps lines (CUD) */
+            case 'B': {
+                MULTI_ARG_IS_ERROR
+                uint32_t arg = Vt_CSI_param(self, 0, 1);
+                for (uint32_t i = 0; i < arg; ++i)
+                    Vt_cursor_down(self);
+            } break;
+
+            /* <ESC>[ Ps ` - move cursor to column Ps (CBT)*/
+            case '`':
+            /* <ESC>[ Ps G - move cursor to column Ps (CHA)*/
+            case 'G': {
+                MULTI_ARG_IS_ERROR
+                Vt_move_cursor_to_column(self, Vt_CSI_param(self, 0, 1) - 1);
+            } break;
+
+            /* <ESC>[ Ps J - Erase display (ED) - clear... */
+            case 'J': {
+                MULTI_ARG_IS_ERROR
+                switch (Vt_CSI_param(self, 0, 0)) {
+                    case 0: /* ...from cursor to end of screen */
+                        Vt_erase_to_end(self);
+                        break;
+
+                    case 1: /* ...from start to cursor */
+                        if (Vt_scroll_region_not_default(self)) {
+                            Vt_clear_above(self);
                         } else {
-                            WRN("Invalid %s argument: \'%s\'\n",
-                                is_enable ? "DECSET" : "DECRST",
-                                token->buf + 1);
+                            Vt_scroll_out_above(self);
                         }
-                    }
-                    Vector_destroy_Vector_char(&tokens);
-                } break;
+                        break;
 
-                /* <ESC>[? Ps i -  Media Copy (MC), DEC-specific */
-                case 'i':
-                    break;
+                    case 3: /* ...whole display + scrollback buffer */
+                        /* if (settings.allow_scrollback_clear) { */
+                        /*     Vt_clear_display_and_scrollback(self); */
+                        /* } */
+                        break;
+
+                    case 2: /* ...whole display. Contents should not
+                             * actually be removed, but saved to scroll
+                             * history if no scroll region is set */
+                        if (self->alt_lines.buf) {
+                            Vt_clear_display_and_scrollback(self);
+                        } else {
+                            if (Vt_scroll_region_not_default(self)) {
+                                Vt_clear_above(self);
+                                Vt_erase_to_end(self);
+                            } else {
+                                Vt_scroll_out_all_content(self);
+                            }
+                        }
+                        break;
+                }
+            } break;
+
+            /* <ESC>[ Ps d - move cursor to row Ps (VPA) */
+            case 'd': {
+                MULTI_ARG_IS_ERROR
+                /* origin is 1:1 */
+                Vt_move_cursor(self, self->cursor.col, Vt_CSI_param(self, 0, 1) - 1);
+            } break;
+
+            /* <ESC>[ Ps ; Ps r - Set scroll region (top;bottom) (DECSTBM)
+             * default: full window */
+            case 'r': {
+                uint32_t top, bottom;
+
+                if (self->parser.csi.nparams) {
+                    top    = Vt_CSI_param(self, 0, 1) - 1;
+                    bottom = Vt_CSI_param(self, 1, self->ws.ws_row) - 1;
+                } else {
+                    top    = 0;
+                    bottom = CALL_FP(self->callbacks.on_number_of_cells_requested,
+                                     self->callbacks.user_data)
+                               .second;
+                }
+
+                self->scroll_region_top    = top;
+                self->scroll_region_bottom = bottom;
+            } break;
+
+            /* <ESC>[ Pn I - cursor forward ps tabulations (CHT) */
+            case 'I': {
+                MULTI_ARG_IS_ERROR
+                uint32_t col = self->cursor.col, n = Vt_CSI_param(self, 0, 1);
+                while (n-- && col + 1 < self->ws.ws_col) {
+                    col = Vt_next_tab_stop(self, col);
+                }
+                Vt_move_cursor_to_column(self, col);
+            } break;
+
+            /* <ESC>[ Pn Z - cursor backward ps tabulations (CBT) */
+            case 'Z': {
+                MULTI_ARG_IS_ERROR
+                uint32_t col = self->cursor.col, n = Vt_CSI_param(self, 0, 1);
+                while (n-- && col) {
+                    col = Vt_previous_tab_stop(self, col);
+                }
+                Vt_move_cursor_to_column(self, col);
+            } break;
+
+            /* <ESC>[ Pn g - tabulation clear (TBC) */
+            case 'g': {
+                MULTI_ARG_IS_ERROR
+                switch (Vt_CSI_param(self, 0, 0)) {
+                    case 0:
+                        Vt_set_tab_stop(self, self->cursor.col, false);
+                        break;
+                    case 3:
+                        memset(self->tab_stops,
+                               0,
+                               (self->tab_stops_cols + 63) / 64 * sizeof(uint64_t));
+                        break;
+                    default:;
+                }
+
+            } break;
+
+            /* no args: 1:1, one arg: x:1 */
+            /* <ESC>[ Py ; Px f - move cursor to Px-Py (HVP) */
+            case 'f':
+            /* <ESC>[ Py ; Px H - move cursor to Px-Py (CUP) */
+            case 'H':
+                Vt_move_cursor(self, Vt_CSI_param(self, 1, 1) - 1, Vt_CSI_param(self, 0, 1) - 1);
+                break;
+
+            /* <ESC>[...c - Send device attributes (Primary DA) */
+            case 'c': {
+                /* report VT 102 */
+                Vt_output(self, "\e[?6c", 5);
+            } break;
 
-                    /* <ESC>[? Ps n Device Status Report (DSR, DEC-specific) */
-                case 'n': {
-                    int arg = short_sequence_get_int_argument(seq);
+            /* <ESC>[...n - Device status report (DSR) */
+            case 'n': {
+                MULTI_ARG_IS_ERROR
+                uint32_t arg = Vt_CSI_param(self, 0, 0);
+                if (arg == 5) {
+                    /* 5 - is terminal ok
+                     *  ok - 0, not ok - 3 */
+                    Vt_output(self, "\e[0n", 4);
+                } else if (arg == 6) {
                     /* 6 - report cursor position */
-                    if (arg == 6) {
-                        Vt_output_formated(self,
-                                           "\e[%zu;%zuR",
-                                           Vt_get_cursor_row_screen(self) + 1,
-                                           self->cursor.col + 1);
-                    } else {
-                        WRN("Unimplemented DSR(DEC) code: %d\n", arg);
-                    }
-                } break;
+                    Vt_output_formated(self,
+                                       "\e[%zu;%zuR",
+                                       Vt_get_cursor_row_screen(self) + 1,
+                                       self->cursor.col + 1);
+                } else {
+                    WRN("Unimplemented DSR code: %u\n", arg);
+                }
+            } break;
 
-                default:
-                    WRN("Unknown CSI sequence: %s\n", seq);
-            }
-        } else if (*seq == '>') {
-            switch (last_char) {
-                /* <ESC>[> Pp m / <ESC>[> Pp ; Pv m - Set/reset key modifier options (XTMODKEYS)
-                 * Pp = 0 - modifyKeyboard.
-                 * Pp = 1 - modifyCursorKeys.
-                 * Pp = 2 - modifyFunctionKeys.
-                 * Pp = 4 - modifyOtherKeys.
-                 */
-                case 'm':
-                    // TODO:
-                    break;
+            /* <ESC>[ Ps M - Delete lines (default = 1) (DL) */
+            case 'M': {
+                MULTI_ARG_IS_ERROR
+                uint32_t arg = Vt_CSI_param(self, 0, 1);
+                for (uint32_t i = 0; i < arg; ++i)
+                    Vt_delete_line(self);
+            } break;
+
+            /* <ESC>[ Ps S - Scroll up (default = 1) (SU) */
+            case 'S': {
+                MULTI_ARG_IS_ERROR
+                uint32_t arg = Vt_CSI_param(self, 0, 1);
+                for (uint32_t i = 0; i < arg; ++i)
+                    Vt_scroll_up(self);
+            } break;
+
+            /* <ESC>[ Ps T - Scroll down (default = 1) (SD) */
+            case 'T': {
+                MULTI_ARG_IS_ERROR
+                uint32_t arg = Vt_CSI_param(self, 0, 1);
+                for (uint32_t i = 0; i < arg; ++i)
+                    Vt_scroll_down(self);
+            } break;
+
+            /* <ESC>[ Ps X - Erase Ps Character(s) (default = 1) (ECH) */
+            case 'X':
+                MULTI_ARG_IS_ERROR
+                Vt_erase_chars(self, Vt_CSI_param(self, 0, 1));
+                break;
+
+            /* <ESC>[ Ps P - Delete Ps Character(s) (default = 1) (DCH) */
+            case 'P':
+                MULTI_ARG_IS_ERROR
+                Vt_delete_chars(self, Vt_CSI_param(self, 0, 1));
+                break;
+
+            /* <ESC>[ Ps i -  Media Copy (MC) Local printing related commands */
+            case 'i':
+                break;
+
+            /* <ESC>[ Ps q - Set cursor style (DECSCUSR) */
+            case 'q': {
+                MULTI_ARG_IS_ERROR
+                uint32_t arg = Vt_CSI_param(self, 0, 0);
+                switch (arg) {
+                    case 0:
+                    case 1:
+                        self->cursor.type     = CURSOR_BLOCK;
+                        self->cursor.blinking = false;
+                        break;
+                    case 2:
+                        self->cursor.type     = CURSOR_BLOCK;
+                        self->cursor.blinking = true;
+                        break;
+                    case 3:
+                        self->cursor.type     = CURSOR_UNDERLINE;
+                        self->cursor.blinking = true;
+                        break;
+                    case 4:
+                        self->cursor.type     = CURSOR_UNDERLINE;
+                        self->cursor.blinking = false;
+                        break;
+                    case 5:
+                        self->cursor.type     = CURSOR_BEAM;
+                        self->cursor.blinking = true;
+                        break;
+                    case 6:
+                        self->cursor.type     = CURSOR_BEAM;
+                        self->cursor.blinking = false;
+                        break;
+
+                    default:
+                        WRN("Unknown DECSCUR code: %u\n", arg);
+                }
+            } break;
+
+            /* <ESC>[  Pm... l - Reset Mode (RM) */
+            case 'l': {
+                MULTI_ARG_IS_ERROR
+                switch (Vt_CSI_param(self, 0, 0)) {
+                    case 4:
+                        // TODO: turn off IRM
+                        break;
+                }
+            } break;
+
+            /* <ESC>[u - Restore cursor (SCORC, also ANSI.SYS) */
+            /* <ESC>[Ps SP u - Set margin-bell volume (DECSMBV), VT520 */
+            case 'u':
+                if (!self->parser.csi.nparams && !self->parser.csi.intermediate) {
+                    // TODO: cursor restore
+                } else {
+                    WRN("DECSMBV not implemented\n");
+                }
+                break;
+
+            /* <ESC>[s - Save cursor (SCOSC, also ANSI.SYS) available only when DECLRMM is
+             * disabled */
+            case 's': {
+                // TODO: save cursor
+            } break;
 
-                /* <ESC>[> Ps n - Disable key modifier options, xterm
-                 * Pp = 0 - modifyKeyboard.
-                 * Pp = 1 - modifyCursorKeys.
-                 * Pp = 2 - modifyFunctionKeys.
-                 * Pp = 4 - modifyOtherKeys.
-                 */
-                case 'n':
-                    // TODO:
+            /* <ESC>[ Ps ; Ps ; Ps t - xterm windowOps (XTWINOPS)*/
+            case 't': {
+                int      nargs = MIN(self->parser.csi.nparams, 4);
+                uint32_t args[4];
+
+                if (!nargs)
                     break;
 
-                /* <ESC>[ > Ps c - Send Device Attributes (Secondary DA) */
-                case 'c': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-                    if (arg == 0) {
-                        /* report VT100, firmware ver. 0, ROM number 0 */
-                        Vt_output(self, "\e[>0;0;0c", 9);
-                    }
-                } break;
+                for (int i = 0; i < nargs; ++i)
+                    args[i] = self->parser.csi.params[i];
 
-                default:
-                    WRN("Unknown CSI sequence: %s\n", seq);
-            }
-        } else if (*seq == '#') {
-            switch (last_char) {
-                case '}':
-                case '{': {
-                    WRN("XTPUSHSGR/XTPOPSGR not implemented\n");
-                } break;
+                switch (args[0]) {
 
-                default:
-                    WRN("Unknown CSI sequence: %s\n", seq);
-            }
-        } else if (*seq == '=') {
-            switch (last_char) {
-                /* <ESC>[ = Ps c - Send Device Attributes (Tertiary DA). */
-                case 'c': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-                    if (arg == 0) {
-                        Vt_output(self, "\e[?6c", 5);
-                    }
-                } break;
+                    /* de-iconyfy */
+                    case 1:
+                        break;
 
-                default:
-                    WRN("Unknown CSI sequence: %s\n", seq);
-            }
-        } else {
-            switch (last_char) {
-                /* <ESC>[ Ps ; ... m - change one or more text attributes (SGR) */
-                case 'm': {
-                    Vector_pop_n_char(&self->parser.active_sequence, 2); // 'm', '\0'
-                    Vector_push_char(&self->parser.active_sequence, '\0');
-                    Vt_handle_SGR_sequence(self, self->parser.active_sequence);
-                } break;
-
-                /* <ESC>[ Ps K - clear(erase) line right of cursor (EL)
-                 * none/0 - right 1 - left 2 - all */
-                case 'K': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = *seq == 'K' ? 0 : short_sequence_get_int_argument(seq);
-                    switch (arg) {
-                        case 0:
-                            Vt_clear_right(self);
-                            break;
-
-                        case 2:
-                            Vt_clear_right(self);
-                            /* fallthrough */
-                        case 1:
-                            Vt_clear_left(self);
-                            break;
-
-                        default:
-                            WRN("Unknown CSI(EL) sequence: %s\n", seq);
-                    }
-                } break;
-
-                /* <ECS>[ Ps @ - Insert Ps Chars (ICH) */
-                case '@': {
-                    MULTI_ARG_IS_ERROR // TODO: (SL), ECMA-48
-                      int arg = short_sequence_get_int_argument(seq);
-                    for (int i = 0; i < arg; ++i) {
-                        Vt_insert_char_at_cursor_with_shift(self, blank_space);
-                    }
-                } break;
-
-                /* <ESC>[ Ps a - move cursor right (forward) Ps lines (HPR) */
-                case 'a':
-                /* <ESC>[ Ps C - move cursor right (forward) Ps lines (CUF) */
-                case 'C': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-                    for (int i = 0; i < arg; ++i)
-                        Vt_cursor_right(self);
-                } break;
-
-                /* <ESC>[ Ps L - Insert line at cursor shift rest down (IL) */
-                case 'L': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-                    for (int i = 0; i < arg; ++i)
-                        Vt_insert_line(self);
-                } break;
-
-                /* <ESC>[ Ps D - move cursor left (back) Ps lines (CUB) */
-                case 'D': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-                    for (int i = 0; i < arg; ++i)
-                        Vt_cursor_left(self);
-                } break;
-
-                /* <ESC>[ Ps A - move cursor up Ps lines (CUU) */
-                case 'A': {
-                    MULTI_ARG_IS_ERROR // TODO: (SL), ECMA-48
-                      int arg = short_sequence_get_int_argument(seq);
-                    for (int i = 0; i < arg; ++i)
-                        Vt_cursor_up(self);
-                } break;
-
-                /* <ESC>[ Ps e - move cursor down Ps lines (VPR) */
-                case 'e':
-                /* <ESC>[ Ps B - move cursor down Ps lines (CUD) */
-                case 'B': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-                    for (int i = 0; i < arg; ++i)
-                        Vt_cursor_down(self);
-                } break;
-
-                /* <ESC>[ Ps ` - move cursor to column Ps (CBT)*/
-                case '`':
-                /* <ESC>[ Ps G - move cursor to column Ps (CHA)*/
-                case 'G': {
-                    MULTI_ARG_IS_ERROR
-                    Vt_move_cursor_to_column(self, short_sequence_get_int_argument(seq) - 1);
-                } break;
-
-                /* <ESC>[ Ps J - Erase display (ED) - clear... */
-                case 'J': {
-                    MULTI_ARG_IS_ERROR
-                    if (*seq == 'J') /* ...from cursor to end of screen */
-                        Vt_erase_to_end(self);
-                    else {
-                        int arg = short_sequence_get_int_argument(seq);
-                        switch (arg) {
-                            case 1: /* ...from start to cursor */
-                                if (Vt_scroll_region_not_default(self)) {
-                                    Vt_clear_above(self);
-                                } else {
-                                    Vt_scroll_out_above(self);
-                                }
-                                break;
-
-                            case 3: /* ...whole display + scrollback buffer */
-                                /* if (settings.allow_scrollback_clear) { */
-                                /*     Vt_clear_display_and_scrollback(self); */
-                                /* } */
-                                break;
-
-                            case 2: /* ...whole display. Contents should not
-                                     * actually be removed, but saved to scroll
-                                     * history if no scroll region is set */
-                                if (self->alt_lines.buf) {
-                                    Vt_clear_display_and_scrollback(self);
-                                } else {
-                                    if (Vt_scroll_region_not_default(self)) {
-                                        Vt_clear_above(self);
-                                        Vt_erase_to_end(self);
-                                    } else {
-                                        Vt_scroll_out_all_content(self);
-                                    }
-                                }
-                                break;
+                    /* iconyfy */
+                    case 2:
+                        break;
+
+                    /* move window to args[1]:args[2] */
+                    case 3:
+                        break;
+
+                    /* resize in pixels */
+                    case 4:
+                        break;
+
+                    /* raise window */
+                    case 5:
+                        break;
+
+                    /* lower window */
+                    case 6:
+                        break;
+
+                    /* refresh(?!) window */
+                    case 7:
+                        break;
+
+                    /* resize in characters */
+                    case 8:
+                        break;
+
+                    case 9: {
+                        /* unmaximize window */
+                        if (args[1] == 0 && nargs >= 2) {
                         }
-                    }
-                } break;
-
-                /* <ESC>[ Ps d - move cursor to row Ps (VPA) */
-                case 'd': {
-                    MULTI_ARG_IS_ERROR
-                    /* origin is 1:1 */
-                    Vt_move_cursor(self,
-                                   self->cursor.col,
-                                   short_sequence_get_int_argument(seq) - 1);
-                } break;
-
-                /* <ESC>[ Ps ; Ps r - Set scroll region (top;bottom) (DECSTBM)
-                 * default: full window */
-                case 'r': {
-                    uint32_t top, bottom;
-
-                    if (*seq != 'r') {
-                        if (sscanf(seq, "%u;%u", &top, &bottom) == EOF) {
-                            WRN("invalid CSI(DECSTBM) sequence %s\n", seq);
-                            break;
+
+                        /* maximize window */
+                        else if (args[1] == 1 && nargs >= 2) {
+                        } else {
+                            WRN("Invalid CSI(WindowOps) sequence: %s\n",
+                                Vt_CSI_to_string(self, last_char));
                         }
-                        --top;
-                        --bottom;
-                    } else {
-                        top    = 0;
-                        bottom = CALL_FP(self->callbacks.on_number_of_cells_requested,
-                                         self->callbacks.user_data)
-                                   .second;
-                    }
+                    } break;
+
+                    /* Report iconification state */
+                    case 11:
+                        /* if (iconified) */
+                        /*     write(CSI 1 t) */
+                        /* else */
+                        /*     write(CSI 2 t) */
+                        break;
 
-                    self->scroll_region_top    = top;
-                    self->scroll_region_bottom = bottom;
-                } break;
-
-                /* <ESC>[ Pn I - cursor forward ps tabulations (CHT) */
-                case 'I': {
-                    MULTI_ARG_IS_ERROR
-                    // TODO:
-                } break;
-
-                /* <ESC>[ Pn Z - cursor backward ps tabulations (CBT) */
-                case 'Z': {
-                    MULTI_ARG_IS_ERROR
-                    // TODO:
-                } break;
-
-                /* <ESC>[ Pn g - tabulation clear (TBC) */
-                case 'g': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-
-                    switch (arg) {
-                        case 0:
-                            // TODO: clear currnet tabstop
-                            break;
-                        case 3:
-                            // TODO: clear all tabstops
-                            break;
-                        default:;
-                    }
+                    /* Report window position */
+                    case 13: {
+                        Pair_uint32_t pos = CALL_FP(self->callbacks.on_window_position_requested,
+                                                    self->callbacks.user_data);
+                        Vt_output_formated(self, "\e[3;%d;%d;t", pos.first, pos.second);
+                    } break;
+
+                    /* Report window size in pixels */
+                    case 14: {
+                        Vt_output_formated(self,
+                                           "\e[4;%d;%d;t",
+                                           self->ws.ws_xpixel,
+                                           self->ws.ws_ypixel);
+                    } break;
 
-                } break;
+                    /* Report text area size in chars */
+                    case 18: {
+                        Vt_output_formated(self,
+                                           "\e[8;%d;%d;t",
+                                           self->ws.ws_col,
+                                           self->ws.ws_row);
 
-                /* no args: 1:1, one arg: x:1 */
-                /* <ESC>[ Py ; Px f - move cursor to Px-Py (HVP) */
-                case 'f':
-                /* <ESC>[ Py ; Px H - move cursor to Px-Py (CUP) */
-                case 'H': {
-                    uint32_t x = 1, y = 1;
-                    if (*seq != 'H' && sscanf(seq, "%u;%u", &y, &x) == EOF) {
-                        WRN("invalid CSI(CUP) sequence %s\n", seq);
-                        break;
-                    }
-                    --x;
-                    --y;
-                    Vt_move_cursor(self, x, y);
-                } break;
-
-                /* <ESC>[...c - Send device attributes (Primary DA) */
-                case 'c': {
-                    /* report VT 102 */
-                    Vt_output(self, "\e[?6c", 5);
-                } break;
-
-                /* <ESC>[...n - Device status report (DSR) */
-                case 'n': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-                    if (arg == 5) {
-                        /* 5 - is terminal ok
-                         *  ok - 0, not ok - 3 */
-                        Vt_output(self, "\e[0n", 4);
-                    } else if (arg == 6) {
-                        /* 6 - report cursor position */
+                    } break;
+
+                    /* Report window size in chars */
+                    case 19: {
                         Vt_output_formated(self,
-                                           "\e[%zu;%zuR",
-                                           Vt_get_cursor_row_screen(self) + 1,
-                                           self->cursor.col + 1);
-                    } else {
-                        WRN("Unimplemented DSR code: %d\n", arg);
-                    }
-                } break;
-
-                /* <ESC>[ Ps M - Delete lines (default = 1) (DL) */
-                case 'M': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-                    for (int i = 0; i < arg; ++i)
-                        Vt_delete_line(self);
-                } break;
-
-                /* <ESC>[ Ps S - Scroll up (default = 1) (SU) */
-                case 'S': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-                    for (int i = 0; i < arg; ++i)
-                        Vt_scroll_up(self);
-                } break;
-
-                /* <ESC>[ Ps T - Scroll down (default = 1) (SD) */
-                case 'T': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-                    for (int i = 0; i < arg; ++i)
-                        Vt_scroll_down(self);
-                } break;
-
-                /* <ESC>[ Ps X - Erase Ps Character(s) (default = 1) (ECH) */
-                case 'X':
-                    MULTI_ARG_IS_ERROR
-                    Vt_erase_chars(self, short_sequence_get_int_argument(seq));
-                    break;
+                                           "\e[9;%d;%d;t",
+                                           self->ws.ws_col,
+                                           self->ws.ws_row);
 
-                /* <ESC>[ Ps P - Delete Ps Character(s) (default = 1) (DCH) */
-                case 'P':
-                    MULTI_ARG_IS_ERROR
-                    Vt_delete_chars(self, short_sequence_get_int_argument(seq));
-                    break;
+                    } break;
 
-                /* <ESC>[ Ps i -  Media Copy (MC) Local printing related commands */
-                case 'i':
-                    break;
+                    /* Report icon name */
+                    case 20:
+                        /* Report window title */
+                    case 21: {
+                        Vt_output_formated(self, "\e]L%s\e\\", self->title);
+                    } break;
+
+                    /* push title to stack */
+                    case 22:
+                        break;
+
+                    /* pop title from stack */
+                    case 23:
+                        break;
 
-                /* <ESC>[ Ps q - Set cursor style (DECSCUSR) */
-                case 'q': {
-                    MULTI_ARG_IS_ERROR
-                    int arg = short_sequence_get_int_argument(seq);
-                    switch (arg) {
-                        case 0:
-                        case 1:
-                            self->cursor.type     = CURSOR_BLOCK;
-                            self->cursor.blinking = false;
-                            break;
-                        case 2:
-                            self->cursor.type     = CURSOR_BLOCK;
-                            self->cursor.blinking = true;
-                            break;
-                        case 3:
-                            self->cursor.type     = CURSOR_UNDERLINE;
-                            self->cursor.blinking = true;
-                            break;
-                        case 4:
-                            self->cursor.type     = CURSOR_UNDERLINE;
-                            self->cursor.blinking = false;
-                            break;
-                        case 5:
-                            self->cursor.type     = CURSOR_BEAM;
-                            self->cursor.blinking = true;
-                            break;
-                        case 6:
-                            self->cursor.type     = CURSOR_BEAM;
-                            self->cursor.blinking = false;
-                            break;
-
-                        default:
-                            WRN("Unknown DECSCUR code: %d\n", arg);
+                    /* Resize window to args[1] lines (DECSLPP) */
+                    default: {
+                        // uint32_t ypixels = gfx_pixels(args[0], 0).first;
                     }
-                } break;
-
-                /* <ESC>[  Pm... l - Reset Mode (RM) */
-                case 'l': {
-                    MULTI_ARG_IS_ERROR
-                    switch (short_sequence_get_int_argument(seq)) {
-                        case 4:
-                            // TODO: turn off IRM
-                            break;
-                    }
-                } break;
+                }
 
-                /* <ESC>[u - Restore cursor (SCORC, also ANSI.SYS) */
-                /* <ESC>[Ps SP u - Set margin-bell volume (DECSMBV), VT520 */
-                case 'u':
-                    if (*seq == 'u') {
-                        // TODO: cursor restore
-                    } else {
-                        WRN("DECSMBV not implemented\n");
-                    }
-                    break;
+            } break;
 
-                /* <ESC>[s - Save cursor (SCOSC, also ANSI.SYS) available only when DECLRMM is
-                 * disabled */
-                case 's': {
-                    // TODO: save cursor
-                } break;
-
-                /* <ESC>[ Ps ; Ps ; Ps t - xterm windowOps (XTWINOPS)*/
-                case 't': {
-                    int nargs;
-                    int args[4];
-
-                    for (nargs = 0; seq && nargs < 4 && *seq != 't'; ++nargs) {
-                        *(args + nargs) = strtol(seq, NULL, 10);
-                        seq             = strstr(seq, ";");
-                        if (seq)
-                            ++seq;
-                    }
+            default:
+                WRN("Unknown CSI sequence: %s\n", Vt_CSI_to_string(self, last_char));
 
-                    if (!nargs)
-                        break;
+        } // end switch
+    }
+}
 
-                    switch (args[0]) {
+/* Control sequence parser actions */
+enum VtParserCsiAction
+{
+    CSI_ACTION_IGNORE = 0,
+    CSI_ACTION_EXECUTE,
+    CSI_ACTION_PARAM,
+    CSI_ACTION_SEPARATOR,
+    CSI_ACTION_SUBSEPARATOR,
+    CSI_ACTION_PRIVATE_MARKER,
+    CSI_ACTION_COLLECT,
+    CSI_ACTION_DISPATCH,
+    CSI_ACTION_CANCEL,
+    CSI_ACTION_ESCAPE,
+};
+
+#define CSI_TRANSITION(_action, _state) ((CSI_ACTION_##_action) | (PARSER_CSI_STATE_##_state) << 4)
+
+#define CSI_TRANSITIONS_C0(_state)                                                                 \
+    [0x00 ... 0x17] = CSI_TRANSITION(EXECUTE, _state), [0x18] = CSI_TRANSITION(CANCEL, ENTRY),    \
+    [0x19] = CSI_TRANSITION(EXECUTE, _state), [0x1a] = CSI_TRANSITION(CANCEL, ENTRY),             \
+    [0x1b] = CSI_TRANSITION(ESCAPE, ENTRY), [0x1c ... 0x1f] = CSI_TRANSITION(EXECUTE, _state)
 
-                        /* de-iconyfy */
-                        case 1:
-                            break;
+/**
+ * Control sequence state transitions, after the DEC ANSI parser. Low nibble is the action to
+ * perform for a given byte, high nibble is the next state */
+static const uint8_t csi_transitions[][256] = {
+    [PARSER_CSI_STATE_ENTRY] = {
+        CSI_TRANSITIONS_C0(ENTRY),
+        [0x20 ... 0x2f] = CSI_TRANSITION(COLLECT, INTERMEDIATE),
+        [0x30 ... 0x39] = CSI_TRANSITION(PARAM, PARAM),
+        [':']           = CSI_TRANSITION(SUBSEPARATOR, PARAM),
+        [';']           = CSI_TRANSITION(SEPARATOR, PARAM),
+        [0x3c ... 0x3f] = CSI_TRANSITION(PRIVATE_MARKER, PARAM),
+        [0x40 ... 0x7e] = CSI_TRANSITION(DISPATCH, ENTRY),
+        [0x7f ... 0xff] = CSI_TRANSITION(IGNORE, ENTRY),
+    },
+    [PARSER_CSI_STATE_PARAM] = {
+        CSI_TRANSITIONS_C0(PARAM),
+        [0x20 ... 0x2f] = CSI_TRANSITION(COLLECT, INTERMEDIATE),
+        [0x30 ... 0x39] = CSI_TRANSITION(PARAM, PARAM),
+        [':']           = CSI_TRANSITION(SUBSEPARATOR, PARAM),
+        [';']           = CSI_TRANSITION(SEPARATOR, PARAM),
+        [0x3c ... 0x3f] = CSI_TRANSITION(IGNORE, IGNORE),
+        [0x40 ... 0x7e] = CSI_TRANSITION(DISPATCH, ENTRY),
+        [0x7f ... 0xff] = CSI_TRANSITION(IGNORE, PARAM),
+    },
+    [PARSER_CSI_STATE_INTERMEDIATE] = {
+        CSI_TRANSITIONS_C0(INTERMEDIATE),
+        [0x20 ... 0x2f] = CSI_TRANSITION(COLLECT, INTERMEDIATE),
+        [0x30 ... 0x3f] = CSI_TRANSITION(IGNORE, IGNORE),
+        [0x40 ... 0x7e] = CSI_TRANSITION(DISPATCH, ENTRY),
+        [0x7f ... 0xff] = CSI_TRANSITION(IGNORE, INTERMEDIATE),
+    },
+    [PARSER_CSI_STATE_DISCARD] = {
+        CSI_TRANSITIONS_C0(DISCARD),
+        [0x20 ... 0x2f] = CSI_TRANSITION(COLLECT, INTERMEDIATE),
+        [0x30 ... 0x3b] = CSI_TRANSITION(IGNORE, DISCARD),
+        [0x3c ... 0x3f] = CSI_TRANSITION(IGNORE, IGNORE),
+        [0x40 ... 0x7e] = CSI_TRANSITION(DISPATCH, ENTRY),
+        [0x7f ... 0xff] = CSI_TRANSITION(IGNORE, DISCARD),
+    },
+    [PARSER_CSI_STATE_IGNORE] = {
+        CSI_TRANSITIONS_C0(IGNORE),
+        [0x20 ... 0x3f] = CSI_TRANSITION(IGNORE, IGNORE),
+        [0x40 ... 0x7e] = CSI_TRANSITION(CANCEL, ENTRY),
+        [0x7f ... 0xff] = CSI_TRANSITION(IGNORE, IGNORE),
+    },
+};
 
-                        /* iconyfy */
-                        case 2:
-                            break;
+/**
+ * Start receiving a new control sequence */
+static inline void Vt_begin_CSI(Vt* self)
+{
+    self->parser.state              = PARSER_STATE_CSI;
+    self->parser.csi.state          = PARSER_CSI_STATE_ENTRY;
+    self->parser.csi.nparams        = 0;
+    self->parser.csi.params_set     = 0;
+    self->parser.csi.params_sub     = 0;
+    self->parser.csi.private_marker = 0;
+    self->parser.csi.intermediate   = 0;
+}
 
-                        /* move window to args[1]:args[2] */
-                        case 3:
-                            break;
+/**
+ * Start a new parameter. Parameters past VT_PARSER_CSI_MAX_PARAMS are skipped, the sequence is
+ * dispatched with the ones that fit */
+static inline void Vt_CSI_next_param(Vt* self, bool is_sub)
+{
+    if (!self->parser.csi.nparams) {
+        /* leading separator, the first parameter was omitted */
+        self->parser.csi.params[self->parser.csi.nparams++] = 0;
+    }
+    if (self->parser.csi.nparams < VT_PARSER_CSI_MAX_PARAMS) {
+        if (is_sub)
+            self->parser.csi.params_sub |= (1u << self->parser.csi.nparams);
+        self->parser.csi.params[self->parser.csi.nparams++] = 0;
+    } else {
+        self->parser.csi.state = PARSER_CSI_STATE_DISCARD;
+    }
+}
 
-                        /* resize in pixels */
-                        case 4:
-                            break;
+__attribute__((hot)) static inline void Vt_handle_CSI(Vt* self, char c)
+{
+    uint8_t transition     = csi_transitions[self->parser.csi.state][(uint8_t)c];
+    self->parser.csi.state = transition >> 4;
 
-                        /* raise window */
-                        case 5:
-                            break;
+    switch ((enum VtParserCsiAction)(transition & 0x0f)) {
+        case CSI_ACTION_IGNORE:
+            break;
 
-                        /* lower window */
-                        case 6:
-                            break;
+        case CSI_ACTION_PARAM: {
+            if (unlikely(!self->parser.csi.nparams))
+                self->parser.csi.params[self->parser.csi.nparams++] = 0;
 
-                        /* refresh(?!) window */
-                        case 7:
-                            break;
+            uint8_t  idx = self->parser.csi.nparams - 1;
+            uint32_t val = self->parser.csi.params[idx] * 10 + (c - '0');
+            self->parser.csi.params[idx] = MIN(val, UINT16_MAX);
+            self->parser.csi.params_set |= (1u << idx);
+        } break;
 
-                        /* resize in characters */
-                        case 8:
-                            break;
+        case CSI_ACTION_SEPARATOR:
+            Vt_CSI_next_param(self, false);
+            break;
 
-                        case 9: {
-                            /* unmaximize window */
-                            if (args[1] == 0 && nargs >= 2) {
-                            }
+        case CSI_ACTION_SUBSEPARATOR:
+            Vt_CSI_next_param(self, true);
+            break;
 
-                            /* maximize window */
-                            else if (args[1] == 1 && nargs >= 2) {
-                            } else {
-                                WRN("Invalid CSI(WindowOps) sequence: %s\n", seq);
-                            }
-                        } break;
-
-                        /* Report iconification state */
-                        case 11:
-                            /* if (iconified) */
-                            /*     write(CSI 1 t) */
-                            /* else */
-                            /*     write(CSI 2 t) */
-                            break;
-
-                        /* Report window position */
-                        case 13: {
-                            Pair_uint32_t pos =
-                              CALL_FP(self->callbacks.on_window_position_requested,
-                                      self->callbacks.user_data);
-                            Vt_output_formated(self, "\e[3;%d;%d;t", pos.first, pos.second);
-                        } break;
-
-                        /* Report window size in pixels */
-                        case 14: {
-                            Vt_output_formated(self,
-                                               "\e[4;%d;%d;t",
-                                               self->ws.ws_xpixel,
-                                               self->ws.ws_ypixel);
-                        } break;
-
-                        /* Report text area size in chars */
-                        case 18: {
-                            Vt_output_formated(self,
-                                               "\e[8;%d;%d;t",
-                                               self->ws.ws_col,
-                                               self->ws.ws_row);
-
-                        } break;
-
-                        /* Report window size in chars */
-                        case 19: {
-                            Vt_output_formated(self,
-                                               "\e[9;%d;%d;t",
-                                               self->ws.ws_col,
-                                               self->ws.ws_row);
-
-                        } break;
-
-                        /* Report icon name */
-                        case 20:
-                            /* Report window title */
-                        case 21: {
-                            Vt_output_formated(self, "\e]L%s\e\\", self->title);
-                        } break;
-
-                        /* push title to stack */
-                        case 22:
-                            break;
-
-                        /* pop title from stack */
-                        case 23:
-                            break;
-
-                        /* Resize window to args[1] lines (DECSLPP) */
-                        default: {
-                            // int arg = short_sequence_get_int_argument(seq);
-                            // uint32_t ypixels = gfx_pixels(arg, 0).first;
-                        }
-                    }
+        case CSI_ACTION_PRIVATE_MARKER:
+            self->parser.csi.private_marker = c;
+            break;
 
-                } break;
+        case CSI_ACTION_COLLECT:
+            /* we don't use anything with more than one intermediate character */
+            self->parser.csi.intermediate = c;
+            break;
 
-                default:
-                    WRN("Unknown CSI sequence: %s\n", seq);
+        case CSI_ACTION_DISPATCH:
+            self->parser.state = PARSER_STATE_LITERAL;
+            Vt_dispatch_CSI(self, c);
+            break;
 
-            } // end switch
-        }
+        case CSI_ACTION_EXECUTE:
+            /* control characters are executed in the middle of a sequence */
+            switch (c) {
+                case '\a':
+                case '\b':
+                case '\t':
+                case '\n':
+                case '\v':
+                case '\f':
+                case '\r':
+                    Vt_handle_literal(self, c);
+            }
+            break;
+
+        case CSI_ACTION_CANCEL:
+            self->parser.state = PARSER_STATE_LITERAL;
+            break;
 
-        Vector_destroy_char(&self->parser.active_sequence);
-        self->parser.active_sequence = Vector_new_char();
-        self->parser.state           = PARSER_STATE_LITERAL;
+        case CSI_ACTION_ESCAPE:
+            self->parser.state = PARSER_STATE_ESCAPED;
+            break;
     }
 }
 
-static void Vt_handle_SGR_code(Vt* self, char* command)
+static void Vt_handle_SGR_code(Vt* self, uint32_t cmd)
 {
-    int cmd = *command ? strtol(command, NULL, 10) : 0;
-
 #define MAYBE_DISABLE_ALL_UNDERLINES                                                               \
     if (!settings.allow_multiple_underlines) {                                                     \
         self->parser.char_state.underlined      = false;                                           \
@@ -2033,7 +3653,25 @@ static void Vt_handle_SGR_code(Vt* self, char* command)
                 self->parser.char_state.bg =
                   ColorRGBA_from_RGB(settings.colorscheme.color[cmd - 92]);
             } else
-                WRN("Unknown SGR code: %d\n", cmd);
+                WRN("Unknown SGR code: %u\n", cmd);
+    }
+}
+
+/**
+ * Make @param lines hold a screen of empty lines. Lines that are already there are cleared in
+ * place and keep their cells, so this does not allocate unless the screen got larger */
+static void Vt_blank_screen_lines(Vt* self, VtLineBuffer* lines)
+{
+    if (lines->size > self->ws.ws_row) {
+        VtLineBuffer_pop_n(lines, lines->size - self->ws.ws_row);
+    }
+
+    for (size_t i = 0; i < lines->size; ++i) {
+        VtLine_clear(&lines->buf[i]);
+    }
+
+    while (lines->size < self->ws.ws_row) {
+        VtLineBuffer_push(lines, Vt_new_line(self));
     }
 }
 
@@ -2043,9 +3681,13 @@ static inline void Vt_alt_buffer_on(Vt* self, bool save_mouse)
     Vt_visual_scroll_reset(self);
     Vt_select_end(self);
     self->alt_lines = self->lines;
-    self->lines     = Vector_new_VtLine();
-    for (size_t i = 0; i < self->ws.ws_row; ++i)
-        Vector_push_VtLine(&self->lines, VtLine_new());
+    if (self->spare_alt_lines.buf) {
+        self->lines           = self->spare_alt_lines;
+        self->spare_alt_lines = (VtLineBuffer){ 0 };
+    } else {
+        self->lines = VtLineBuffer_new();
+    }
+    Vt_blank_screen_lines(self, &self->lines);
     if (save_mouse) {
         self->alt_cursor_pos  = self->cursor.col;
         self->alt_active_line = self->cursor.row;
@@ -2058,10 +3700,11 @@ static inline void Vt_alt_buffer_off(Vt* self, bool save_mouse)
     self->last_interted = NULL;
     Vt_select_end(self);
     if (self->alt_lines.buf) {
-        Vector_destroy_VtLine(&self->lines);
-        self->lines          = self->alt_lines;
-        self->alt_lines.buf  = NULL;
-        self->alt_lines.size = 0;
+        /* renderer resources are released now, the cells are kept */
+        Vt_blank_screen_lines(self, &self->lines);
+        self->spare_alt_lines = self->lines;
+        self->lines           = self->alt_lines;
+        self->alt_lines       = (VtLineBuffer){ 0 };
         if (save_mouse) {
             self->cursor.col = self->alt_cursor_pos;
             self->cursor.row = self->alt_active_line;
@@ -2072,245 +3715,255 @@ static inline void Vt_alt_buffer_off(Vt* self, bool save_mouse)
     }
 }
 
+/**
+ * Set foreground(38), background(48) or underline(58) color */
+static inline void Vt_set_SGR_color(Vt* self, uint32_t target, ColorRGB color)
+{
+    switch (target) {
+        case 38:
+            self->parser.char_state.fg = color;
+            break;
+        case 48:
+            self->parser.char_state.bg = ColorRGBA_from_RGB(color);
+            break;
+        case 58:
+            self->parser.char_state.linecolornotdefault = true;
+            self->parser.char_state.line                = color;
+            break;
+    }
+}
+
 /**
  * SGR codes are separated by one ';' or ':', some values require a set number of following
  * 'arguments'. 'Commands' may be combined into a single sequence. A ';' without any text should be
  * interpreted as a 0 (CSI ; 3 m == CSI 0 ; 3 m), but ':' should not
  * (CSI 58:2::130:110:255 m == CSI 58:2:130:110:255 m)" */
-static void Vt_handle_SGR_sequence(Vt* self, Vector_char seq)
-{
-    Vector_Vector_char tokens = string_split_on(seq.buf, ";", ":", NULL);
-    for (Vector_char* token = NULL; (token = Vector_iter_Vector_char(&tokens, token));) {
-        Vector_char* args[] = { token, NULL, NULL, NULL, NULL };
-
-        /* color change 'commands' */
-        if (!strcmp(token->buf + 1, "38") /* foreground */ ||
-            !strcmp(token->buf + 1, "48") /* background */ ||
-            !strcmp(token->buf + 1, "58") /* underline  */) {
-            /* next argument determines how the color will be set and final
-             * number of args */
-
-            if ((args[1] = (token = Vector_iter_Vector_char(&tokens, token))) &&
-                (args[2] = (token = Vector_iter_Vector_char(&tokens, token)))) {
-                if (!strcmp(args[1]->buf + 1, "5")) {
-                    /* from 256 palette (one argument) */
-                    long idx = MIN(strtol(args[2]->buf + 1, NULL, 10), 255);
+static void Vt_handle_SGR_sequence(Vt* self)
+{
+    const struct VtParserCsi* csi = &self->parser.csi;
 
-                    if (args[0]->buf[1] == '3')
-                        self->parser.char_state.fg = color_palette_256[idx];
+    uint16_t     args[VT_PARSER_CSI_MAX_PARAMS];
+    uint32_t     args_sub = 0;
+    uint_fast8_t nargs    = 0;
 
-                    else if (args[0]->buf[1] == '4')
-                        self->parser.char_state.bg = ColorRGBA_from_RGB(color_palette_256[idx]);
+    if (!csi->nparams) {
+        Vt_reset_text_attribs(self);
+        return;
+    }
 
-                    else if (args[0]->buf[1] == '5') {
-                        self->parser.char_state.linecolornotdefault = true;
-                        self->parser.char_state.line                = color_palette_256[idx];
-                    }
+    /* drop empty parameters followed by ':' */
+    for (uint_fast8_t i = 0; i < csi->nparams; ++i) {
+        if (!(csi->params_set & (1u << i)) && i + 1 < csi->nparams &&
+            (csi->params_sub & (1u << (i + 1)))) {
+            continue;
+        }
+        if (csi->params_sub & (1u << i))
+            args_sub |= (1u << nargs);
+        args[nargs++] = csi->params[i];
+    }
+
+    for (uint_fast8_t i = 0; i < nargs; ++i) {
+        switch (args[i]) {
+            /* color change 'commands', next argument determines how the color will be set and
+             * final number of args */
+            case 38: /* foreground */
+            case 48: /* background */
+            case 58: /* underline  */
+                if (i + 2 >= nargs)
+                    return;
 
-                } else if (!strcmp(args[1]->buf + 1, "2")) {
+                if (args[i + 1] == 5) {
+                    /* from 256 palette (one argument) */
+                    Vt_set_SGR_color(self, args[i], color_palette_256[MIN(args[i + 2], 255)]);
+                    i += 2;
+                } else if (args[i + 1] == 2) {
                     /* sent as 24-bit rgb (three arguments) */
-                    if ((args[3] = (token = Vector_iter_Vector_char(&tokens, token))) &&
-                        (args[4] = (token = Vector_iter_Vector_char(&tokens, token)))) {
-                        long c[3] = { MIN(strtol(args[2]->buf + 1, NULL, 10), 255),
-                                      MIN(strtol(args[3]->buf + 1, NULL, 10), 255),
-                                      MIN(strtol(args[4]->buf + 1, NULL, 10), 255) };
-
-                        if (args[0]->buf[1] == '3') {
-                            self->parser.char_state.fg =
-                              (ColorRGB){ .r = c[0], .g = c[1], .b = c[2] };
-                        } else if (args[0]->buf[1] == '4') {
-                            self->parser.char_state.bg =
-                              (ColorRGBA){ .r = c[0], .g = c[1], .b = c[2], .a = 255 };
-                        } else if (args[0]->buf[1] == '5') {
-                            self->parser.char_state.linecolornotdefault = true;
-                            self->parser.char_state.line =
-                              (ColorRGB){ .r = c[0], .g = c[1], .b = c[2] };
-                        }
-                    }
+                    if (i + 4 >= nargs)
+                        return;
+
+                    Vt_set_SGR_color(self,
+                                     args[i],
+                                     (ColorRGB){ .r = MIN(args[i + 2], 255),
+                                                 .g = MIN(args[i + 3], 255),
+                                                 .b = MIN(args[i + 4], 255) });
+                    i += 4;
+                } else {
+                    i += 2;
                 }
-            }
-        } else if (!strcmp(token->buf + 1, "4")) {
-
-            /* possible curly underline */
-            if ((args[1] = (token = Vector_iter_Vector_char(&tokens, token)))) {
-
-                /* enable this only on "4:3" not "4;3" */
-                if (!strcmp(args[1]->buf, ":3")) {
+                break;
 
+            case 4:
+                /* possible curly underline, enable this only on "4:3" not "4;3" */
+                if (i + 1 < nargs && (args_sub & (1u << (i + 1))) && args[i + 1] == 3) {
                     if (!settings.allow_multiple_underlines) {
                         self->parser.char_state.underlined      = false;
                         self->parser.char_state.doubleunderline = false;
                     }
 
                     self->parser.char_state.curlyunderline = true;
+                    ++i;
                 } else {
-                    Vt_handle_SGR_code(self, args[0]->buf + 1);
-                    token = Vector_iter_back_Vector_char(&tokens, token);
+                    Vt_handle_SGR_code(self, args[i]);
                 }
-            } else {
-                Vt_handle_SGR_code(self, args[0]->buf + 1);
-                break; // end of sequence
-            }
+                break;
 
-        } else {
-            Vt_handle_SGR_code(self, token->buf + 1);
+            default:
+                Vt_handle_SGR_code(self, args[i]);
         }
-    } // end for
-
-    Vector_destroy_Vector_char(&tokens);
+    }
 }
 
-static void Vt_handle_APC(Vt* self, char c)
+static void Vt_dispatch_APC(Vt* self)
 {
-    Vector_push_char(&self->parser.active_sequence, c);
-    if (is_generic_sequence_terminated(self->parser.active_sequence.buf,
-                                       self->parser.active_sequence.size)) {
-        Vector_push_char(&self->parser.active_sequence, '\0');
-        const char* seq = self->parser.active_sequence.buf;
-        char*       str = pty_string_prettyfy(seq, strlen(seq));
-        WRN("Unknown APC: %s\n", str);
-        free(str);
-        Vector_destroy_char(&self->parser.active_sequence);
-        self->parser.active_sequence = Vector_new_char();
-        self->parser.state           = PARSER_STATE_LITERAL;
-    }
+    const char* seq = self->parser.active_sequence.buf;
+    char*       str = pty_string_prettyfy(seq, strlen(seq));
+    WRN("Unknown APC: %s\n", str);
+    free(str);
 }
 
-static void Vt_handle_DCS(Vt* self, char c)
+static void Vt_dispatch_DCS(Vt* self)
 {
-    Vector_push_char(&self->parser.active_sequence, c);
-
-    if (is_generic_sequence_terminated(self->parser.active_sequence.buf,
-                                       self->parser.active_sequence.size)) {
-        Vector_push_char(&self->parser.active_sequence, '\0');
-
-        const char* seq = self->parser.active_sequence.buf;
-        switch (*seq) {
-            /* Terminal image protocol */
-            case 'G':
-                break;
-
-            /* sixel or ReGIS */
-            case '0':
-                break;
-
-            default:;
-        }
+    const char* seq = self->parser.active_sequence.buf;
+    switch (*seq) {
+        /* Terminal image protocol */
+        case 'G':
+            break;
 
-        char* str =
-          pty_string_prettyfy(self->parser.active_sequence.buf, self->parser.active_sequence.size);
-        WRN("Unknown device control string: %s\n", str);
-        free(str);
+        /* sixel or ReGIS */
+        case '0':
+            break;
 
-        Vector_destroy_char(&self->parser.active_sequence);
-        self->parser.active_sequence = Vector_new_char();
-        self->parser.state           = PARSER_STATE_LITERAL;
+        default:;
     }
-}
 
-static void Vt_handle_PM(Vt* self, char c)
-{
-    Vector_push_char(&self->parser.active_sequence, c);
-    if (is_generic_sequence_terminated(self->parser.active_sequence.buf,
-                                       self->parser.active_sequence.size)) {
-        Vector_destroy_char(&self->parser.active_sequence);
-        self->parser.active_sequence = Vector_new_char();
-        self->parser.state           = PARSER_STATE_LITERAL;
-    }
+    char* str = pty_string_prettyfy(seq, strlen(seq));
+    WRN("Unknown device control string: %s\n", str);
+    free(str);
 }
 
-static void Vt_handle_OSC(Vt* self, char c)
+static void Vt_dispatch_OSC(Vt* self)
 {
-    Vector_push_char(&self->parser.active_sequence, c);
+    const char* seq = self->parser.active_sequence.buf;
+    int         arg = 0;
+
+    /* Ps ; Pt - everything after the first separator is the text argument */
+    for (const char* i = seq; *i >= '0' && *i <= '9' && arg < INT16_MAX; ++i)
+        arg = arg * 10 + (*i - '0');
+    const char* text = strchr(seq, ';');
+    if (text)
+        ++text;
+
+    switch (arg) {
+        /* Change Icon Name and Window Title */
+        case 0:
+        /* Change Icon Name */
+        case 1:
+        /* Change Window Title */
+        case 2:
+            /* Set title */
+            if (text) {
+                free(self->title);
+                self->title = strdup(text);
+                CALL_FP(self->callbacks.on_title_changed, self->callbacks.user_data, text);
+            }
+            break;
 
-    if (is_generic_sequence_terminated(self->parser.active_sequence.buf,
-                                       self->parser.active_sequence.size)) {
-        Vector_push_char(&self->parser.active_sequence, '\0');
-        char*              seq    = self->parser.active_sequence.buf;
-        Vector_Vector_char tokens = string_split_on(seq, ";:", NULL, "\a\b\n\t\v");
-        int                arg    = strtol(tokens.buf[0].buf + 1, NULL, 10);
-        switch (arg) {
-            /* Change Icon Name and Window Title */
-            case 0:
-            /* Change Icon Name */
-            case 1:
-            /* Change Window Title */
-            case 2:
-                /* Set title */
-                if (tokens.size >= 2) {
-                    free(self->title);
-                    self->title = strdup(tokens.buf[1].buf + 1);
-                    CALL_FP(self->callbacks.on_title_changed,
-                            self->callbacks.user_data,
-                            tokens.buf[1].buf + 1);
-                }
-                break;
+        /* Set X property on top-level window (prop=val) */
+        case 3:
+            // TODO:
+            WRN("OSC 3 not implemented\n");
+            break;
 
-            /* Set X property on top-level window (prop=val) */
-            case 3:
-                // TODO:
-                WRN("OSC 3 not implemented\n");
-                break;
+        /* Modify regular color palette */
+        case 4:
+        /* Modify special color palette */
+        case 5:
+        /* enable/disable special color */
+        case 6:
+            // TODO:
+            WRN("Dynamic colors not implemented\n");
+            break;
 
-            /* Modify regular color palette */
-            case 4:
-            /* Modify special color palette */
-            case 5:
-            /* enable/disable special color */
-            case 6:
-                // TODO:
-                WRN("Dynamic colors not implemented\n");
-                break;
+        /* pwd info as URI */
+        case 7: {
+            free(self->work_dir);
+            const char* uri = text ? text : "";
+            if (streq_wildcard(uri, "file:*") && strlen(uri) >= 8) {
+                uri += 7; // skip 'file://'
+                while (*uri && *uri != '/')
+                    ++uri; // skip hostname
+                self->work_dir = strdup(uri);
+                LOG("Program changed work dir to \'%s\'\n", self->work_dir);
+            } else {
+                self->work_dir = NULL;
+                WRN("Bad URI \'%s\', scheme is not \'file\'\n", uri);
+            }
+        } break;
 
-            /* pwd info as URI */
-            case 7: {
-                free(self->work_dir);
-                char* uri = seq + 2; // 7;
-                if (streq_wildcard(uri, "file:*") && strlen(uri) >= 8) {
-                    uri += 7; // skip 'file://'
-                    while (*uri && *uri != '/')
-                        ++uri; // skip hostname
-                    self->work_dir = strdup(uri);
-                    LOG("Program changed work dir to \'%s\'\n", self->work_dir);
-                } else {
-                    self->work_dir = NULL;
-                    WRN("Bad URI \'%s\', scheme is not \'file\'\n", uri);
-                }
-            } break;
+        /* mark text as hyperlink with URL */
+        case 8:
+            // TODO:
+            WRN("OSC 8 hyperlinks not implemented\n");
+            break;
 
-            /* mark text as hyperlink with URL */
-            case 8:
-                // TODO:
-                WRN("OSC 8 hyperlinks not implemented\n");
-                break;
+        /* sets dynamic colors for xterm colorOps */
+        case 10 ... 19:
+            WRN("Dynamic colors not implemented\n");
+            break;
 
-            /* sets dynamic colors for xterm colorOps */
-            case 10 ... 19:
-                WRN("Dynamic colors not implemented\n");
-                break;
+        /* coresponding colorOps resets */
+        case 110 ... 119:
+            // TODO: reset things, when there are things to reset
+            break;
 
-            /* coresponding colorOps resets */
-            case 110 ... 119:
-                // TODO: reset things, when there are things to reset
-                break;
+        case 50:
+            WRN("xterm fontOps not implemented\n");
+            break;
 
-            case 50:
-                WRN("xterm fontOps not implemented\n");
-                break;
+        /* Send desktop notification */
+        case 777:
+            WRN("OSC 777 notifications not implemented\n");
+            break;
 
-            /* Send desktop notification */
-            case 777:
-                WRN("OSC 777 notifications not implemented\n");
-                break;
+        default:
+            WRN("Unknown OSC: %s\n", seq);
+    }
+}
 
-            default:
-                WRN("Unknown OSC: %s\n", self->parser.active_sequence.buf);
-        }
+/**
+ * Receive a byte of an OSC, DCS, APC or PM string. The string is terminated by ST or BEL and
+ * dispatched, CAN and SUB abort it, other control characters are ignored */
+static void Vt_handle_command_string(Vt* self, char c)
+{
+    switch (c) {
+        case '\a':
+        case '\e':
+            Vector_push_char(&self->parser.active_sequence, '\0');
+            switch (self->parser.state) {
+                case PARSER_STATE_OSC:
+                    Vt_dispatch_OSC(self);
+                    break;
+                case PARSER_STATE_DCS:
+                    Vt_dispatch_DCS(self);
+                    break;
+                case PARSER_STATE_APC:
+                    Vt_dispatch_APC(self);
+                    break;
+                default:;
+            }
+            /* the ESC is the first half of the ST, or begins a new sequence */
+            self->parser.state = c == '\e' ? PARSER_STATE_ESCAPED : PARSER_STATE_LITERAL;
+            break;
+
+        /* CAN, SUB */
+        case 0x18:
+        case 0x1a:
+            self->parser.state = PARSER_STATE_LITERAL;
+            break;
 
-        Vector_destroy_Vector_char(&tokens);
-        Vector_destroy_char(&self->parser.active_sequence);
-        self->parser.active_sequence = Vector_new_char();
-        self->parser.state           = PARSER_STATE_LITERAL;
+        default:
+            if (likely((unsigned char)c >= ' '))
+                Vector_push_char(&self->parser.active_sequence, c);
     }
 }
 
@@ -2350,125 +4003,260 @@ static inline void Vt_carriage_return(Vt* self)
 }
 
 /**
- * make a new empty line at cursor position, scroll down contents below */
-static inline void Vt_insert_line(Vt* self)
+ * Last line of the scroll region */
+static inline size_t Vt_scroll_region_last_line(Vt* self)
 {
-    self->last_interted = NULL;
-    Vector_insert_VtLine(&self->lines,
-                         Vector_at_VtLine(&self->lines, self->cursor.row),
-                         VtLine_new());
+    return MIN(Vt_bottom_line(self), Vt_get_scroll_region_bottom(self) + 1);
+}
 
-    Vt_empty_line_fill_bg(self, self->cursor.row);
+/**
+ * Rotate lines in [@param begin, @param end) by one and blank the line that wrapped around. It is
+ * reused instead of freeing it and allocating a new one */
+static void Vt_scroll_lines(Vt* self, size_t begin, size_t end, bool up)
+{
+    if (begin >= end) {
+        return;
+    }
 
-    Vector_remove_at_VtLine(&self->lines,
-                            MIN(Vt_get_scroll_region_bottom(self) + 1, Vt_bottom_line(self)),
-                            1);
+    self->last_interted = NULL;
+    VtLineBuffer_rotate(&self->lines, begin, end, up);
 
+    size_t idx = up ? end - 1 : begin;
+    VtLine_clear(&self->lines.buf[idx]);
+    Vt_empty_line_fill_bg(self, idx);
     Vt_mark_proxies_damaged_in_selected_region_and_scroll_region(self);
 }
 
+/**
+ * make a new empty line at cursor position, scroll down contents below */
+static inline void Vt_insert_line(Vt* self)
+{
+    Vt_scroll_lines(self, self->cursor.row, Vt_scroll_region_last_line(self) + 1, false);
+}
+
 /**
  * the same as insert line, but adds before cursor line */
 static inline void Vt_reverse_line_feed(Vt* self)
 {
-    self->last_interted = NULL;
-    Vector_remove_at_VtLine(&self->lines,
-                            MIN(Vt_bottom_line(self), Vt_get_scroll_region_bottom(self) + 1),
-                            1);
-    Vector_insert_VtLine(&self->lines,
-                         Vector_at_VtLine(&self->lines, self->cursor.row),
-                         VtLine_new());
-    Vt_empty_line_fill_bg(self, self->cursor.row);
-    Vt_mark_proxies_damaged_in_selected_region_and_scroll_region(self);
+    Vt_scroll_lines(self, self->cursor.row, Vt_scroll_region_last_line(self) + 1, false);
 }
 
 /**
  * delete active line, content below scrolls up */
 static inline void Vt_delete_line(Vt* self)
 {
-    self->last_interted = NULL;
-    Vector_remove_at_VtLine(&self->lines, self->cursor.row, 1);
+    Vt_scroll_lines(self, self->cursor.row, Vt_scroll_region_last_line(self) + 1, true);
+}
 
-    Vector_insert_VtLine(
-      &self->lines,
-      Vector_at_VtLine(&self->lines,
-                       MIN(Vt_get_scroll_region_bottom(self) + 1, Vt_bottom_line(self))),
-      VtLine_new());
+static inline void Vt_scroll_up(Vt* self)
+{
+    Vt_scroll_lines(self,
+                    Vt_get_scroll_region_top(self),
+                    Vt_scroll_region_last_line(self) + 1,
+                    true);
+}
 
-    Vt_empty_line_fill_bg(self, MIN(Vt_get_scroll_region_bottom(self) + 1, Vt_bottom_line(self)));
+static inline void Vt_scroll_down(Vt* self)
+{
+    Vt_scroll_lines(self,
+                    Vt_get_scroll_region_top(self),
+                    Vt_scroll_region_last_line(self) + 1,
+                    false);
+}
 
-    Vt_mark_proxies_damaged_in_selected_region_and_scroll_region(self);
+/**
+ * Move cursor one cell down if possible */
+static inline void Vt_cursor_down(Vt* self)
+{
+    self->last_interted = NULL;
+    if (self->cursor.row < Vt_bottom_line(self))
+        ++self->cursor.row;
+    Vt_notify_repaint_required(self);
 }
 
-static inline void Vt_scroll_up(Vt* self)
+/**
+ * Move cursor one cell up if possible */
+static inline void Vt_cursor_up(Vt* self)
+{
+    self->last_interted = NULL;
+    if (self->cursor.row > Vt_top_line(self))
+        --self->cursor.row;
+    Vt_notify_repaint_required(self);
+}
+
+/**
+ * Move cursor one cell to the left if possible */
+static inline void Vt_cursor_left(Vt* self)
 {
     self->last_interted = NULL;
-    Vector_insert_VtLine(
-      &self->lines,
-      Vector_at_VtLine(&self->lines,
-                       MIN(Vt_bottom_line(self), Vt_get_scroll_region_bottom(self) + 1) + 1),
-      VtLine_new());
+    if (self->cursor.col)
+        --self->cursor.col;
+    Vt_notify_repaint_required(self);
+}
 
-    Vt_empty_line_fill_bg(self,
-                          MIN(Vt_bottom_line(self), Vt_get_scroll_region_bottom(self) + 1) + 1);
+/**
+ * Move cursor one cell to the right if possible */
+static inline void Vt_cursor_right(Vt* self)
+{
+    self->last_interted = NULL;
+    if (self->cursor.col < self->ws.ws_col)
+        ++self->cursor.col;
+    Vt_notify_repaint_required(self);
+}
 
-    Vector_remove_at_VtLine(&self->lines, Vt_get_scroll_region_top(self) - 1, 1);
+/**
+ * Make sure there is a tab stop bit for each of @param cols columns. Bits for new columns are set
+ * every VT_TAB_WIDTH cells, stops that were cleared or set earlier are kept */
+static void Vt_grow_tab_stops(Vt* self, uint32_t cols)
+{
+    if (cols <= self->tab_stops_cols) {
+        return;
+    }
 
-    Vt_mark_proxies_damaged_in_selected_region_and_scroll_region(self);
+    uint32_t old_words = (self->tab_stops_cols + 63) / 64, words = (cols + 63) / 64;
+    if (words > old_words) {
+        self->tab_stops = realloc(self->tab_stops, words * sizeof(uint64_t));
+        memset(self->tab_stops + old_words, 0, (words - old_words) * sizeof(uint64_t));
+    }
+
+    for (uint32_t i = self->tab_stops_cols; i < cols; ++i) {
+        if (i && !(i % VT_TAB_WIDTH)) {
+            self->tab_stops[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+    self->tab_stops_cols = cols;
 }
 
-static inline void Vt_scroll_down(Vt* self)
+/**
+ * Put a tab stop every VT_TAB_WIDTH cells */
+static void Vt_reset_tab_stops(Vt* self)
 {
-    self->last_interted = NULL;
-    Vector_remove_at_VtLine(&self->lines,
-                            MAX(Vt_top_line(self), Vt_get_scroll_region_bottom(self) + 1),
-                            1);
+    self->tab_stops_cols = 0;
+    Vt_grow_tab_stops(self, MAX(self->ws.ws_col, 1));
+}
 
-    Vector_insert_VtLine(&self->lines,
-                         Vector_at_VtLine(&self->lines, Vt_get_scroll_region_top(self)),
-                         VtLine_new());
+/**
+ * Set (HTS) or clear (TBC) the tab stop at @param col */
+static inline void Vt_set_tab_stop(Vt* self, uint32_t col, bool set)
+{
+    if (col >= self->tab_stops_cols) {
+        return;
+    }
+    if (set) {
+        self->tab_stops[col / 64] |= 1ULL << (col % 64);
+    } else {
+        self->tab_stops[col / 64] &= ~(1ULL << (col % 64));
+    }
+}
 
-    Vt_mark_proxies_damaged_in_selected_region_and_scroll_region(self);
+/**
+ * Column of the first tab stop after @param col. Returns the last column if there is none, the
+ * cursor never moves past it */
+static uint32_t Vt_next_tab_stop(const Vt* self, uint32_t col)
+{
+    uint32_t last = self->ws.ws_col ? self->ws.ws_col - 1 : 0;
+    if (col >= last) {
+        return MAX(col, last);
+    }
+
+    uint32_t begin = col + 1;
+    for (uint32_t w = begin / 64; w * 64 < self->tab_stops_cols; ++w) {
+        uint64_t bits = self->tab_stops[w];
+        if (w == begin / 64) {
+            bits &= UINT64_MAX << (begin % 64);
+        }
+        if (bits) {
+            return MIN(w * 64 + __builtin_ctzll(bits), last);
+        }
+    }
+    return last;
+}
+
+/**
+ * Column of the last tab stop before @param col, 0 if there is none */
+static uint32_t Vt_previous_tab_stop(const Vt* self, uint32_t col)
+{
+    uint32_t end = MIN(col, self->tab_stops_cols);
+    if (!end) {
+        return 0;
+    }
+
+    for (uint32_t w = (end - 1) / 64 + 1; w--;) {
+        uint64_t bits = self->tab_stops[w];
+        if (w == (end - 1) / 64) {
+            bits &= UINT64_MAX >> (63 - (end - 1) % 64);
+        }
+        if (bits) {
+            return w * 64 + 63 - __builtin_clzll(bits);
+        }
+    }
+    return 0;
 }
 
 /**
- * Move cursor one cell down if possible */
-static inline void Vt_cursor_down(Vt* self)
+ * Set @param n cells from @param dst to @param value. Each copy doubles the filled part, so a row
+ * takes a few memcpy calls instead of a store per cell */
+static inline void VtRune_fill(VtRune* dst, const VtRune* value, size_t n)
 {
-    self->last_interted = NULL;
-    if (self->cursor.row < Vt_bottom_line(self))
-        ++self->cursor.row;
-    CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+    if (!n) {
+        return;
+    }
+
+    dst[0] = *value;
+    for (size_t done = 1; done < n;) {
+        size_t cnt = MIN(done, n - done);
+        memcpy(dst + done, dst, cnt * sizeof(VtRune));
+        done += cnt;
+    }
 }
 
 /**
- * Move cursor one cell up if possible */
-static inline void Vt_cursor_up(Vt* self)
+ * Set cells [@param begin, @param end) of a line to @param value. Lines shorter than @param begin
+ * are padded with blank_space first */
+static void Vt_fill_cells(Vector_VtRune* line, size_t begin, size_t end, const VtRune* value)
 {
-    self->last_interted = NULL;
-    if (self->cursor.row > Vt_top_line(self))
-        --self->cursor.row;
-    CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+    if (begin >= end) {
+        return;
+    }
+
+    if (line->cap < end) {
+        Vector_reserve_VtRune(line, end);
+    }
+
+    if (line->size < begin) {
+        VtRune_fill(line->buf + line->size, &blank_space, begin - line->size);
+    }
+
+    VtRune_fill(line->buf + begin, value, end - begin);
+    line->size = MAX(line->size, end);
 }
 
 /**
- * Move cursor one cell to the left if possible */
-static inline void Vt_cursor_left(Vt* self)
+ * Cells past the end of a line are drawn as blank space with the default background. Erasing with
+ * the default background and no line decorations looks the same, so erasing to the end of a line
+ * can shorten it instead */
+static inline bool Vt_erases_to_default(const Vt* self)
 {
-    self->last_interted = NULL;
-    if (self->cursor.col)
-        --self->cursor.col;
-    CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+    const VtRune* c = &self->parser.char_state;
+    return ColorRGBA_eq(c->bg, settings.bg) && !c->underlined && !c->doubleunderline &&
+           !c->curlyunderline && !c->strikethrough && !c->overline;
 }
 
 /**
- * Move cursor one cell to the right if possible */
-static inline void Vt_cursor_right(Vt* self)
+ * Erase cells from @param begin to @param end, the end of the line as far as it is drawn */
+static void Vt_erase_cells_to_end(Vt* self, size_t row, size_t begin, size_t end)
 {
-    self->last_interted = NULL;
-    if (self->cursor.col < self->ws.ws_col)
-        ++self->cursor.col;
-    CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+    Vector_VtRune* line = &self->lines.buf[row].data;
+
+    if (Vt_erases_to_default(self)) {
+        if (line->size > begin) {
+            line->size = begin;
+        }
+    } else {
+        Vt_fill_cells(line, begin, end, &self->parser.char_state);
+    }
+
+    Vt_mark_proxy_fully_damaged(self, row);
 }
 
 static inline void Vt_erase_to_end(Vt* self)
@@ -2482,7 +4270,7 @@ static inline void Vt_erase_to_end(Vt* self)
 
 static inline void Vt_handle_backspace(Vt* self)
 {
-    CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+    Vt_notify_repaint_required(self);
     Vt_cursor_left(self);
 }
 
@@ -2490,15 +4278,16 @@ static inline void Vt_handle_backspace(Vt* self)
  * Overwrite characters with colored space */
 static inline void Vt_erase_chars(Vt* self, size_t n)
 {
-    for (size_t i = 0; i < n; ++i) {
-        size_t idx = self->cursor.col + i;
-        if (idx >= self->lines.buf[self->cursor.row].data.size) {
-            Vector_push_VtRune(&self->lines.buf[self->cursor.row].data, self->parser.char_state);
-        } else {
-            self->lines.buf[self->cursor.row].data.buf[idx] = self->parser.char_state;
-        }
+    Vector_VtRune* line  = &self->lines.buf[self->cursor.row].data;
+    size_t         begin = self->cursor.col;
+    size_t         end   = MIN(begin + n, MAX((size_t)self->ws.ws_col, line->size));
+
+    if (end >= line->size) {
+        Vt_erase_cells_to_end(self, self->cursor.row, begin, end);
+    } else {
+        Vt_fill_cells(line, begin, end, &self->parser.char_state);
+        Vt_mark_proxy_fully_damaged(self, self->cursor.row);
     }
-    Vt_mark_proxy_fully_damaged(self, self->cursor.row);
 }
 
 /**
@@ -2572,7 +4361,7 @@ static inline void Vt_scroll_out_all_content(Vt* self)
     to_add += 1;
 
     for (int64_t i = 0; i < to_add; ++i) {
-        Vector_push_VtLine(&self->lines, VtLine_new());
+        VtLineBuffer_push(&self->lines, Vt_new_line(self));
         Vt_empty_line_fill_bg(self, self->lines.size - 1);
     }
 
@@ -2583,7 +4372,7 @@ static inline void Vt_scroll_out_above(Vt* self)
 {
     size_t to_add = Vt_get_cursor_row_screen(self);
     for (size_t i = 0; i < to_add; ++i) {
-        Vector_push_VtLine(&self->lines, VtLine_new());
+        VtLineBuffer_push(&self->lines, Vt_new_line(self));
         Vt_empty_line_fill_bg(self, self->lines.size - 1);
     }
 
@@ -2602,11 +4391,28 @@ static inline void Vt_clear_above(Vt* self)
 static inline void Vt_clear_display_and_scrollback(Vt* self)
 {
     Vt_mark_proxy_fully_damaged(self, self->cursor.row);
-    Vector_destroy_VtLine(&self->lines);
-    self->lines = Vector_new_VtLine();
-    for (size_t i = 0; i < self->ws.ws_row; ++i) {
-        Vector_push_VtLine(&self->lines, VtLine_new());
-        Vt_empty_line_fill_bg(self, self->lines.size - 1);
+    if (self->alt_lines.buf) {
+        /* the alternate screen has no scrollback, its lines are cleared in place */
+        Vt_blank_screen_lines(self, &self->lines);
+    } else {
+        VtLineBuffer_destroy(&self->lines);
+        self->lines = VtLineBuffer_new();
+        Vt_clear_thaw_cache(self);
+        if (self->spill.is_open)
+            Spill_clear(&self->spill);
+        self->reflow_top = 0;
+        VtStyleTable_destroy(&self->style_table);
+        self->style_table = VtStyleTable_new();
+        VtCompactLineTable_destroy(&self->line_table);
+        VtClusterTable_destroy(&self->clusters);
+        self->clusters      = VtClusterTable_new();
+        self->last_interted = NULL;
+        for (size_t i = 0; i < self->ws.ws_row; ++i) {
+            VtLineBuffer_push(&self->lines, VtLine_new());
+        }
+    }
+    for (size_t i = 0; i < self->lines.size; ++i) {
+        Vt_empty_line_fill_bg(self, i);
     }
     self->cursor.row = 0;
 }
@@ -2616,13 +4422,15 @@ static inline void Vt_clear_display_and_scrollback(Vt* self)
  * attributes are set */
 static inline void Vt_clear_left(Vt* self)
 {
-    for (size_t i = 0; i <= self->cursor.col; ++i) {
-        if (i < self->lines.buf[self->cursor.row].data.size)
-            self->lines.buf[self->cursor.row].data.buf[i] = self->parser.char_state;
-        else
-            Vector_push_VtRune(&self->lines.buf[self->cursor.row].data, self->parser.char_state);
+    Vector_VtRune* line = &self->lines.buf[self->cursor.row].data;
+    size_t         end  = self->cursor.col + 1;
+
+    if (end >= line->size) {
+        Vt_erase_cells_to_end(self, self->cursor.row, 0, end);
+    } else {
+        Vt_fill_cells(line, 0, end, &self->parser.char_state);
+        Vt_mark_proxy_fully_damaged(self, self->cursor.row);
     }
-    Vt_mark_proxy_fully_damaged(self, self->cursor.row);
 }
 
 /**
@@ -2630,21 +4438,17 @@ static inline void Vt_clear_left(Vt* self)
  * attributes are set */
 static inline void Vt_clear_right(Vt* self)
 {
-    for (int32_t i = self->cursor.col; i <= (int32_t)self->ws.ws_col; ++i) {
-        if (i + 1 <= (int32_t)self->lines.buf[self->cursor.row].data.size) {
-            self->lines.buf[self->cursor.row].data.buf[i] = self->parser.char_state;
-        } else {
-            Vector_push_VtRune(&self->lines.buf[self->cursor.row].data, self->parser.char_state);
-        }
-    }
-    Vt_mark_proxy_fully_damaged(self, self->cursor.row);
+    Vector_VtRune* line = &self->lines.buf[self->cursor.row].data;
+    size_t         end  = MAX((size_t)self->ws.ws_col + 1, line->size);
+
+    Vt_erase_cells_to_end(self, self->cursor.row, self->cursor.col, end);
 }
 
 /**
  * Insert character literal at cursor position, deal with reaching column limit */
 __attribute__((hot)) static inline void Vt_insert_char_at_cursor(Vt* self, VtRune c)
 {
-    CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+    Vt_notify_repaint_required(self);
 
     if (unlikely(self->cursor.col >= (size_t)self->ws.ws_col)) {
         if (unlikely(self->modes.no_auto_wrap)) {
@@ -2656,14 +4460,16 @@ __attribute__((hot)) static inline void Vt_insert_char_at_cursor(Vt* self, VtRun
         }
     }
 
-    while (self->lines.buf[self->cursor.row].data.size <= self->cursor.col) {
-        Vector_push_VtRune(&self->lines.buf[self->cursor.row].data, blank_space);
+    if (unlikely(self->lines.buf[self->cursor.row].data.size <= self->cursor.col)) {
+        Vector_VtRune* line = &self->lines.buf[self->cursor.row].data;
+        Vt_fill_cells(line, line->size, self->cursor.col + 1, &blank_space);
     }
     if (unlikely(self->parser.color_inverted)) {
         ColorRGB tmp = c.fg;
         c.fg         = ColorRGB_from_RGBA(c.bg);
         c.bg         = ColorRGBA_from_RGB(tmp);
     }
+    c.wide               = unicode_width(c.rune.code) == 2;
     VtRune* insert_point = &self->lines.buf[self->cursor.row].data.buf[self->cursor.col];
     if (likely(memcmp(insert_point, &c, sizeof(VtRune)))) {
         Vt_mark_proxy_damaged_cell(self, self->cursor.row, self->cursor.col);
@@ -2671,9 +4477,10 @@ __attribute__((hot)) static inline void Vt_insert_char_at_cursor(Vt* self, VtRun
     }
     self->last_interted = &self->lines.buf[self->cursor.row].data.buf[self->cursor.col];
     ++self->cursor.col;
-    if (unlikely(wcwidth(c.rune.code) == 2)) {
+    if (unlikely(c.wide)) {
         VtRune tmp    = c;
         tmp.rune.code = ' ';
+        tmp.wide      = false;
         if (self->lines.buf[self->cursor.row].data.size <= self->cursor.col) {
             Vector_push_VtRune(&self->lines.buf[self->cursor.row].data, tmp);
         } else {
@@ -2683,6 +4490,79 @@ __attribute__((hot)) static inline void Vt_insert_char_at_cursor(Vt* self, VtRun
     }
 }
 
+/**
+ * Insert a run of printable ascii characters at cursor position. Same as calling
+ * Vt_insert_char_at_cursor() for every character, but the line is only resized, damaged and
+ * the cursor advanced once for every part of the run that fits on a single line */
+__attribute__((hot)) static void Vt_insert_ascii_run_at_cursor(Vt*         self,
+                                                                 const char* run,
+                                                                 size_t      len)
+{
+    Vt_notify_repaint_required(self);
+
+    VtRune c = self->parser.char_state;
+    if (unlikely(self->parser.color_inverted)) {
+        ColorRGB tmp = c.fg;
+        c.fg         = ColorRGB_from_RGBA(c.bg);
+        c.bg         = ColorRGBA_from_RGB(tmp);
+    }
+
+    while (len) {
+        if (unlikely(self->cursor.col >= (size_t)self->ws.ws_col)) {
+            if (unlikely(self->modes.no_auto_wrap)) {
+                /* every remaining character overwrites the last column */
+                for (; len; --len, ++run) {
+                    VtRune tmp    = self->parser.char_state;
+                    tmp.rune.code = *run;
+                    Vt_insert_char_at_cursor(self, tmp);
+                }
+                return;
+            }
+            self->cursor.col = 0;
+            Vt_insert_new_line(self);
+            self->lines.buf[self->cursor.row].rejoinable = true;
+        }
+
+        Vector_VtRune* line  = &self->lines.buf[self->cursor.row].data;
+        size_t         begin = self->cursor.col;
+        size_t         cnt   = MIN(len, (size_t)self->ws.ws_col - begin);
+        size_t         end   = begin + cnt;
+
+        if (line->cap < end) {
+            Vector_reserve_VtRune(line, end);
+        }
+        if (line->size < begin) {
+            VtRune_fill(line->buf + line->size, &blank_space, begin - line->size);
+            line->size = begin;
+        }
+
+        /* only mark the span that actually changed */
+        size_t damage_front = SIZE_MAX, damage_end = 0;
+        for (size_t i = begin; i < end; ++i, ++run) {
+            VtRune* cell = line->buf + i;
+            if (i < line->size && cell->rune.code == (char32_t)*run) {
+                c.rune.code = *run;
+                if (!memcmp(cell, &c, sizeof(VtRune)))
+                    continue;
+            }
+            *cell           = c;
+            cell->rune.code = *run;
+            damage_front    = MIN(damage_front, i);
+            damage_end      = i;
+        }
+        line->size = MAX(line->size, end);
+
+        if (damage_front != SIZE_MAX) {
+            Vt_mark_proxy_damaged_cell(self, self->cursor.row, damage_front);
+            Vt_mark_proxy_damaged_cell(self, self->cursor.row, damage_end);
+        }
+
+        self->last_interted = &line->buf[end - 1];
+        self->cursor.col    = end;
+        len -= cnt;
+    }
+}
+
 static inline void Vt_insert_char_at_cursor_with_shift(Vt* self, VtRune c)
 {
     if (unlikely(self->cursor.col >= (size_t)self->ws.ws_col)) {
@@ -2708,9 +4588,7 @@ static inline void Vt_empty_line_fill_bg(Vt* self, size_t idx)
 
     Vt_mark_proxy_fully_damaged(self, idx);
     if (!ColorRGBA_eq(self->parser.char_state.bg, settings.bg)) {
-        for (size_t i = 0; i < self->ws.ws_col; ++i) {
-            Vector_push_VtRune(&self->lines.buf[idx].data, self->parser.char_state);
-        }
+        Vt_fill_cells(&self->lines.buf[idx].data, 0, self->ws.ws_col, &self->parser.char_state);
     }
 }
 
@@ -2721,14 +4599,10 @@ static inline void Vt_insert_new_line(Vt* self)
     Vt_mark_proxies_damaged_in_selected_region_and_scroll_region(self);
 
     if (self->cursor.row == Vt_get_scroll_region_bottom(self) + 1) {
-        Vector_remove_at_VtLine(&self->lines, Vt_get_scroll_region_top(self), 1);
-        Vector_insert_VtLine(&self->lines,
-                             Vector_at_VtLine(&self->lines, self->cursor.row),
-                             VtLine_new());
-        Vt_empty_line_fill_bg(self, self->cursor.row);
+        Vt_scroll_lines(self, Vt_get_scroll_region_top(self), self->cursor.row + 1, true);
     } else {
         if (Vt_bottom_line(self) == self->cursor.row) {
-            Vector_push_VtLine(&self->lines, VtLine_new());
+            VtLineBuffer_push(&self->lines, Vt_new_line(self));
             Vt_empty_line_fill_bg(self, self->lines.size - 1);
         }
         ++self->cursor.row;
@@ -2742,7 +4616,7 @@ static inline void Vt_move_cursor(Vt* self, uint32_t columns, uint32_t rows)
     self->last_interted = NULL;
     self->cursor.row    = MIN(rows, (uint32_t)self->ws.ws_row - 1) + Vt_top_line(self);
     self->cursor.col    = MIN(columns, (uint32_t)self->ws.ws_col);
-    CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+    Vt_notify_repaint_required(self);
 }
 
 /**
@@ -2751,21 +4625,7 @@ static inline void Vt_move_cursor_to_column(Vt* self, uint32_t columns)
 {
     self->last_interted = NULL;
     self->cursor.col    = MIN(columns, (uint32_t)self->ws.ws_col);
-    CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
-}
-
-/**
- * Add a character as a combining character for that rune */
-static inline void VtRune_push_combining(VtRune* self, char32_t codepoint)
-{
-    ASSERT(unicode_is_combining(codepoint), "must be a combining character");
-    for (uint_fast8_t i = 0; i < ARRAY_SIZE(self->rune.combine); ++i) {
-        if (!self->rune.combine[i]) {
-            self->rune.combine[i] = codepoint;
-            return;
-        }
-    }
-    WRN("Combining character limit (%zu) exceeded\n", ARRAY_SIZE(self->rune.combine));
+    Vt_notify_repaint_required(self);
 }
 
 /**
@@ -2815,109 +4675,111 @@ static inline void Vt_handle_combinable(Vt* self, char32_t c)
         if (VtRune_try_normalize_as_property(self->last_interted, c)) {
             return;
         }
-#ifndef NOUTF8PROC
-        if (self->last_interted->rune.combine[0]) {
-#endif
-            // Already contains a combining char that failed to normalize
-            VtRune_push_combining(self->last_interted, c);
-#ifndef NOUTF8PROC
+
+        // Once a combining char failed to compose, later ones can't be composed in order
+        char32_t composed;
+        if (!self->last_interted->rune.cluster &&
+            (composed = unicode_compose(self->last_interted->rune.code, c))) {
+            self->last_interted->rune.code = composed;
         } else {
-            mbstate_t mbs;
-            memset(&mbs, 0, sizeof(mbs));
-            char   buff[MB_CUR_MAX * 2 + 1];
-            size_t oft = c32rtomb(buff, self->last_interted->rune.code, &mbs);
-            buff[c32rtomb(buff + oft, c, &mbs) + oft] = 0;
-            size_t   old_len                          = strlen(buff);
-            char*    res     = (char*)utf8proc_NFC((const utf8proc_uint8_t*)buff);
-            char32_t conv[2] = { 0, 0 };
-            if (old_len == strlen(res)) {
-                VtRune_push_combining(self->last_interted, c);
-            } else if (mbrtoc32(conv, res, ARRAY_SIZE(buff) - 1, &mbs) < 1) {
-                // conversion failed
-                WRN("unicode normalization failed %s", strerror(errno));
-            } else {
-                self->last_interted->rune.code = conv[0];
-            }
-            free(res);
+            Vt_push_combining(self, self->last_interted, c);
         }
-#endif
     }
 }
 
-__attribute__((always_inline, hot, flatten)) static inline void Vt_handle_literal(Vt* self, char c)
+/**
+ * Insert a decoded character */
+__attribute__((always_inline, hot)) static inline void Vt_handle_codepoint(Vt* self,
+                                                                          char32_t codepoint)
 {
-    if (unlikely(self->parser.in_mb_seq)) {
-        char32_t res;
-        size_t   rd = mbrtoc32(&res, &c, 1, &self->parser.input_mbstate);
-
-        if (unlikely(rd == (size_t)-1)) {
-            /* encoding error */
-            WRN("%s\n", strerror(errno));
-            errno = 0;
-
-            /* zero-initialized mbstate_t always represents the initial conversion state */
-            memset(&self->parser.input_mbstate, 0, sizeof(mbstate_t));
-        } else if (rd != (size_t)-2) {
-            /* sequence is complete */
-            self->parser.in_mb_seq = false;
-            if (unlikely(unicode_is_combining(res))) {
-                Vt_handle_combinable(self, res);
-                return;
-            }
-            VtRune new_rune    = self->parser.char_state;
-            new_rune.rune.code = res;
-            Vt_insert_char_at_cursor(self, new_rune);
-        }
-    } else {
-        switch (c) {
-            case '\a':
-                if (!settings.no_flash) {
-                    CALL_FP(self->callbacks.on_bell_flash, self->callbacks.user_data);
-                }
-                break;
+    if (unlikely(unicode_is_combining(codepoint))) {
+        Vt_handle_combinable(self, codepoint);
+        return;
+    }
+    VtRune new_rune    = self->parser.char_state;
+    new_rune.rune.code = codepoint;
+    Vt_insert_char_at_cursor(self, new_rune);
+}
 
-            case '\b':
-                Vt_handle_backspace(self);
+/**
+ * Decode multibyte characters from the start of buf. Stops at the first ascii byte that is not
+ * part of an incomplete sequence, an incomplete sequence at the end is continued on the next call.
+ * Invalid input is replaced with U+FFFD.
+ *
+ * @return number of bytes consumed */
+__attribute__((hot)) static size_t Vt_handle_utf8(Vt* self, const char* buf, size_t n)
+{
+    size_t i = 0;
+
+    while (i < n && ((buf[i] & 0x80) || self->parser.utf8_state != UTF8_ACCEPT)) {
+        uint32_t prev = self->parser.utf8_state;
+        switch (utf8_decode(&self->parser.utf8_state, &self->parser.utf8_codepoint, buf[i])) {
+            case UTF8_ACCEPT:
+                Vt_handle_codepoint(self, self->parser.utf8_codepoint);
+                ++i;
                 break;
 
-            case '\r':
-                Vt_carriage_return(self);
+            case UTF8_REJECT:
+                Vt_handle_codepoint(self, UTF8_REPLACEMENT_CHARACTER);
+                self->parser.utf8_state = UTF8_ACCEPT;
+                /* byte that broke a sequence may begin the next one */
+                if (prev == UTF8_ACCEPT)
+                    ++i;
                 break;
 
-            case '\f':
-            case '\v':
-            case '\n':
-                Vt_insert_new_line(self);
-                break;
+            default:
+                ++i;
+        }
+    }
 
-            case '\e':
-                self->parser.state = PARSER_STATE_ESCAPED;
-                break;
+    return i;
+}
 
-            case '\t': {
-                size_t cp = self->cursor.col;
+__attribute__((always_inline, hot, flatten)) static inline void Vt_handle_literal(Vt* self, char c)
+{
+    switch (c) {
+        case '\a':
+            if (!settings.no_flash) {
+                CALL_FP(self->callbacks.on_bell_flash, self->callbacks.user_data);
+            }
+            break;
 
-                // TODO: do this properly
-                for (size_t i = 0; i < self->tabstop - (cp % self->tabstop); ++i)
-                    Vt_cursor_right(self);
-            } break;
+        case '\b':
+            Vt_handle_backspace(self);
+            break;
 
-            default: {
-                if (c & (1 << 7)) {
-                    mbrtoc32(NULL, &c, 1, &self->parser.input_mbstate);
-                    self->parser.in_mb_seq = true;
-                    break;
-                }
-                VtRune new_char    = self->parser.char_state;
-                new_char.rune.code = c;
-                if (unlikely((bool)self->charset_g0)) {
-                    new_char.rune.code = self->charset_g0(c);
-                }
-                if (unlikely((bool)self->charset_g1)) {
-                    new_char.rune.code = self->charset_g1(c);
-                }
-                Vt_insert_char_at_cursor(self, new_char);
+        case '\r':
+            Vt_carriage_return(self);
+            break;
+
+        case '\f':
+        case '\v':
+        case '\n':
+            Vt_insert_new_line(self);
+            break;
+
+        case '\e':
+            self->parser.state = PARSER_STATE_ESCAPED;
+            break;
+
+        case '\t':
+            Vt_move_cursor_to_column(self, Vt_next_tab_stop(self, self->cursor.col));
+            break;
+
+        default: {
+            if (c & (1 << 7)) {
+                Vt_handle_utf8(self, &c, 1);
+                break;
+            }
+            VtRune new_char    = self->parser.char_state;
+            new_char.rune.code = c;
+            if (unlikely((bool)self->charset_g0)) {
+                new_char.rune.code = self->charset_g0(c);
+            }
+            if (unlikely((bool)self->charset_g1)) {
+                new_char.rune.code = self->charset_g1(c);
             }
+            Vt_insert_char_at_cursor(self, new_char);
         }
     }
 }
@@ -2939,24 +4801,44 @@ __attribute__((always_inline, hot)) static inline void Vt_handle_char(Vt* self,
 
                 /* Control sequence introduce (CSI) */
                 case '[':
-                    self->parser.state = PARSER_STATE_CSI;
+                    Vt_begin_CSI(self);
                     return;
 
                 /* Operating system command (OSC) */
                 case ']':
+                    Vector_clear_char(&self->parser.active_sequence);
                     self->parser.state = PARSER_STATE_OSC;
                     return;
 
                 /* Device control */
                 case 'P':
+                    Vector_clear_char(&self->parser.active_sequence);
                     self->parser.state = PARSER_STATE_DCS;
                     return;
 
                 /* Application Programming Command (APC) */
                 case '_':
+                    Vector_clear_char(&self->parser.active_sequence);
                     self->parser.state = PARSER_STATE_APC;
                     return;
 
+                /* Privacy Message (PM) */
+                case '^':
+                    Vector_clear_char(&self->parser.active_sequence);
+                    self->parser.state = PARSER_STATE_PM;
+                    return;
+
+                /* String terminator (ST), the string was dispatched on ESC */
+                case '\\':
+                    self->parser.state = PARSER_STATE_LITERAL;
+                    return;
+
+                /* Horizontal tab set (HTS) */
+                case 'H':
+                    Vt_set_tab_stop(self, self->cursor.col, true);
+                    self->parser.state = PARSER_STATE_LITERAL;
+                    return;
+
                 /* Reverse line feed (RI) */
                 case 'M':
                     Vt_reverse_line_feed(self);
@@ -3014,7 +4896,7 @@ __attribute__((always_inline, hot)) static inline void Vt_handle_char(Vt* self,
                     Vt_select_end(self);
                     Vt_clear_display_and_scrollback(self);
                     Vt_move_cursor(self, 0, 0);
-                    self->tabstop           = 8;
+                    Vt_reset_tab_stops(self);
                     self->parser.state      = PARSER_STATE_LITERAL;
                     self->scroll_region_top = 0;
                     self->charset_g0        = NULL;
@@ -3116,19 +4998,10 @@ __attribute__((always_inline, hot)) static inline void Vt_handle_char(Vt* self,
             break;
 
         case PARSER_STATE_OSC:
-            Vt_handle_OSC(self, c);
-            break;
-
         case PARSER_STATE_PM:
-            Vt_handle_PM(self, c);
-            break;
-
         case PARSER_STATE_DCS:
-            Vt_handle_DCS(self, c);
-            break;
-
         case PARSER_STATE_APC:
-            Vt_handle_APC(self, c);
+            Vt_handle_command_string(self, c);
             break;
 
         default:
@@ -3136,17 +5009,59 @@ __attribute__((always_inline, hot)) static inline void Vt_handle_char(Vt* self,
     }
 }
 
+/**
+ * Drop the oldest lines past the scrollback limit. Positions that refer to lines by index are
+ * moved with the contents */
 static inline void Vt_shrink_scrollback(Vt* self)
 {
     /* alt buffer is active */
     if (self->alt_lines.buf)
         return;
 
-    int64_t ln_cnt = self->lines.size;
-    if (unlikely(ln_cnt > MAX(settings.scrollback * 1.1, self->ws.ws_row))) {
-        int64_t to_remove = ln_cnt - settings.scrollback - self->ws.ws_row;
-        Vector_remove_at_VtLine(&self->lines, 0, to_remove);
-        self->cursor.row -= to_remove;
+    size_t max_lines = settings.scrollback + self->ws.ws_row;
+    if (likely(self->lines.size <= max_lines))
+        return;
+
+    size_t to_remove = self->lines.size - max_lines;
+
+    /* keep the lines paged in from the scrollback file while they are looked at */
+    if (self->spill.is_open && self->scrolling_visual) {
+        to_remove = MIN(to_remove, self->visual_scroll_top);
+        if (!to_remove)
+            return;
+    }
+
+    if (self->selection.mode != SELECT_MODE_NONE &&
+        MIN(self->selection.begin_line, self->selection.end_line) < to_remove) {
+        Vt_select_end(self);
+    }
+
+    for (size_t i = 0; i < to_remove; ++i) {
+        Vt_forget_last_inserted_in(self, &self->lines.buf[i]);
+    }
+
+    if (self->spill.is_open) {
+        Vt_spill_lines(self, to_remove);
+    }
+
+    /* with little or no scrollback lines are evicted before they are compacted */
+    for (size_t i = 0; i < to_remove; ++i) {
+        Vt_give_cells(self, &self->lines.buf[i].data);
+    }
+
+    VtLineBuffer_evict_front(&self->lines, to_remove);
+
+    self->reflow_top -= MIN(to_remove, self->reflow_top);
+    self->cursor.row -= to_remove;
+    self->saved_active_line = self->saved_active_line > to_remove
+                                ? self->saved_active_line - to_remove
+                                : 0;
+    self->selection.begin_line -= MIN(to_remove, self->selection.begin_line);
+    self->selection.end_line -= MIN(to_remove, self->selection.end_line);
+    self->selection.click_begin_line -= MIN(to_remove, self->selection.click_begin_line);
+
+    if (self->scrolling_visual) {
+        self->visual_scroll_top -= MIN(to_remove, self->visual_scroll_top);
     }
 }
 
@@ -3172,8 +5087,44 @@ inline void Vt_interpret(Vt* self, char* buf, size_t bytes)
         fprintf(stderr, "pty.read (%3zu) ~> { %s }\n\n", bytes, str);
         free(str);
     }
-    for (size_t i = 0; i < bytes; ++i) {
-        Vt_handle_char(self, buf[i]);
+
+    self->deferred_callbacks.active = true;
+
+    for (size_t i = 0; i < bytes;) {
+        if (self->parser.state == PARSER_STATE_LITERAL) {
+            if ((buf[i] & 0x80) || self->parser.utf8_state != UTF8_ACCEPT) {
+                i += Vt_handle_utf8(self, buf + i, bytes - i);
+                continue;
+            }
+            if (!self->charset_g0 && !self->charset_g1) {
+                size_t run = printable_ascii_run_length(buf + i, bytes - i);
+                if (run) {
+                    Vt_insert_ascii_run_at_cursor(self, buf + i, run);
+                    i += run;
+                    continue;
+                }
+            }
+        }
+        Vt_handle_char(self, buf[i++]);
+    }
+
+    Vt_shrink_scrollback(self);
+    Vt_compact_scrollback(self);
+    Vt_freeze_scrollback(self);
+
+    if (unlikely(self->clusters.codes.size > self->clusters.rebuild_size))
+        Vt_rebuild_cluster_table(self);
+
+    self->deferred_callbacks.active = false;
+
+    if (self->deferred_callbacks.repaint_required) {
+        self->deferred_callbacks.repaint_required = false;
+        CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+    }
+
+    if (self->deferred_callbacks.action_performed) {
+        self->deferred_callbacks.action_performed = false;
+        CALL_FP(self->callbacks.on_action_performed, self->callbacks.user_data);
     }
 }
 
@@ -3188,6 +5139,191 @@ void Vt_get_visible_lines(const Vt* self, VtLine** out_begin, VtLine** out_end)
     }
 }
 
+VtSnapshot VtSnapshot_new()
+{
+    VtSnapshot self;
+    memset(&self, 0, sizeof(self));
+    self.view.lines                = VtLineBuffer_new();
+    self.view.unicode_input.buffer = Vector_new_char();
+    return self;
+}
+
+/**
+ * Damage of a row that was not drawn yet combined with new damage of its line */
+static struct VtLineDamage VtLineDamage_merge(struct VtLineDamage old, struct VtLineDamage new)
+{
+    if (old.type == VT_LINE_DAMAGE_NONE) {
+        return new;
+    } else if (new.type == VT_LINE_DAMAGE_NONE) {
+        return old;
+    } else if (old.type == VT_LINE_DAMAGE_RANGE && new.type == VT_LINE_DAMAGE_RANGE) {
+        return (struct VtLineDamage){ .type  = VT_LINE_DAMAGE_RANGE,
+                                      .front = MIN(old.front, new.front),
+                                      .end   = MAX(old.end, new.end) };
+    }
+    return (struct VtLineDamage){ .type = VT_LINE_DAMAGE_FULL };
+}
+
+/**
+ * Move the selection to snapshot rows. Ends outside of the visible rows are moved to the first or
+ * last one */
+static void VtSnapshot_update_selection(VtSnapshot* self, const Vt* vt)
+{
+    struct Selection* sel    = &self->view.selection;
+    size_t            top    = self->top;
+    size_t            bottom = top + self->view.lines.size - 1;
+
+    *sel = vt->selection;
+    if (sel->mode == SELECT_MODE_NONE) {
+        return;
+    }
+
+    bool begin_first =
+      sel->begin_line < sel->end_line ||
+      (sel->begin_line == sel->end_line && sel->begin_char_idx <= sel->end_char_idx);
+    size_t*  first_line = begin_first ? &sel->begin_line : &sel->end_line;
+    size_t*  last_line  = begin_first ? &sel->end_line : &sel->begin_line;
+    int32_t* first_char = begin_first ? &sel->begin_char_idx : &sel->end_char_idx;
+    int32_t* last_char  = begin_first ? &sel->end_char_idx : &sel->begin_char_idx;
+
+    if (*last_line < top || *first_line > bottom) {
+        sel->mode = SELECT_MODE_NONE;
+        return;
+    }
+
+    if (*first_line < top) {
+        *first_line = top;
+        if (sel->mode == SELECT_MODE_NORMAL) {
+            *first_char = 0;
+        }
+    }
+
+    if (*last_line > bottom) {
+        *last_line = bottom;
+        if (sel->mode == SELECT_MODE_NORMAL) {
+            *last_char = vt->ws.ws_col;
+        }
+    }
+
+    *first_line -= top;
+    *last_line -= top;
+}
+
+void VtSnapshot_update(VtSnapshot* self, Vt* vt)
+{
+    size_t         nrows   = vt->ws.ws_row;
+    VtLineBuffer   old     = self->view.lines;
+    VtLineBuffer   rows    = VtLineBuffer_new();
+    const VtRune** sources = calloc(nrows, sizeof(VtRune*));
+    int32_t*       matches = malloc(nrows * sizeof(int32_t));
+    bool*          taken   = calloc(old.size + 1, sizeof(bool));
+
+    self->top = Vt_visual_top_line(vt);
+
+    /* Find the row each line was on in the last snapshot. Lines keep their cell storage when they
+     * move, start with full damage when it is reused and get damaged when their cells change */
+    for (size_t i = 0; i < nrows; ++i) {
+        size_t        idx  = self->top + i;
+        const VtRune* data = idx < vt->lines.size ? vt->lines.buf[idx].data.buf : NULL;
+        matches[i]         = -1;
+
+        if (!data) {
+            continue;
+        }
+
+        for (size_t j = 0; j < old.size; ++j) {
+            size_t guess = (i + j) % old.size;
+            if (!taken[guess] && self->sources[guess] == data) {
+                matches[i]   = guess;
+                taken[guess] = true;
+                break;
+            }
+        }
+    }
+
+    /* Rows that are not matched give their storage and proxies to lines that are new on screen */
+    size_t spare = 0;
+    for (size_t i = 0; i < nrows; ++i) {
+        size_t  idx  = self->top + i;
+        VtLine* line = idx < vt->lines.size ? vt->lines.buf + idx : NULL;
+        VtLine  row;
+
+        if (matches[i] >= 0) {
+            row = old.buf[matches[i]];
+            if (line->damage.type != VT_LINE_DAMAGE_NONE || row.data.size != line->data.size) {
+                Vector_clear_VtRune(&row.data);
+                Vector_pushv_VtRune(&row.data, line->data.buf, line->data.size);
+                row.damage = VtLineDamage_merge(row.damage, line->damage);
+            }
+        } else {
+            while (spare < old.size && taken[spare]) {
+                ++spare;
+            }
+
+            if (spare < old.size) {
+                taken[spare] = true;
+                row          = old.buf[spare];
+                Vector_clear_VtRune(&row.data);
+            } else {
+                row = VtLine_new();
+            }
+
+            if (line) {
+                Vector_pushv_VtRune(&row.data, line->data.buf, line->data.size);
+            }
+            row.damage = (struct VtLineDamage){ .type = VT_LINE_DAMAGE_FULL };
+        }
+
+        if (line) {
+            sources[i]        = line->data.buf;
+            line->damage.type = VT_LINE_DAMAGE_NONE;
+        }
+
+        VtLineBuffer_push(&rows, row);
+    }
+
+    for (size_t j = 0; j < old.size; ++j) {
+        if (!taken[j]) {
+            VtLine_destroy(old.buf + j);
+        }
+    }
+
+    free(old.mem);
+    free(self->sources);
+    free(matches);
+    free(taken);
+    self->sources    = sources;
+    self->view.lines = rows;
+
+    self->view.ws               = vt->ws;
+    self->view.scrolling_visual = vt->scrolling_visual;
+    self->view.cursor           = vt->cursor;
+    self->view.cursor.row       = vt->cursor.row - MIN(vt->cursor.row, self->top);
+    VtSnapshot_update_selection(self, vt);
+
+    self->view.unicode_input.active = vt->unicode_input.active;
+    Vector_clear_char(&self->view.unicode_input.buffer);
+    Vector_pushv_char(&self->view.unicode_input.buffer,
+                      vt->unicode_input.buffer.buf,
+                      vt->unicode_input.buffer.size);
+}
+
+void VtSnapshot_clear_proxies(VtSnapshot* self)
+{
+    for (size_t i = 0; i < self->view.lines.size; ++i) {
+        Vt_destroy_line_proxy(self->view.lines.buf[i].proxy.data);
+        self->view.lines.buf[i].damage.type = VT_LINE_DAMAGE_FULL;
+    }
+}
+
+void VtSnapshot_destroy(VtSnapshot* self)
+{
+    VtLineBuffer_destroy(&self->view.lines);
+    Vector_destroy_char(&self->view.unicode_input.buffer);
+    free(self->sources);
+    self->sources = NULL;
+}
+
 static inline const char* normal_keypad_response(const uint32_t key)
 {
     switch (key) {
@@ -3293,7 +5429,7 @@ static inline const char* application_mod_keypad_response(const uint32_t key)
 void Vt_start_unicode_input(Vt* self)
 {
     self->unicode_input.active = true;
-    CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+    Vt_notify_repaint_required(self);
 }
 
 /**
@@ -3327,7 +5463,7 @@ static bool Vt_maybe_handle_unicode_input_key(Vt*      self,
             // Escape
             self->unicode_input.buffer.size = 0;
             self->unicode_input.active      = false;
-            CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+            Vt_notify_repaint_required(self);
         } else if (key == 8) {
             // Backspace
             if (self->unicode_input.buffer.size) {
@@ -3336,13 +5472,13 @@ static bool Vt_maybe_handle_unicode_input_key(Vt*      self,
                 self->unicode_input.buffer.size = 0;
                 self->unicode_input.active      = false;
             }
-            CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+            Vt_notify_repaint_required(self);
         } else if (isxdigit(key)) {
             if (self->unicode_input.buffer.size > 8) {
                 CALL_FP(self->callbacks.on_bell_flash, self->callbacks.user_data);
             } else {
                 Vector_push_char(&self->unicode_input.buffer, key);
-                CALL_FP(self->callbacks.on_repaint_required, self->callbacks.user_data);
+                Vt_notify_repaint_required(self);
             }
         } else {
             CALL_FP(self->callbacks.on_bell_flash, self->callbacks.user_data);
@@ -3579,19 +5715,34 @@ void Vt_handle_clipboard(void* self, const char* text)
 
 void Vt_destroy(Vt* self)
 {
-    Vector_destroy_VtLine(&self->lines);
+    VtLineBuffer_destroy(&self->lines);
     if (self->alt_lines.buf) {
-        Vector_destroy_VtLine(&self->alt_lines);
+        VtLineBuffer_destroy(&self->alt_lines);
+    }
+    if (self->spare_alt_lines.buf) {
+        VtLineBuffer_destroy(&self->spare_alt_lines);
     }
+    for (uint32_t i = 0; i < self->cell_pool_size; ++i) {
+        Vector_destroy_VtRune(&self->cell_pool[i]);
+    }
+    Vt_clear_thaw_cache(self);
+    VtStyleTable_destroy(&self->style_table);
+    VtCompactLineTable_destroy(&self->line_table);
+    VtClusterTable_destroy(&self->clusters);
+    Spill_close(&self->spill);
 
     Vector_destroy_char(&self->parser.active_sequence);
+    Vector_destroy_char(&self->output);
+    Vector_destroy_char(&self->unicode_input.buffer);
 
     for (size_t* i = NULL; Vector_iter_size_t(&self->title_stack, i);) {
         free((char*)*i);
     }
 
     Vector_destroy_size_t(&self->title_stack);
+    free(self->title);
     free(self->work_dir);
+    free(self->tab_stops);
 }
 
 void Vt_get_output(Vt* self, char** out_buf, size_t* out_bytes)
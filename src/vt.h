@@ -24,14 +24,71 @@
 #include "colors.h"
 #include "monitor.h"
 #include "settings.h"
+#include "spill.h"
 #include "timing.h"
 #include "util.h"
 #include "vector.h"
 
+/* Most combining characters added to one cell */
 #ifndef VT_RUNE_MAX_COMBINE
-#define VT_RUNE_MAX_COMBINE 2
+#define VT_RUNE_MAX_COMBINE 16
 #endif
 
+/* Number of characters in the combining character table that makes it get rebuilt with only the
+ * sequences still in use. It is allowed to grow to twice the size left by a rebuild */
+#ifndef VT_CLUSTER_TABLE_REBUILD
+#define VT_CLUSTER_TABLE_REBUILD (1 << 16)
+#endif
+
+/* Number of scrollback lines compressed together */
+#ifndef VT_COLD_BLOCK_LINES
+#define VT_COLD_BLOCK_LINES 64
+#endif
+
+/* Lines closer than this to the top of the screen are not compressed */
+#ifndef VT_COLD_DISTANCE
+#define VT_COLD_DISTANCE 512
+#endif
+
+/* Number of decompressed blocks kept around */
+#ifndef VT_THAW_CACHE_SIZE
+#define VT_THAW_CACHE_SIZE 4
+#endif
+
+/* Number of lines read back from the scrollback file at once */
+#ifndef VT_SPILL_PAGE_LINES
+#define VT_SPILL_PAGE_LINES 256
+#endif
+
+/* Number of history lines reflowed per call to Vt_reflow_history_step() */
+#ifndef VT_REFLOW_STEP_LINES
+#define VT_REFLOW_STEP_LINES 1024
+#endif
+
+/* Number of free line cell buffers kept for reuse */
+#ifndef VT_CELL_POOL_SIZE
+#define VT_CELL_POOL_SIZE 128
+#endif
+
+/* Distance between the initial tab stops */
+#ifndef VT_TAB_WIDTH
+#define VT_TAB_WIDTH 8
+#endif
+
+/* Scrollback file index entry: block offset, line flags and position in the block, then the part
+ * of the logical line in the row */
+#define VT_SPILL_ENTRY(_offset, _flags, _index)                                                    \
+    ((uint64_t)(_offset) << 24 | (uint64_t)(_flags) << 16 | (_index))
+#define VT_SPILL_ENTRY_OFFSET(_entry) ((_entry) >> 24)
+#define VT_SPILL_ENTRY_FLAGS(_entry)  (((_entry) >> 16) & 0xff)
+#define VT_SPILL_ENTRY_INDEX(_entry)  ((_entry)&0xffff)
+#define VT_SPILL_ENTRY_SLICE(_begin, _cells) ((uint64_t)(_begin) << 32 | (_cells))
+#define VT_SPILL_ENTRY_BEGIN(_slice)         ((_slice) >> 32)
+#define VT_SPILL_ENTRY_CELLS(_slice)         ((_slice)&0xffffffff)
+
+/* Control sequence parameters past this are skipped, the sequence is still executed */
+#define VT_PARSER_CSI_MAX_PARAMS 32
+
 enum MouseButton
 {
     MOUSE_BTN_LEFT       = 1,
@@ -58,7 +115,11 @@ typedef struct Cursor
 typedef struct
 {
     char32_t code;
-    char32_t combine[VT_RUNE_MAX_COMBINE];
+
+    /* Combining characters following 'code', an index into the VtClusterTable of the terminal or 0
+     * if there are none */
+    uint32_t cluster : 29;
+
     enum VtRuneStyle
     {
         VT_RUNE_NORMAL = 0,
@@ -87,6 +148,8 @@ typedef struct
     uint8_t   curlyunderline : 1;
     uint8_t   overline : 1;
 
+    /* Takes up two cells, the next cell is a placeholder */
+    uint8_t wide : 1;
 } VtRune;
 
 DEF_VECTOR(VtRune, NULL)
@@ -95,6 +158,8 @@ DEF_VECTOR(char, NULL)
 
 DEF_VECTOR(size_t, NULL)
 
+DEF_VECTOR(char32_t, NULL)
+
 DEF_VECTOR(Vector_VtRune, Vector_destroy_VtRune)
 
 DEF_VECTOR(Vector_char, Vector_destroy_char)
@@ -119,6 +184,141 @@ typedef struct
     int32_t data[4];
 } VtLineProxy;
 
+/**
+ * Character cell of a line in the scrollback. Colors and decorations are kept once in a
+ * VtStyleTable, the cell refers to them by index */
+typedef struct
+{
+    uint32_t code : 21;
+    uint32_t wide : 1;
+    uint16_t style;
+} VtCompactCell;
+
+/**
+ * Combining characters of a compacted cell */
+typedef struct
+{
+    uint32_t column, cluster;
+} VtCompactCombine;
+
+/**
+ * Compacted line contents. 'ncombine' VtCompactCombine entries follow the cells in the same
+ * allocation. With settings.scrollback_dedup identical lines are shared, every row showing one
+ * and the VtCompactLineTable hold a reference. Shared lines are never modified, rows get their own
+ * copy of the cells when they are expanded */
+typedef struct
+{
+    uint32_t      size, ncombine;
+    uint32_t      refs, hash;
+    VtCompactCell cells[];
+} VtCompactLine;
+
+static inline VtCompactCombine* VtCompactLine_combine(VtCompactLine* self)
+{
+    return (VtCompactCombine*)(self->cells + self->size);
+}
+
+static inline void VtCompactLine_unref(VtCompactLine* self)
+{
+    if (self && !--self->refs)
+        free(self);
+}
+
+/**
+ * Compact lines shared by identical scrollback rows, an open addressing hash table. Lines are not
+ * removed when the last row using them goes away, the ones only the table refers to are dropped
+ * when it fills up */
+typedef struct
+{
+    VtCompactLine** slots;
+    uint32_t        nslots, nlines;
+
+    /* number of rows compacted since the table was created and how many of them reused a line */
+    uint64_t interned, shared;
+} VtCompactLineTable;
+
+/**
+ * Compressed contents of up to VT_COLD_BLOCK_LINES old scrollback lines. Rows wrapped from the
+ * same logical line are stored as one line, so resizing only changes which part of it each row
+ * shows. Every row showing a line stored here holds a reference, as does the thaw cache while
+ * @param thawed is set. Cells refer to styles in a palette stored with the block, so blocks do
+ * not keep entries of the VtStyleTable alive */
+typedef struct VtColdBlock
+{
+    uint32_t refs;
+    uint32_t size, compressed_size;
+
+    /* position of the VtRune style palette in the decompressed contents */
+    uint32_t palette_offset, npalette;
+
+    uint16_t nlines;
+
+    /* where the block is stored in the scrollback file, UINT64_MAX if it was not written there */
+    uint64_t spill_offset;
+
+    /* decompressed contents, only kept while the block is in the thaw cache */
+    uint8_t* thawed;
+
+    /* position of each line in the decompressed contents and its number of cells */
+    struct VtColdBlockLine
+    {
+        uint32_t offset, cells;
+    } lines[VT_COLD_BLOCK_LINES];
+
+    uint8_t data[];
+} VtColdBlock;
+
+static inline void VtColdBlock_unref(VtColdBlock* self)
+{
+    if (!--self->refs) {
+        free(self->thawed);
+        free(self);
+    }
+}
+
+/**
+ * Interned sequences of combining characters. Each is stored in 'codes' as its length followed by
+ * the characters, cells refer to it by that position + 1. Found through an open addressing hash
+ * table of the same indices. Once 'codes' is larger than rebuild_size the table is rebuilt with
+ * only the sequences cells still use, which changes their indices. Glyphs do not depend on the
+ * combining characters, so glyph cache keys with old indices still get the right glyph */
+typedef struct
+{
+    Vector_char32_t codes;
+    uint32_t*       slots;
+    uint32_t        nslots, nclusters, rebuild_size;
+
+    /* Sequence added last if no lookup returned it since. Only the cell it was added for uses it,
+     * so it is removed when that cell gets another combining character */
+    uint32_t unshared;
+} VtClusterTable;
+
+/**
+ * Get the characters of @param cluster, valid until the next one is added */
+static inline const char32_t* VtClusterTable_get(const VtClusterTable* self,
+                                                 uint32_t              cluster,
+                                                 uint32_t*             out_len)
+{
+    const char32_t* codes = self->codes.buf + cluster - 1;
+    *out_len              = codes[0];
+    return codes + 1;
+}
+
+/**
+ * Deduplicated cell styles. Stored as VtRunes with no character, looked up through an open
+ * addressing hash table of indices + 1. Entries are never removed one by one, once the table is
+ * full it is rebuilt with only the styles compact lines still use */
+typedef struct
+{
+    Vector_VtRune styles;
+    uint32_t*     slots;
+    uint32_t      nslots;
+
+    /* maps style indices to block palette indices while a block is built, UINT32_MAX if unset */
+    uint32_t* palette_index;
+    uint32_t  npalette_index;
+} VtStyleTable;
+
 extern void (*Vt_destroy_line_proxy)(int32_t proxy[static 4]);
 
 typedef struct
@@ -126,6 +326,15 @@ typedef struct
     /* Characters */
     Vector_VtRune data;
 
+    /* Contents of a line moved to the scrollback, 'data' is empty while this is set */
+    VtCompactLine* compact;
+
+    /* Block holding the compressed contents of an old line, 'data' and 'compact' are empty while
+     * this is set. The row shows 'cold_cells' cells of the logical line from 'cold_begin' */
+    VtColdBlock* cold;
+    uint16_t     cold_index;
+    uint32_t     cold_begin, cold_cells;
+
     /* Arbitrary data used by the renderer */
     VtLineProxy proxy;
 
@@ -176,9 +385,208 @@ static inline void VtLine_destroy(VtLine* self)
         Vt_destroy_line_proxy(self->proxy.data);
 
     Vector_destroy_VtRune(&self->data);
+    VtCompactLine_unref(self->compact);
+
+    if (self->cold)
+        VtColdBlock_unref(self->cold);
 }
 
-DEF_VECTOR(VtLine, VtLine_destroy)
+/**
+ * Make a line empty, keeping the storage of its cells */
+static inline void VtLine_clear(VtLine* self)
+{
+    if (Vt_destroy_line_proxy)
+        Vt_destroy_line_proxy(self->proxy.data);
+
+    VtCompactLine_unref(self->compact);
+
+    if (self->cold)
+        VtColdBlock_unref(self->cold);
+
+    Vector_VtRune data = self->data.buf ? self->data : Vector_new_VtRune();
+    Vector_clear_VtRune(&data);
+
+    *self = (VtLine){
+        .data       = data,
+        .damage     = (struct VtLineDamage){ .type = VT_LINE_DAMAGE_FULL },
+        .reflowable = true,
+    };
+}
+
+/**
+ * Line storage. Lines are kept contiguous so ranges of them can be handed out as pointers, but the
+ * start of the range can move forward. Evicting the oldest lines only advances @param buf, the
+ * space in front of it is reclaimed by a single move once it is larger than the stored lines, so
+ * trimming the scrollback costs O(1) per line instead of moving the whole history */
+typedef struct
+{
+    size_t  cap, size;
+    VtLine* buf; /* first stored line */
+    VtLine* mem; /* start of the allocation */
+
+    /* Lines before these indices were already compacted/compressed */
+    size_t compacted, frozen;
+} VtLineBuffer;
+
+static inline VtLineBuffer VtLineBuffer_new()
+{
+    VtLine* mem = malloc(sizeof(VtLine) * 16);
+    return (VtLineBuffer){
+        .cap = 16, .size = 0, .buf = mem, .mem = mem, .compacted = 0, .frozen = 0
+    };
+}
+
+/**
+ * Make space for at least one line past the end */
+static inline void VtLineBuffer_make_room(VtLineBuffer* self)
+{
+    size_t evicted = self->buf - self->mem;
+
+    if (likely(evicted + self->size < self->cap))
+        return;
+
+    if (evicted && evicted >= self->size) {
+        memmove(self->mem, self->buf, self->size * sizeof(VtLine));
+        self->buf = self->mem;
+    } else {
+        self->mem = realloc(self->mem, (self->cap <<= 1) * sizeof(VtLine));
+        self->buf = self->mem + evicted;
+    }
+}
+
+static inline void VtLineBuffer_push(VtLineBuffer* self, VtLine line)
+{
+    ASSERT(self->mem, "VtLineBuffer not initialized");
+    VtLineBuffer_make_room(self);
+    self->buf[self->size++] = line;
+}
+
+static inline void VtLineBuffer_insert_at(VtLineBuffer* self, size_t idx, VtLine line)
+{
+    ASSERT(idx <= self->size, "VtLineBuffer index out of range");
+    VtLineBuffer_make_room(self);
+    self->compacted = MIN(self->compacted, idx);
+    self->frozen    = MIN(self->frozen, idx);
+    memmove(self->buf + idx + 1, self->buf + idx, (self->size++ - idx) * sizeof(VtLine));
+    self->buf[idx] = line;
+}
+
+static inline void VtLineBuffer_remove_at(VtLineBuffer* self, size_t idx, size_t n)
+{
+    ASSERT(idx + n <= self->size, "VtLineBuffer index out of range");
+    for (size_t i = idx; i < idx + n; ++i)
+        VtLine_destroy(self->buf + i);
+    self->compacted = MIN(self->compacted, idx);
+    self->frozen    = MIN(self->frozen, idx);
+    memmove(self->buf + idx, self->buf + idx + n, ((self->size -= n) - idx) * sizeof(VtLine));
+}
+
+static inline void VtLineBuffer_pop_n(VtLineBuffer* self, size_t n)
+{
+    for (size_t i = 0; i < n && self->size; ++i)
+        VtLine_destroy(self->buf + --self->size);
+    self->compacted = MIN(self->compacted, self->size);
+    self->frozen    = MIN(self->frozen, self->size);
+}
+
+/**
+ * Replace @param n lines at @param idx with @param nlines lines moved from @param lines */
+static inline void VtLineBuffer_splice(VtLineBuffer* self,
+                                       size_t        idx,
+                                       size_t        n,
+                                       const VtLine* lines,
+                                       size_t        nlines)
+{
+    ASSERT(idx + n <= self->size, "VtLineBuffer index out of range");
+
+    size_t evicted = self->buf - self->mem;
+    size_t size    = self->size - n + nlines;
+
+    if (evicted + size > self->cap) {
+        self->cap = MAX(self->cap * 2, evicted + size);
+        self->mem = realloc(self->mem, self->cap * sizeof(VtLine));
+        self->buf = self->mem + evicted;
+    }
+
+    memmove(self->buf + idx + nlines, self->buf + idx + n, (self->size - idx - n) * sizeof(VtLine));
+    memcpy(self->buf + idx, lines, nlines * sizeof(VtLine));
+    self->size      = size;
+    self->compacted = MIN(self->compacted, idx);
+    self->frozen    = MIN(self->frozen, idx);
+}
+
+/**
+ * Rotate lines in [@param begin, @param end) by one. The first line is moved to the end if
+ * @param up is set, otherwise the last one is moved to the front. Only the lines in the range are
+ * moved, so scrolling a region costs at most its height */
+static inline void VtLineBuffer_rotate(VtLineBuffer* self, size_t begin, size_t end, bool up)
+{
+    ASSERT(begin <= end && end <= self->size, "VtLineBuffer index out of range");
+
+    if (end - begin < 2)
+        return;
+
+    VtLine line;
+    if (up) {
+        line = self->buf[begin];
+        memmove(self->buf + begin, self->buf + begin + 1, (end - begin - 1) * sizeof(VtLine));
+        self->buf[end - 1] = line;
+    } else {
+        line = self->buf[end - 1];
+        memmove(self->buf + begin + 1, self->buf + begin, (end - begin - 1) * sizeof(VtLine));
+        self->buf[begin] = line;
+    }
+
+    self->compacted = MIN(self->compacted, begin);
+    self->frozen    = MIN(self->frozen, begin);
+}
+
+/**
+ * Drop @param n lines from the front */
+static inline void VtLineBuffer_evict_front(VtLineBuffer* self, size_t n)
+{
+    n = MIN(n, self->size);
+    for (size_t i = 0; i < n; ++i)
+        VtLine_destroy(self->buf + i);
+    self->buf += n;
+    self->size -= n;
+    self->compacted -= MIN(n, self->compacted);
+    self->frozen -= MIN(n, self->frozen);
+    if (!self->size)
+        self->buf = self->mem;
+}
+
+/**
+ * Add @param n lines in front of the first one. Returns the new lines, they are not initialized.
+ * The compacted/compressed hints are moved, so the new lines should not be expanded */
+static inline VtLine* VtLineBuffer_prepend(VtLineBuffer* self, size_t n)
+{
+    if ((size_t)(self->buf - self->mem) < n) {
+        size_t  cap   = MAX(self->cap * 2, (self->size + n) * 2);
+        size_t  front = n + (cap - self->size - n) / 2;
+        VtLine* mem   = malloc(cap * sizeof(VtLine));
+        memcpy(mem + front, self->buf, self->size * sizeof(VtLine));
+        free(self->mem);
+        self->mem = mem;
+        self->buf = mem + front;
+        self->cap = cap;
+    }
+
+    self->buf -= n;
+    self->size += n;
+    self->compacted += n;
+    self->frozen += n;
+    return self->buf;
+}
+
+static inline void VtLineBuffer_destroy(VtLineBuffer* self)
+{
+    for (size_t i = 0; i < self->size; ++i)
+        VtLine_destroy(self->buf + i);
+    free(self->mem);
+    self->buf = self->mem = NULL;
+    self->size = self->cap = self->compacted = self->frozen = 0;
+}
 
 typedef struct _Vt
 {
@@ -203,6 +611,15 @@ typedef struct _Vt
 
     } callbacks;
 
+    /* Set while interpreting a batch of input. Repaint and action callbacks are held back and
+     * sent once when the batch is done */
+    struct VtDeferredCallbacks
+    {
+        bool active;
+        bool repaint_required;
+        bool action_performed;
+    } deferred_callbacks;
+
     size_t last_click_x;
     size_t last_click_y;
     double pixels_per_cell_x, pixels_per_cell_y;
@@ -267,12 +684,41 @@ typedef struct _Vt
             PARSER_STATE_CHARSET_G3,
         } state;
 
-        bool      in_mb_seq;
-        mbstate_t input_mbstate;
+        /* UTF-8 decoder state, kept between reads */
+        uint32_t utf8_state;
+        char32_t utf8_codepoint;
 
         VtRune char_state; // records currently selected character properties
         bool   color_inverted;
 
+        /* Control sequence being received. Parameters are accumulated as the digits arrive */
+        struct VtParserCsi
+        {
+            enum VtParserCsiState
+            {
+                PARSER_CSI_STATE_ENTRY = 0,
+                PARSER_CSI_STATE_PARAM,
+                PARSER_CSI_STATE_INTERMEDIATE,
+
+                /* too many parameters, skip the rest until the final byte */
+                PARSER_CSI_STATE_DISCARD,
+                PARSER_CSI_STATE_IGNORE,
+            } state;
+
+            uint16_t params[VT_PARSER_CSI_MAX_PARAMS];
+
+            /* bit n is set if parameter n had any digits */
+            uint32_t params_set;
+
+            /* bit n is set if parameter n was separated from the previous one with ':' */
+            uint32_t params_sub;
+
+            uint8_t nparams;
+            char    private_marker;
+            char    intermediate;
+        } csi;
+
+        /* OSC, DCS, APC and PM payload */
         Vector_char active_sequence;
     } parser;
 
@@ -285,9 +731,40 @@ typedef struct _Vt
     char32_t (*charset_g2)(char);
     char32_t (*charset_g3)(char);
 
-    uint8_t tabstop;
+    /* Tab stops, one bit per column. Columns added by resizing get a stop every VT_TAB_WIDTH */
+    uint64_t* tab_stops;
+    uint32_t  tab_stops_cols;
+
+    VtLineBuffer lines, alt_lines;
+
+    /* Empty lines of the alternate screen while it is not shown, reused the next time it is */
+    VtLineBuffer spare_alt_lines;
+
+    /* Cell buffers of lines that were compacted or evicted, given to new lines so they start out
+     * with room for a full row */
+    Vector_VtRune cell_pool[VT_CELL_POOL_SIZE];
+    uint32_t      cell_pool_size;
+
+    /* Styles referenced by compacted lines */
+    VtStyleTable style_table;
+
+    /* Combining characters of cells */
+    VtClusterTable clusters;
 
-    Vector_VtLine lines, alt_lines;
+    /* Identical compacted lines, only used with settings.scrollback_dedup */
+    VtCompactLineTable line_table;
+
+    /* Recently decompressed scrollback blocks */
+    VtColdBlock* thaw_cache[VT_THAW_CACHE_SIZE];
+    uint8_t      thaw_cache_next;
+
+    /* Lines moved out of the scrollback with settings.scrollback_spill, oldest first. Each index
+     * entry is VT_SPILL_ENTRY() of the line */
+    Spill spill;
+
+    /* Vt_resize() only reflows the lines near the screen. Main buffer lines before this one may
+     * still be wrapped at some previous width and are reflowed in steps or when scrolled to */
+    size_t reflow_top;
 
     VtRune* last_interted;
 
@@ -320,6 +797,22 @@ typedef struct _Vt
 
 } Vt;
 
+/**
+ * Copy of the visible part of a Vt made at a frame boundary, so it can be drawn while the original
+ * keeps interpreting. 'view' only holds the visible rows, with the cursor and selection moved to
+ * match, and can be drawn like any other Vt. Rows own the renderer proxies, lines of the original
+ * never get any. Rows are only copied if their line was damaged or moved to another row */
+typedef struct
+{
+    Vt view;
+
+    /* Line of the original shown in the first row */
+    size_t top;
+
+    /* Cell storage of the line each row was last copied from */
+    const VtRune** sources;
+} VtSnapshot;
+
 /**
  * Make a new interpreter with a given size */
 Vt Vt_new(uint32_t cols, uint32_t rows);
@@ -394,6 +887,18 @@ static inline size_t Vt_visual_bottom_line(const Vt* const self)
     return self->ws.ws_row + Vt_visual_top_line(self) - 1;
 }
 
+/**
+ * History above the screen still needs to be reflowed to the current width */
+static inline bool Vt_is_reflow_pending(const Vt* const self)
+{
+    return self->reflow_top && !self->alt_lines.buf;
+}
+
+/**
+ * Reflow up to VT_REFLOW_STEP_LINES lines of history left over from the last resize. Returns true
+ * if there is more to do */
+bool Vt_reflow_history_step(Vt* self);
+
 void Vt_visual_scroll_to(Vt* self, size_t line);
 void Vt_visual_scroll_up(Vt* self);
 void Vt_visual_scroll_down(Vt* self);
@@ -403,6 +908,18 @@ void Vt_visual_scroll_reset(Vt* self);
  * Get a range of lines that should be visible */
 void Vt_get_visible_lines(const Vt* self, VtLine** out_begin, VtLine** out_end);
 
+VtSnapshot VtSnapshot_new();
+
+/**
+ * Bring the snapshot up to date with the visible lines of @param vt and take their damage */
+void VtSnapshot_update(VtSnapshot* self, Vt* vt);
+
+/**
+ * Destroy the proxies of all rows, so they are drawn again */
+void VtSnapshot_clear_proxies(VtSnapshot* self);
+
+void VtSnapshot_destroy(VtSnapshot* self);
+
 /**
  * Initialize selection region to word by pixel in screen coordinates */
 void Vt_select_init_word(Vt* self, int32_t x, int32_t y);
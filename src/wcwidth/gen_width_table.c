@@ -0,0 +1,118 @@
+/* See LICENSE for license information. */
+
+/**
+ * Generates the two-level character property table used by unicode_width() and
+ * unicode_is_combining() (see util.h) from the interval tables in wcwidth.c. Every codepoint maps
+ * to a byte with the wcwidth() result in the low two bits (3 for -1) and a combining flag.
+ * Codepoints are split into 256 character blocks, identical blocks are stored once.
+ *
+ * Also turns the pairs from compose_pairs.h into the hash table used by unicode_compose().
+ *
+ * usage: gen_width_table > unicode_table.c */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "compose_pairs.h"
+#include "wcwidth.h"
+
+#define CODEPOINT_MAX 0x110000
+#define BLOCK_SIZE    256
+#define BLOCK_COUNT   (CODEPOINT_MAX / BLOCK_SIZE)
+
+#define WIDTH_MASK     0x03
+#define COMBINING_FLAG 0x04
+
+/* Must match UNICODE_COMPOSE_SLOTS in util.h */
+#define COMPOSE_SLOTS 2048
+
+/* Ranges of combining characters that get attached to the preceding cell */
+static bool is_combining(uint32_t codepoint)
+{
+    return (codepoint >= 0x0300 && codepoint <= 0x036F) ||
+           (codepoint >= 0x1AB0 && codepoint <= 0x1AFF) ||
+           (codepoint >= 0x1DC0 && codepoint <= 0x1DFF) ||
+           (codepoint >= 0x20D0 && codepoint <= 0x20FF) ||
+           (codepoint >= 0xFE20 && codepoint <= 0xFE2F);
+}
+
+/* Must match unicode_compose_hash() in util.h */
+static uint32_t compose_hash(uint32_t base, uint32_t mark)
+{
+    return ((base * 0x9E3779B1u) ^ (mark * 0x85EBCA6Bu)) >> 21 & (COMPOSE_SLOTS - 1);
+}
+
+static uint8_t  blocks[BLOCK_COUNT][BLOCK_SIZE];
+static uint8_t  block_index[BLOCK_COUNT];
+static uint32_t compose_table[COMPOSE_SLOTS][3];
+
+int main(void)
+{
+    uint32_t nblocks = 0;
+
+    for (uint32_t b = 0; b < BLOCK_COUNT; ++b) {
+        uint8_t block[BLOCK_SIZE];
+
+        for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
+            uint32_t cp = b * BLOCK_SIZE + i;
+            block[i]    = (wcwidth(cp) & WIDTH_MASK) | (is_combining(cp) ? COMBINING_FLAG : 0);
+        }
+
+        uint32_t found;
+        for (found = 0; found < nblocks; ++found)
+            if (!memcmp(blocks[found], block, BLOCK_SIZE))
+                break;
+
+        if (found == nblocks) {
+            if (nblocks > UINT8_MAX) {
+                fprintf(stderr, "too many unique blocks\n");
+                return 1;
+            }
+            memcpy(blocks[nblocks++], block, BLOCK_SIZE);
+        }
+        block_index[b] = found;
+    }
+
+    printf("/* Generated by gen_width_table, do not edit */\n\n"
+           "#include <stdint.h>\n\n"
+           "const uint8_t unicode_table_index[%d] = {",
+           BLOCK_COUNT);
+    for (uint32_t b = 0; b < BLOCK_COUNT; ++b)
+        printf("%s%u,", b % 24 ? " " : "\n    ", block_index[b]);
+
+    printf("\n};\n\nconst uint8_t unicode_table_blocks[%u][%d] = {", nblocks, BLOCK_SIZE);
+    for (uint32_t b = 0; b < nblocks; ++b) {
+        printf("\n    {");
+        for (uint32_t i = 0; i < BLOCK_SIZE; ++i)
+            printf("%s%u,", i % 32 ? " " : "\n        ", blocks[b][i]);
+        printf("\n    },");
+    }
+    printf("\n};\n");
+
+    uint32_t npairs = sizeof(compose_pairs) / sizeof(*compose_pairs);
+    if (npairs > COMPOSE_SLOTS * 3 / 4) {
+        fprintf(stderr, "too many composition pairs\n");
+        return 1;
+    }
+
+    for (uint32_t p = 0; p < npairs; ++p) {
+        uint32_t i = compose_hash(compose_pairs[p][0], compose_pairs[p][1]);
+        while (compose_table[i][0])
+            i = (i + 1) & (COMPOSE_SLOTS - 1);
+        memcpy(compose_table[i], compose_pairs[p], sizeof(*compose_pairs));
+    }
+
+    printf("\nconst uint32_t unicode_compose_table[%d][3] = {", COMPOSE_SLOTS);
+    for (uint32_t i = 0; i < COMPOSE_SLOTS; ++i)
+        printf("%s{ %u, %u, %u },",
+               i % 8 ? " " : "\n    ",
+               compose_table[i][0],
+               compose_table[i][1],
+               compose_table[i][2]);
+    printf("\n};\n");
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+/* See LICENSE for license information. */
+
+/**
+ * Throughput of Vt_interpret() for a few kinds of generated program output. Built by 'make bench',
+ * pass the name of a workload to run only that one */
+
+#define _GNU_SOURCE
+
+#include "vt.h"
+
+#include <locale.h>
+#include <time.h>
+
+/* normally defined in settings.c */
+Settings settings;
+ColorRGB color_palette_256[257];
+
+#define BENCH_INPUT_SIZE (1 << 22)
+#define BENCH_READ_SIZE  4096
+#define BENCH_REPEATS    5
+
+static void noop_proxy(int32_t proxy[static 4]) {}
+
+static void noop(void* user_data) {}
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ * Plain text, like compiler or log output */
+static int make_ascii_line(char* out, uint32_t n)
+{
+    int len = 20 + n * 37 % 100, i;
+    for (i = 0; i < len; ++i)
+        out[i] = i % 9 ? 'a' + (i * 7 + n) % 26 : ' ';
+    return i + sprintf(out + i, "\r\n");
+}
+
+/**
+ * Short words that each set several attributes and colors, like colored 'ls' or syntax
+ * highlighted output */
+static int make_sgr_line(char* out, uint32_t n)
+{
+    int len = 0;
+    for (uint32_t i = 0; i < 12; ++i) {
+        len += sprintf(out + len,
+                       "\e[%u;38;5;%um%s\e[0m \e[38:2::%u:%u:%umx\e[48;2;1;2;3m",
+                       1 + i % 2,
+                       (n + i * 20) % 256,
+                       "word",
+                       i,
+                       i * 3,
+                       (n + i) % 256);
+    }
+    return len + sprintf(out + len, "\e[m\r\n");
+}
+
+/**
+ * Multi byte and double width characters */
+static int make_utf8_line(char* out, uint32_t n)
+{
+    int len = 0;
+    for (uint32_t i = 0; i < 30; ++i)
+        len += sprintf(out + len, (i + n) % 3 ? "漢字" : "😀é");
+    return len + sprintf(out + len, "\r\n");
+}
+
+/**
+ * Cursor movement and erasing, like a full screen program redrawing parts of the screen */
+static int make_csi_line(char* out, uint32_t n)
+{
+    int len = 0;
+    for (uint32_t i = 0; i < 20; ++i)
+        len += sprintf(out + len, "\e[%u;%uHab\e[K\e[2C", 1 + i, 1 + (i * 3 + n) % 150);
+    return len;
+}
+
+/**
+ * Output scrolled inside a region with a status line below it, like tmux or a split in vim */
+static int make_region_line(char* out, uint32_t n)
+{
+    int len = sprintf(out, "\e[1;48r\e[48;1H");
+    len += make_ascii_line(out + len, n) - 2;
+    len += sprintf(out + len, "\n\e[50;1Hstatus %u\e[K", n);
+    if (n % 8 == 0)
+        len += sprintf(out + len, "\e[10;1H\e[2M\e[20;1H\e[2L");
+    return len;
+}
+
+static const struct
+{
+    const char* name;
+    int (*make_line)(char* out, uint32_t n);
+} workloads[] = {
+    { "ascii", make_ascii_line },
+    { "sgr", make_sgr_line },
+    { "utf8", make_utf8_line },
+    { "csi", make_csi_line },
+    { "region", make_region_line },
+};
+
+static double run(const Vector_char* input)
+{
+    double best = 0;
+
+    for (uint32_t rep = 0; rep < BENCH_REPEATS; ++rep) {
+        Vt vt                            = Vt_new(200, 50);
+        vt.callbacks.on_repaint_required = noop;
+        vt.callbacks.on_action_performed = noop;
+
+        double begin = now();
+        for (size_t off = 0; off < input->size; off += BENCH_READ_SIZE)
+            Vt_interpret(&vt, input->buf + off, MIN(BENCH_READ_SIZE, input->size - off));
+        double t = now() - begin;
+
+        best = rep ? MIN(best, t) : t;
+        Vt_destroy(&vt);
+    }
+
+    return input->size / best / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    setlocale(LC_ALL, "C.UTF-8");
+    Vt_destroy_line_proxy = noop_proxy;
+    settings.scrollback   = 2000;
+    settings.fg           = (ColorRGB){ .r = 255, .g = 255, .b = 255 };
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(workloads); ++i) {
+        if (argc > 1 && strcmp(argv[1], workloads[i].name))
+            continue;
+
+        char        line[1024];
+        Vector_char input = Vector_new_with_capacity_char(BENCH_INPUT_SIZE + sizeof(line));
+        for (uint32_t n = 0; input.size < BENCH_INPUT_SIZE; ++n)
+            Vector_pushv_char(&input, line, workloads[i].make_line(line, n));
+
+        printf("%-8s %8.1f MB/s\n", workloads[i].name, run(&input));
+        Vector_destroy_char(&input);
+    }
+
+    return EXIT_SUCCESS;
+}
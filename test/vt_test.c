@@ -0,0 +1,993 @@
+/* See LICENSE for license information. */
+
+/**
+ * Regression tests for the terminal emulator core. Built with sanitizers by 'make test', most of
+ * the checks are done by them. */
+
+#define _GNU_SOURCE
+
+#include "utf8.h"
+#include "vt.h"
+
+#include <locale.h>
+
+/* normally defined in settings.c */
+Settings settings;
+ColorRGB color_palette_256[257];
+
+static uint32_t failed = 0;
+
+#define CHECK(_cond)                                                                               \
+    do {                                                                                           \
+        if (!(_cond)) {                                                                            \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __func__, __LINE__, #_cond);              \
+            ++failed;                                                                              \
+        }                                                                                          \
+    } while (0)
+
+static void noop_proxy(int32_t proxy[static 4]) {}
+
+static void noop(void* user_data) {}
+
+static void noop_title(void* user_data, const char* title) {}
+
+static char32_t char_sub_ascii(char c)
+{
+    return c;
+}
+
+static Pair_uint32_t window_size_from_cells(void* user_data, uint32_t cols, uint32_t rows)
+{
+    return (Pair_uint32_t){ .first = cols * 8, .second = rows * 16 };
+}
+
+static Pair_uint32_t number_of_cells(void* user_data)
+{
+    const Vt* vt = user_data;
+    return (Pair_uint32_t){ .first = vt->ws.ws_col, .second = vt->ws.ws_row };
+}
+
+static Vt make_vt(uint32_t cols, uint32_t rows, uint32_t scrollback)
+{
+    settings.scrollback = scrollback;
+    Vt vt               = Vt_new(cols, rows);
+    vt.callbacks.on_window_size_from_cells_requested = window_size_from_cells;
+    vt.callbacks.on_repaint_required                 = noop;
+    vt.callbacks.on_action_performed                 = noop;
+    return vt;
+}
+
+static void interpret(Vt* vt, const char* str)
+{
+    Vt_interpret(vt, (char*)str, strlen(str));
+}
+
+/**
+ * Check that row @param row holds the characters of @param expected and nothing else. The right
+ * halves of wide characters are skipped */
+static bool row_is(const Vt* vt, size_t row, const char32_t* expected)
+{
+    const Vector_VtRune* cells = &vt->lines.buf[row].data;
+    size_t               i     = 0;
+    for (; *expected; ++expected, ++i) {
+        if (i >= cells->size || cells->buf[i].rune.code != *expected)
+            return false;
+        if (cells->buf[i].wide)
+            ++i;
+    }
+    return i == cells->size;
+}
+
+/**
+ * Interpret @param input in a new terminal and check what the first row holds */
+static bool decodes_to(const char* input, const char32_t* expected)
+{
+    Vt vt = make_vt(20, 2, 0);
+    interpret(&vt, input);
+    bool ok = row_is(&vt, 0, expected);
+    Vt_destroy(&vt);
+    return ok;
+}
+
+/**
+ * Interpret @param input in two terminals, one going through the printable ascii fast path and one
+ * forced to insert every character on its own, and check they end up with the same cells */
+static bool same_as_per_char(Vt* fast, const char* input)
+{
+    Vt slow         = make_vt(fast->ws.ws_col, fast->ws.ws_row, settings.scrollback);
+    slow.modes      = fast->modes;
+    slow.charset_g1 = char_sub_ascii;
+    interpret(fast, input);
+    interpret(&slow, input);
+
+    bool ok = fast->lines.size == slow.lines.size && fast->cursor.row == slow.cursor.row &&
+              fast->cursor.col == slow.cursor.col;
+    for (size_t i = 0; ok && i < fast->lines.size; ++i) {
+        const VtLine* a = &fast->lines.buf[i];
+        const VtLine* b = &slow.lines.buf[i];
+        ok = a->rejoinable == b->rejoinable && a->data.size == b->data.size &&
+             !memcmp(a->data.buf, b->data.buf, a->data.size * sizeof(VtRune));
+    }
+
+    Vt_destroy(&slow);
+    return ok;
+}
+
+/**
+ * A combining character after the line it would combine with was moved to the scrollback */
+static void test_combining_after_scrolled_out_line()
+{
+    Vt vt = make_vt(10, 5, 1000);
+    interpret(&vt, "x\n\n\n\n\n\n\n\n");
+    interpret(&vt, "\xcc\x81");
+    CHECK(vt.lines.size == 9);
+    Vt_destroy(&vt);
+}
+
+/**
+ * Any number of combining characters up to VT_RUNE_MAX_COMBINE is kept with a cell, also after the
+ * line was compressed */
+static void test_combining_cluster()
+{
+    Vt vt = make_vt(10, 5, 10000);
+    interpret(&vt, "q\xcc\x81\xcc\x82\xcc\x83\xcc\x84x\xcc\x81\r\n");
+    for (uint32_t i = 0; i < 2000; ++i)
+        interpret(&vt, "line\r\n");
+
+    CHECK(vt.lines.buf[0].cold);
+    Vt_visual_scroll_to(&vt, 0);
+    CHECK(vt.lines.buf[0].data.size == 2);
+
+    uint32_t        len;
+    const Rune*     rune  = &vt.lines.buf[0].data.buf[0].rune;
+    const char32_t* codes = VtClusterTable_get(&vt.clusters, rune->cluster, &len);
+    CHECK(rune->code == 'q' && len == 4 && codes[0] == 0x301 && codes[3] == 0x304);
+
+    rune  = &vt.lines.buf[0].data.buf[1].rune;
+    codes = VtClusterTable_get(&vt.clusters, rune->cluster, &len);
+    CHECK(rune->code == 'x' && len == 1 && codes[0] == 0x301);
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Combining characters that have a precomposed form replace the base character, one after another.
+ * Marks after one that did not compose are kept in order */
+static void test_combining_compose()
+{
+    Vt vt = make_vt(10, 5, 0);
+    interpret(&vt, "e\xcc\x81" "a\xcc\x82\xcc\x81" "o\xcc\x81\xcc\x82" "\xe2\x89\xa0\xcd\x81");
+
+    const VtLine* line = &vt.lines.buf[0];
+    CHECK(line->data.size == 4);
+    CHECK(line->data.buf[0].rune.code == 0xE9 && !line->data.buf[0].rune.cluster);
+    CHECK(line->data.buf[1].rune.code == 0x1EA5 && !line->data.buf[1].rune.cluster);
+
+    uint32_t        len;
+    const char32_t* codes = VtClusterTable_get(&vt.clusters, line->data.buf[2].rune.cluster, &len);
+    CHECK(line->data.buf[2].rune.code == 0xF3 && len == 1 && codes[0] == 0x302);
+
+    /* '≠' followed by U+0341, which NFC replaces with U+0301 */
+    CHECK(line->data.buf[3].rune.code == 0x2260 && line->data.buf[3].rune.cluster);
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Marks of cell @param n of test_cluster_table_reclaimed(), no two cells share them */
+static void cluster_table_marks(uint32_t n, char32_t marks[static 3])
+{
+    marks[0] = 0x300 + n % 48;
+    marks[1] = 0x300 + n / 48 % 48;
+    marks[2] = 0x300 + n / (48 * 48) % 48;
+}
+
+/**
+ * Adding marks to a cell does not leave the shorter sequences in the cluster table, and sequences
+ * no cell uses anymore are dropped when the table is rebuilt or the terminal is reset */
+static void test_cluster_table_reclaimed()
+{
+    Vt vt                                     = make_vt(20, 5, 100);
+    vt.callbacks.user_data                    = &vt;
+    vt.callbacks.on_number_of_cells_requested = number_of_cells;
+    interpret(&vt, "q\xcc\x80\xcc\x81\xcc\x82\xcc\x83\xcc\x84\xcc\x85\xcc\x86\xcc\x87");
+    interpret(&vt, "x\xcc\x80\xcc\x81\xcc\x82\xcc\x83\xcc\x84\xcc\x85\xcc\x86\xcc\x87");
+    CHECK(vt.clusters.nclusters == 1);
+    CHECK(vt.lines.buf[0].data.buf[0].rune.cluster == vt.lines.buf[0].data.buf[1].rune.cluster);
+
+    uint32_t n = 0;
+    for (uint32_t row = 0; row < 10000; ++row) {
+        char  buf[20 * 7 + 2];
+        char* out = buf;
+        for (uint32_t i = 0; i < vt.ws.ws_col; ++i, ++n) {
+            char32_t marks[3];
+            cluster_table_marks(n, marks);
+            *out++ = 'q';
+            for (uint32_t j = 0; j < 3; ++j)
+                out += utf8_encode(marks[j], out);
+        }
+        *out++ = '\r';
+        *out++ = '\n';
+        Vt_interpret(&vt, buf, out - buf);
+    }
+
+    CHECK(n == 200000);
+    CHECK(vt.clusters.codes.size <= VT_CLUSTER_TABLE_REBUILD + 20 * 4);
+    CHECK(vt.clusters.nclusters <= VT_CLUSTER_TABLE_REBUILD / 4 + 20);
+
+    /* cells still have their own marks */
+    const VtLine* line = &vt.lines.buf[vt.lines.size - 2];
+    for (uint32_t i = 0; i < vt.ws.ws_col; ++i) {
+        char32_t marks[3];
+        cluster_table_marks(n - vt.ws.ws_col + i, marks);
+
+        uint32_t        len, cluster = line->data.buf[i].rune.cluster;
+        const char32_t* codes = VtClusterTable_get(&vt.clusters, cluster, &len);
+        CHECK(len == 3 && !memcmp(codes, marks, sizeof(marks)));
+    }
+
+    /* typing them again finds the same entries, removing sequences kept the hash table intact */
+    uint32_t nclusters = vt.clusters.nclusters;
+    for (uint32_t i = 0; i < vt.ws.ws_col; ++i) {
+        char     buf[8] = "q";
+        char32_t marks[3];
+        size_t   len = 1;
+        cluster_table_marks(n - vt.ws.ws_col + i, marks);
+        for (uint32_t j = 0; j < 3; ++j)
+            len += utf8_encode(marks[j], buf + len);
+        Vt_interpret(&vt, buf, len);
+
+        const VtRune* cell = &vt.lines.buf[vt.cursor.row].data.buf[i];
+        CHECK(cell->rune.cluster == line->data.buf[i].rune.cluster);
+    }
+    CHECK(vt.clusters.nclusters == nclusters);
+
+    interpret(&vt, "\ec");
+    CHECK(vt.clusters.nclusters == 0 && vt.clusters.codes.size == 0);
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Tabs move to the next stop, stops can be set and cleared. Columns added by resizing get the
+ * default stops */
+static void test_tab_stops()
+{
+    Vt vt = make_vt(30, 5, 0);
+
+    interpret(&vt, "ab\t");
+    CHECK(vt.cursor.col == 8);
+    interpret(&vt, "\e[2I");
+    CHECK(vt.cursor.col == 24);
+    interpret(&vt, "\t\t");
+    CHECK(vt.cursor.col == 29);
+    interpret(&vt, "\e[Z");
+    CHECK(vt.cursor.col == 24);
+    interpret(&vt, "\e[100Z");
+    CHECK(vt.cursor.col == 0);
+
+    interpret(&vt, "\e[3G\eH\e[13G\eH\e[17G\e[g\r\t");
+    CHECK(vt.cursor.col == 2);
+    interpret(&vt, "\t\t");
+    CHECK(vt.cursor.col == 12);
+    interpret(&vt, "\t");
+    CHECK(vt.cursor.col == 24);
+
+    interpret(&vt, "\e[3g\r\t");
+    CHECK(vt.cursor.col == 29);
+
+    Vt_resize(&vt, 100, 5);
+    interpret(&vt, "\r\t");
+    CHECK(vt.cursor.col == 32);
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Same as above, but the line is dropped right away because there is no scrollback */
+static void test_combining_after_evicted_line()
+{
+    Vt vt = make_vt(10, 5, 0);
+    interpret(&vt, "x\n\n\n\n\n\n\n\n");
+    interpret(&vt, "\xcc\x81");
+    CHECK(vt.lines.size == 5);
+    Vt_destroy(&vt);
+}
+
+/**
+ * More distinct styles go through the scrollback than the style table can index. Lines should
+ * still be compacted and keep their colors */
+static void test_style_table_reclaimed()
+{
+    Vt   vt = make_vt(10, 5, 100000);
+    char buf[64];
+
+    for (uint32_t i = 0; i < 70000; ++i) {
+        int len = snprintf(buf,
+                           sizeof(buf),
+                           "\e[38;2;%u;%u;%umx\r\n",
+                           i & 0xff,
+                           (i >> 8) & 0xff,
+                           (i >> 16) & 0xff);
+        Vt_interpret(&vt, buf, len);
+    }
+
+    size_t last_in_scrollback = vt.lines.size - vt.ws.ws_row - 1;
+    CHECK(vt.lines.buf[last_in_scrollback].compact || vt.lines.buf[last_in_scrollback].cold);
+    CHECK(vt.style_table.styles.size <= UINT16_MAX + 1);
+
+    /* line 'i' was written with color 'i' */
+    for (size_t i = 1000; i <= 69000; i += 17000) {
+        Vt_visual_scroll_to(&vt, i);
+        CHECK(vt.lines.buf[i].data.size && vt.lines.buf[i].data.buf[0].rune.code == 'x');
+        CHECK(vt.lines.buf[i].data.buf[0].fg.r == (i & 0xff));
+        CHECK(vt.lines.buf[i].data.buf[0].fg.g == ((i >> 8) & 0xff));
+        CHECK(vt.lines.buf[i].data.buf[0].fg.b == ((i >> 16) & 0xff));
+    }
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Identical scrollback lines share their compact cells. Expanding one of them leaves the others
+ * as they were, including after the style table was rebuilt */
+static void test_scrollback_dedup()
+{
+    settings.scrollback_dedup = true;
+    Vt   vt                   = make_vt(10, 5, 200000);
+    char buf[64];
+
+    for (uint32_t i = 0; i < 70000; ++i) {
+        int len = snprintf(buf,
+                           sizeof(buf),
+                           "\e[38;2;%u;%u;%umx\r\n\e[38;2;9;8;7m--\r\n",
+                           i & 0xff,
+                           (i >> 8) & 0xff,
+                           (i >> 16) & 0xff);
+        Vt_interpret(&vt, buf, len);
+    }
+    settings.scrollback_dedup = false;
+
+    size_t last = vt.lines.size - vt.ws.ws_row - 1;
+    CHECK(vt.lines.buf[last].compact);
+    CHECK(vt.lines.buf[last].compact == vt.lines.buf[last - 2].compact);
+    CHECK(vt.line_table.shared >= 69000);
+
+    Vt_visual_scroll_to(&vt, last - 6);
+    CHECK(!vt.lines.buf[last - 2].compact && vt.lines.buf[last].compact);
+    CHECK(vt.lines.buf[last - 2].data.size == 2);
+    CHECK(vt.lines.buf[last - 2].data.buf[1].rune.code == '-');
+
+    for (size_t i = 1000; i <= 130000; i += 43000) {
+        Vt_visual_scroll_to(&vt, i);
+        CHECK(vt.lines.buf[i].data.size && vt.lines.buf[i].data.buf[0].rune.code == 'x');
+        CHECK(vt.lines.buf[i].data.buf[0].fg.r == (i / 2 & 0xff));
+        CHECK(vt.lines.buf[i + 1].data.size && vt.lines.buf[i + 1].data.buf[0].rune.code == '-');
+        CHECK(vt.lines.buf[i + 1].data.buf[0].fg.r == 9);
+    }
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Changing the width joins wrapped lines, lines that do not change stay compact */
+static void test_resize_keeps_history_compact()
+{
+    Vt vt = make_vt(10, 5, 1000);
+    interpret(&vt, "0123456789abcde\r\n");
+    for (uint32_t i = 0; i < 20; ++i) {
+        interpret(&vt, "line\r\n");
+    }
+
+    size_t lines = vt.lines.size;
+    CHECK(vt.lines.buf[0].compact || vt.lines.buf[0].cold);
+
+    Vt_resize(&vt, 40, 5);
+
+    /* too far from the screen to be reflowed right away */
+    CHECK(vt.lines.size == lines);
+    CHECK(Vt_is_reflow_pending(&vt));
+
+    Vt_visual_scroll_to(&vt, 0);
+    CHECK(!Vt_is_reflow_pending(&vt));
+    CHECK(vt.lines.size == lines - 1);
+    CHECK(vt.lines.buf[5].compact || vt.lines.buf[5].cold);
+    CHECK(vt.lines.buf[0].data.size == 15);
+    CHECK(vt.lines.buf[0].data.buf[14].rune.code == 'e');
+    CHECK(vt.lines.buf[1].data.size == 4);
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * History far from the screen is reflowed in steps after a resize. The width changes again before
+ * that is done, so lines are left wrapped at different widths */
+static void test_resize_reflows_history_in_steps()
+{
+    Vt vt = make_vt(10, 5, 100000);
+    for (uint32_t i = 0; i < 10000; ++i) {
+        interpret(&vt, "0123456789abcde\r\n");
+    }
+
+    Vt_resize(&vt, 20, 5);
+    CHECK(Vt_is_reflow_pending(&vt));
+    for (uint32_t i = 0; i < 2 && Vt_reflow_history_step(&vt); ++i)
+        ;
+    Vt_resize(&vt, 8, 5);
+    Vt_resize(&vt, 6, 5);
+    Vt_resize(&vt, 8, 5);
+
+    while (Vt_reflow_history_step(&vt))
+        ;
+
+    CHECK(vt.lines.size == 20000 + 1);
+    for (size_t i = 0; i < 20000; i += 2) {
+        if (!(i % 4))
+            Vt_visual_scroll_to(&vt, i);
+        CHECK(!vt.lines.buf[i].rejoinable && vt.lines.buf[i + 1].rejoinable);
+        CHECK(vt.lines.buf[i].data.size == 8 && vt.lines.buf[i + 1].data.size == 7);
+        CHECK(vt.lines.buf[i + 1].data.size && vt.lines.buf[i + 1].data.buf[0].rune.code == '8');
+    }
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Rows wrapped from one logical line are compressed as one line, reflowing them only changes
+ * which part of it each row shows */
+static void test_resize_reslices_frozen_lines()
+{
+    Vt   vt = make_vt(10, 5, 100000);
+    char buf[32];
+    for (uint32_t i = 0; i < 2000; ++i) {
+        int len = snprintf(buf, sizeof(buf), "%04u abcdefghijklmnopqrst\r\n", i);
+        Vt_interpret(&vt, buf, len);
+    }
+
+    CHECK(vt.lines.size == 6000 + 1);
+    CHECK(vt.lines.buf[0].cold && vt.lines.buf[2].cold == vt.lines.buf[0].cold);
+    CHECK(vt.lines.buf[2].cold_index == vt.lines.buf[0].cold_index);
+    CHECK(vt.lines.buf[2].cold_begin == 20 && vt.lines.buf[2].cold_cells == 5);
+
+    Vt_resize(&vt, 7, 5);
+    while (Vt_reflow_history_step(&vt))
+        ;
+
+    CHECK(vt.lines.size == 8000 + 1);
+    CHECK(vt.lines.buf[3].cold && vt.lines.buf[3].cold_begin == 21);
+    CHECK(vt.lines.buf[3].cold_cells == 4 && !vt.lines.buf[3].was_reflown);
+    CHECK(vt.lines.buf[4].cold_begin == 0 && !vt.lines.buf[4].rejoinable);
+
+    Vt_resize(&vt, 30, 5);
+    while (Vt_reflow_history_step(&vt))
+        ;
+
+    CHECK(vt.lines.size == 2000 + 1);
+    for (uint32_t i = 0; i < 2000; i += 97) {
+        Vt_visual_scroll_to(&vt, i);
+        VtLine* line = &vt.lines.buf[i];
+        snprintf(buf, sizeof(buf), "%04u abcdefghijklmnopqrst", i);
+        CHECK(line->data.size == strlen(buf));
+        for (size_t j = 0; j < line->data.size && j < strlen(buf); ++j)
+            CHECK(line->data.buf[j].rune.code == (char32_t)buf[j]);
+    }
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Scrolling inside a region moves only the lines in it. Scrolling down with the default region
+ * used to read past the last line */
+static void test_scroll_region()
+{
+    Vt vt = make_vt(10, 5, 1000);
+    interpret(&vt, "h0\r\nh1\r\nh2\r\nh3\r\nh4\r\nh5\r\na\r\nb\r\nc\r\nd\r\ne");
+
+    size_t lines = vt.lines.size, top = lines - 5;
+    interpret(&vt, "\e[T");
+    CHECK(vt.lines.buf[top].data.size == 0 && vt.lines.buf[top + 4].data.buf[0].rune.code == 'd');
+
+    /* region is rows 2-4 */
+    interpret(&vt, "\e[2;4r\e[4;1H\nx\e[2;1H\e[M");
+    CHECK(vt.lines.size == lines);
+    CHECK(vt.lines.buf[top + 1].data.buf[0].rune.code == 'c');
+    CHECK(vt.lines.buf[top + 2].data.buf[0].rune.code == 'x');
+    CHECK(vt.lines.buf[top + 3].data.size == 0);
+    CHECK(vt.lines.buf[top + 4].data.buf[0].rune.code == 'd');
+
+    Vt_visual_scroll_to(&vt, 0);
+    CHECK(vt.lines.buf[0].data.size && vt.lines.buf[0].data.buf[1].rune.code == '0');
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * The alternate screen keeps its lines and cells when it is left, entering it again reuses them
+ * and starts out blank */
+static void test_alt_screen_reused()
+{
+    Vt vt = make_vt(10, 5, 1000);
+    interpret(&vt, "main\e[?1049h\e[3;1Halt");
+
+    VtLine* alt_lines = vt.lines.buf;
+    VtRune* alt_cells = vt.lines.buf[2].data.buf;
+    interpret(&vt, "\e[?1049l");
+    CHECK(vt.lines.buf[0].data.buf[0].rune.code == 'm');
+
+    interpret(&vt, "\e[?1049h");
+    CHECK(vt.lines.buf == alt_lines && vt.lines.buf[2].data.buf == alt_cells);
+    CHECK(vt.lines.size == 5 && vt.lines.buf[2].data.size == 0);
+
+    interpret(&vt, "x\e[?1049l");
+    CHECK(vt.lines.buf[0].data.buf[0].rune.code == 'm');
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Erasing with the default background shortens the line, with another one the erased cells keep
+ * it. Erasing past the end of a line pads it with blank space */
+static void test_erase()
+{
+    Vt vt = make_vt(10, 5, 1000);
+    interpret(&vt, "abcdef\e[4G\e[K");
+    CHECK(vt.lines.buf[0].data.size == 3 && vt.lines.buf[0].data.buf[2].rune.code == 'c');
+
+    interpret(&vt, "\e[41m\e[2G\e[K");
+    CHECK(vt.lines.buf[0].data.size == 11);
+    CHECK(vt.lines.buf[0].data.buf[0].rune.code == 'a');
+    CHECK(!ColorRGBA_eq(vt.lines.buf[0].data.buf[1].bg, settings.bg));
+    CHECK(!ColorRGBA_eq(vt.lines.buf[0].data.buf[10].bg, settings.bg));
+
+    interpret(&vt, "\r\n\e[6G\e[2X");
+    CHECK(vt.lines.buf[1].data.size == 7);
+    CHECK(ColorRGBA_eq(vt.lines.buf[1].data.buf[4].bg, settings.bg));
+    CHECK(!ColorRGBA_eq(vt.lines.buf[1].data.buf[5].bg, settings.bg));
+
+    interpret(&vt, "\e[m\e[6G\e[1K");
+    CHECK(vt.lines.buf[1].data.size == 7);
+    CHECK(ColorRGBA_eq(vt.lines.buf[1].data.buf[5].bg, settings.bg));
+    CHECK(!ColorRGBA_eq(vt.lines.buf[1].data.buf[6].bg, settings.bg));
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Control sequence with more parameters than are stored. The ones that fit are used, the rest
+ * are skipped */
+static void test_csi_too_many_params()
+{
+    Vt vt = make_vt(10, 5, 1000);
+    interpret(&vt,
+              "\e[0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;0;1;4;4;4mx");
+
+    VtRune* rune = &vt.lines.buf[vt.cursor.row].data.buf[0];
+    CHECK(rune->rune.code == 'x');
+    CHECK(rune->rune.style == VT_RUNE_BOLD);
+    CHECK(!rune->underlined);
+    CHECK(vt.parser.state == PARSER_STATE_LITERAL);
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * OSC is terminated by BEL or ST. The backslash of ST is not printed */
+static void test_osc_terminators()
+{
+    Vt vt                         = make_vt(10, 5, 1000);
+    vt.callbacks.on_title_changed = noop_title;
+
+    interpret(&vt, "\e]2;one\a");
+    CHECK(vt.title && !strcmp(vt.title, "one"));
+    CHECK(vt.parser.state == PARSER_STATE_LITERAL);
+
+    interpret(&vt, "\e]2;two\e\\x");
+    CHECK(vt.title && !strcmp(vt.title, "two"));
+    CHECK(vt.parser.state == PARSER_STATE_LITERAL);
+    CHECK(row_is(&vt, 0, U"x"));
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * CAN and SUB abort a sequence without dispatching it, what follows is printed */
+static void test_sequence_cancelled()
+{
+    Vt vt                         = make_vt(10, 5, 1000);
+    vt.callbacks.on_title_changed = noop_title;
+
+    interpret(&vt, "\e[1\x18mA");
+    CHECK(vt.parser.state == PARSER_STATE_LITERAL);
+    CHECK(row_is(&vt, 0, U"mA"));
+    CHECK(vt.lines.buf[0].data.buf[1].rune.style == VT_RUNE_NORMAL);
+
+    interpret(&vt, "\r\n\e]2;title\x1a" "b");
+    CHECK(!vt.title);
+    CHECK(row_is(&vt, 1, U"b"));
+
+    interpret(&vt, "\r\n\eP1$q\x18" "c\e[4\x1a" "d");
+    CHECK(row_is(&vt, 2, U"cd"));
+    CHECK(!vt.lines.buf[2].data.buf[1].underlined);
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * A bare ESC ends a DCS, APC or PM string and begins the next sequence. The string is not
+ * printed */
+static void test_command_string_escape()
+{
+    static const char* introducers[] = { "\eP", "\e_", "\e^" };
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(introducers); ++i) {
+        Vt vt = make_vt(10, 5, 1000);
+        interpret(&vt, introducers[i]);
+        interpret(&vt, "hidden\e[1my");
+        CHECK(vt.parser.state == PARSER_STATE_LITERAL);
+        CHECK(row_is(&vt, 0, U"y"));
+        CHECK(vt.lines.buf[0].data.buf[0].rune.style == VT_RUNE_BOLD);
+        Vt_destroy(&vt);
+    }
+}
+
+/**
+ * Private marker and intermediate bytes select a different sequence than the final byte alone. A
+ * marker after the parameters makes the sequence invalid */
+static void test_csi_marker_and_intermediate()
+{
+    Vt vt = make_vt(10, 5, 1000);
+
+    interpret(&vt, "\e[?25l");
+    CHECK(vt.cursor.hidden);
+    interpret(&vt, "\e[?25h");
+    CHECK(!vt.cursor.hidden);
+
+    interpret(&vt, "\e[>c");
+    CHECK(vt.output.size == 9 && !memcmp(vt.output.buf, "\e[>0;0;0c", 9));
+
+    interpret(&vt, "\e[5 q");
+    CHECK(vt.parser.csi.intermediate == ' ');
+    CHECK(vt.cursor.type == CURSOR_BEAM && vt.cursor.blinking);
+
+    interpret(&vt, "\e[?1m\e[1#{\e[1?m");
+    CHECK(vt.parser.state == PARSER_STATE_LITERAL);
+    CHECK(vt.parser.char_state.rune.style == VT_RUNE_NORMAL);
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * C0 controls in the middle of a control sequence are executed, the sequence continues after
+ * them */
+static void test_csi_executes_controls()
+{
+    Vt vt = make_vt(10, 5, 1000);
+
+    interpret(&vt, "ab\e[\b1mx");
+    CHECK(row_is(&vt, 0, U"ax"));
+    CHECK(vt.lines.buf[0].data.buf[1].rune.style == VT_RUNE_BOLD);
+
+    interpret(&vt, "\e[1;1H\e[3\nC");
+    CHECK(vt.cursor.row == 1 && vt.cursor.col == 3);
+    CHECK(vt.parser.state == PARSER_STATE_LITERAL);
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * A run of printable characters longer than the line wraps the same way single characters do, the
+ * continuation lines are rejoinable */
+static void test_ascii_run_wraps()
+{
+    Vt vt = make_vt(10, 5, 1000);
+    CHECK(same_as_per_char(&vt, "0123456789abcdefghijklmnopqrstuvwxyz"));
+    CHECK(!vt.lines.buf[0].rejoinable);
+    CHECK(vt.lines.buf[1].rejoinable && vt.lines.buf[2].rejoinable && vt.lines.buf[3].rejoinable);
+    CHECK(row_is(&vt, 1, U"abcdefghij"));
+    CHECK(row_is(&vt, 3, U"uvwxyz"));
+    CHECK(vt.cursor.row == 3 && vt.cursor.col == 6);
+
+    Vt_destroy(&vt);
+
+    /* a run that ends exactly at the margin only wraps once the next run arrives */
+    vt = make_vt(10, 5, 1000);
+    CHECK(same_as_per_char(&vt, "0123456789\e[mx"));
+    CHECK(row_is(&vt, 0, U"0123456789") && row_is(&vt, 1, U"x"));
+    CHECK(vt.lines.buf[1].rejoinable);
+    Vt_destroy(&vt);
+}
+
+/**
+ * Without auto wrap every character past the margin overwrites the last column, with the same
+ * attributes as the rest of the run */
+static void test_ascii_run_no_auto_wrap()
+{
+    Vt vt                 = make_vt(10, 5, 1000);
+    vt.modes.no_auto_wrap = true;
+    CHECK(same_as_per_char(&vt, "\e[38;2;1;2;3;7m0123456789abc"));
+    CHECK(row_is(&vt, 0, U"012345678c"));
+    const ColorRGBA inverted = { .r = 1, .g = 2, .b = 3, .a = 255 };
+    CHECK(ColorRGBA_eq(vt.lines.buf[0].data.buf[9].bg, inverted));
+    CHECK(vt.cursor.row == 0 && vt.cursor.col == 10);
+    CHECK(!vt.lines.buf[1].rejoinable && !vt.lines.buf[1].data.size);
+    Vt_destroy(&vt);
+}
+
+/**
+ * Characters are translated while DEC special graphics are designated to G0, the fast path is only
+ * used again once ascii is selected */
+static void test_ascii_run_dec_graphics()
+{
+    Vt vt = make_vt(10, 5, 1000);
+    interpret(&vt, "\e(0lqqk\e(Bab");
+    CHECK(row_is(&vt, 0, U"┌──┐ab"));
+    CHECK(!vt.charset_g0);
+    Vt_destroy(&vt);
+}
+
+/**
+ * Inverted colors are applied to every character of the run */
+static void test_ascii_run_inverted()
+{
+    Vt vt = make_vt(10, 5, 1000);
+    CHECK(same_as_per_char(&vt, "\e[38;2;1;2;3;48;2;4;5;6;7mxyz0123456789"));
+
+    const VtRune* cell = &vt.lines.buf[1].data.buf[2];
+    CHECK(cell->rune.code == '9');
+    CHECK(ColorRGB_eq(cell->fg, (ColorRGB){ .r = 4, .g = 5, .b = 6 }));
+    CHECK(ColorRGBA_eq(cell->bg, (ColorRGBA){ .r = 1, .g = 2, .b = 3, .a = 255 }));
+    Vt_destroy(&vt);
+}
+
+/**
+ * Color and underline parameters of SGR, separated by ';' and ':'. Missing arguments leave the
+ * attributes as they were */
+static void test_sgr()
+{
+    color_palette_256[100] = (ColorRGB){ .r = 1, .g = 2, .b = 3 };
+    color_palette_256[200] = (ColorRGB){ .r = 4, .g = 5, .b = 6 };
+
+    Vt            vt    = make_vt(10, 5, 1000);
+    const VtRune* state = &vt.parser.char_state;
+
+    interpret(&vt, "\e[38;5;100m");
+    CHECK(ColorRGB_eq(state->fg, color_palette_256[100]));
+
+    interpret(&vt, "\e[48;2;10;20;30m");
+    CHECK(ColorRGBA_eq(state->bg, (ColorRGBA){ .r = 10, .g = 20, .b = 30, .a = 255 }));
+    CHECK(ColorRGB_eq(state->fg, color_palette_256[100]));
+
+    interpret(&vt, "\e[0m\e[38:2::40:50:60;1m");
+    CHECK(ColorRGB_eq(state->fg, (ColorRGB){ .r = 40, .g = 50, .b = 60 }));
+    CHECK(state->rune.style == VT_RUNE_BOLD);
+
+    interpret(&vt, "\e[0m\e[58:5:200m");
+    CHECK(state->linecolornotdefault);
+    CHECK(ColorRGB_eq(state->line, color_palette_256[200]));
+    CHECK(ColorRGB_eq(state->fg, settings.fg));
+
+    interpret(&vt, "\e[0m\e[4:3m");
+    CHECK(state->curlyunderline && !state->underlined);
+    CHECK(state->rune.style == VT_RUNE_NORMAL);
+
+    interpret(&vt, "\e[0m\e[4;3m");
+    CHECK(!state->curlyunderline && state->underlined);
+    CHECK(state->rune.style == VT_RUNE_ITALIC);
+
+    /* the empty parameter is a 0 and resets italic before bold is set */
+    interpret(&vt, "\e[;1m");
+    CHECK(state->rune.style == VT_RUNE_BOLD);
+    CHECK(!state->underlined);
+
+    const ColorRGB rgb = { .r = 7, .g = 8, .b = 9 };
+    interpret(&vt, "\e[0m\e[38;2;7;8;9m\e[38;5m");
+    CHECK(ColorRGB_eq(state->fg, rgb));
+    CHECK(vt.parser.state == PARSER_STATE_LITERAL);
+
+    interpret(&vt, "x");
+    CHECK(ColorRGB_eq(vt.lines.buf[vt.cursor.row].data.buf[0].fg, rgb));
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Sequences split between reads are decoded once the rest arrives */
+static void test_utf8_split()
+{
+    Vt vt = make_vt(20, 2, 0);
+    interpret(&vt, "a\xe6\xbc");
+    CHECK(row_is(&vt, 0, U"a"));
+    interpret(&vt, "\xa2\xf0");
+    interpret(&vt, "\x9f");
+    interpret(&vt, "\x98\x80" "b");
+    CHECK(row_is(&vt, 0, U"a\u6f22\U0001f600b"));
+    CHECK(vt.parser.utf8_state == UTF8_ACCEPT);
+    Vt_destroy(&vt);
+}
+
+/**
+ * Each maximal subpart of an invalid or truncated sequence becomes one U+FFFD, a byte that ends a
+ * sequence early is decoded again */
+static void test_utf8_invalid()
+{
+    CHECK(decodes_to("a\x80" "b", U"a\ufffdb"));
+    CHECK(decodes_to("\xbf\xff\xfe", U"\ufffd\ufffd\ufffd"));
+    CHECK(decodes_to("\xe6\xbc" "x", U"\ufffdx"));
+    CHECK(decodes_to("\xf0\x9f\x98" "x", U"\ufffdx"));
+    CHECK(decodes_to("\xe6\xbc\xe6\xbc\xa2", U"\ufffd\u6f22"));
+    CHECK(decodes_to("\xf0\x9f\x98\e[1mx", U"\ufffdx"));
+    /* the control character is still executed */
+    CHECK(decodes_to("\xc3\r" "x", U"x"));
+}
+
+/**
+ * Overlong forms, surrogates and values past U+10FFFF are not characters. Each byte that can not
+ * begin or continue a valid sequence is replaced on its own */
+static void test_utf8_rejected_forms()
+{
+    CHECK(decodes_to("\xc0\xaf", U"\ufffd\ufffd"));
+    CHECK(decodes_to("\xc1\xbf", U"\ufffd\ufffd"));
+    CHECK(decodes_to("\xe0\x80\xaf", U"\ufffd\ufffd\ufffd"));
+    CHECK(decodes_to("\xf0\x80\x80\xaf", U"\ufffd\ufffd\ufffd\ufffd"));
+    CHECK(decodes_to("\xed\xa0\x80", U"\ufffd\ufffd\ufffd"));
+    CHECK(decodes_to("\xed\xbf\xbf", U"\ufffd\ufffd\ufffd"));
+    CHECK(decodes_to("\xf4\x90\x80\x80", U"\ufffd\ufffd\ufffd\ufffd"));
+    CHECK(decodes_to("\xf5\x80", U"\ufffd\ufffd"));
+
+    /* the smallest and largest of each length are fine */
+    CHECK(decodes_to("\xc2\x80\xdf\xbf", (const char32_t[]){ 0x80, 0x7ff, 0 }));
+    CHECK(decodes_to("\xe0\xa0\x80\xed\x9f\xbf\xee\x80\x80", U"\u0800\ud7ff\ue000"));
+    CHECK(decodes_to("\xf0\x90\x80\x80\xf4\x8f\xbf\xbf", U"\U00010000\U0010ffff"));
+}
+
+/**
+ * Decoding does not depend on the locale of the process */
+static void test_utf8_c_locale()
+{
+    char* saved = strdup(setlocale(LC_ALL, NULL));
+    setlocale(LC_ALL, "C");
+
+    CHECK(decodes_to("\xc3\xa9\xe6\xbc\xa2\xf0\x9f\x98\x80", U"\u00e9\u6f22\U0001f600"));
+    CHECK(decodes_to("\xe6\xbc" "x", U"\ufffdx"));
+
+    setlocale(LC_ALL, saved);
+    free(saved);
+}
+
+/**
+ * Lines past the scrollback size go to the scrollback file and come back when scrolling past the
+ * oldest line in memory */
+static void test_scrollback_spill()
+{
+    settings.scrollback_spill = true;
+    Vt vt                     = make_vt(10, 5, 100);
+    settings.scrollback_spill = false;
+    CHECK(vt.spill.is_open);
+
+    char buf[32];
+    for (uint32_t i = 0; i < 1000; ++i) {
+        int len = snprintf(buf, sizeof(buf), "\e[38;2;%u;0;0m%u\r\n", i & 0xff, i);
+        Vt_interpret(&vt, buf, len);
+    }
+
+    CHECK(vt.lines.size == 105);
+    CHECK(vt.spill.nentries == 896);
+
+    for (uint32_t i = 0; i < 1000; ++i)
+        Vt_visual_scroll_up(&vt);
+
+    CHECK(vt.spill.nentries == 0);
+    CHECK(vt.visual_scroll_top == 0);
+    CHECK(vt.lines.size == 1001);
+    for (uint32_t i = 0; i < 1000; i += 111) {
+        Vt_visual_scroll_to(&vt, i);
+        VtLine* line = &vt.lines.buf[i];
+        snprintf(buf, sizeof(buf), "%u", i);
+        CHECK(line->data.size == strlen(buf));
+        CHECK(line->data.size && line->data.buf[0].rune.code == (char32_t)buf[0]);
+        CHECK(line->data.size && line->data.buf[0].fg.r == (i & 0xff));
+    }
+
+    /* back at the bottom, lines are moved to the file again */
+    Vt_visual_scroll_reset(&vt);
+    interpret(&vt, "x\r\n");
+    CHECK(vt.lines.size == 105);
+    CHECK(vt.spill.nentries == 897);
+
+    Vt_destroy(&vt);
+}
+
+/**
+ * Rows of a snapshot keep their proxies when the screen scrolls and only lines with new contents
+ * are damaged */
+static void test_snapshot()
+{
+    Vt         vt   = make_vt(10, 5, 1000);
+    VtSnapshot snap = VtSnapshot_new();
+    interpret(&vt, "a\r\nb\r\nc");
+    VtSnapshot_update(&snap, &vt);
+
+    CHECK(snap.view.lines.size == 5 && snap.top == 0);
+    CHECK(snap.view.lines.buf[1].data.buf[0].rune.code == 'b');
+    CHECK(snap.view.lines.buf[1].damage.type == VT_LINE_DAMAGE_FULL);
+    CHECK(vt.lines.buf[1].damage.type == VT_LINE_DAMAGE_NONE);
+
+    /* pretend the rows were drawn */
+    for (uint32_t i = 0; i < snap.view.lines.size; ++i) {
+        snap.view.lines.buf[i].proxy.data[0] = i + 1;
+        snap.view.lines.buf[i].damage.type   = VT_LINE_DAMAGE_NONE;
+    }
+
+    interpret(&vt, "\r\n\r\n\r\nd");
+    VtSnapshot_update(&snap, &vt);
+
+    CHECK(snap.top == 1);
+    CHECK(snap.view.lines.buf[0].data.buf[0].rune.code == 'b');
+    CHECK(snap.view.lines.buf[0].proxy.data[0] == 2);
+    CHECK(snap.view.lines.buf[0].damage.type == VT_LINE_DAMAGE_NONE);
+    CHECK(snap.view.lines.buf[1].proxy.data[0] == 3);
+    CHECK(snap.view.lines.buf[4].data.buf[0].rune.code == 'd');
+    CHECK(snap.view.lines.buf[4].damage.type == VT_LINE_DAMAGE_FULL);
+    CHECK(snap.view.cursor.row == 4);
+
+    /* selection starting above the screen */
+    vt.selection = (struct Selection){ .mode           = SELECT_MODE_NORMAL,
+                                       .begin_line     = 0,
+                                       .begin_char_idx = 3,
+                                       .end_line       = 2,
+                                       .end_char_idx   = 1 };
+    VtSnapshot_update(&snap, &vt);
+    CHECK(Vt_is_cell_selected(&snap.view, 5, 0));
+    CHECK(Vt_is_cell_selected(&snap.view, 1, 1));
+    CHECK(!Vt_is_cell_selected(&snap.view, 2, 1));
+    CHECK(!Vt_is_cell_selected(&snap.view, 0, 2));
+
+    VtSnapshot_destroy(&snap);
+    Vt_destroy(&vt);
+}
+
+int main(int argc, char** argv)
+{
+    setlocale(LC_ALL, "C.UTF-8");
+    Vt_destroy_line_proxy = noop_proxy;
+
+    test_csi_too_many_params();
+    test_sgr();
+    test_osc_terminators();
+    test_sequence_cancelled();
+    test_command_string_escape();
+    test_csi_marker_and_intermediate();
+    test_csi_executes_controls();
+    test_ascii_run_wraps();
+    test_ascii_run_no_auto_wrap();
+    test_ascii_run_dec_graphics();
+    test_ascii_run_inverted();
+    test_utf8_split();
+    test_utf8_invalid();
+    test_utf8_rejected_forms();
+    test_utf8_c_locale();
+    test_erase();
+    test_scroll_region();
+    test_alt_screen_reused();
+    test_combining_after_scrolled_out_line();
+    test_combining_after_evicted_line();
+    test_combining_cluster();
+    test_combining_compose();
+    test_cluster_table_reclaimed();
+    test_tab_stops();
+    test_style_table_reclaimed();
+    test_scrollback_dedup();
+    test_resize_keeps_history_compact();
+    test_resize_reflows_history_in_steps();
+    test_resize_reslices_frozen_lines();
+    test_scrollback_spill();
+    test_snapshot();
+
+    if (failed) {
+        fprintf(stderr, "%u check(s) failed\n", failed);
+        return EXIT_FAILURE;
+    }
+
+    puts("all tests passed");
+    return EXIT_SUCCESS;
+}